@@ -0,0 +1,17 @@
+# Times each phase of the solver over a sweep of containers, particle counts,
+# smoothing radii and thread counts, and writes the results as CSV or JSON.
+# It still links the Qt GUI and OpenGL modules, see simulation.pri.
+
+TARGET = tp3-benchmark
+TEMPLATE = app
+
+include(simulation.pri)
+
+SOURCES += \
+    src/Benchmark/*.cpp
+
+HEADERS += \
+    src/Benchmark/*.h
+
+OBJECTS_DIR = build/benchmark
+MOC_DIR = build/benchmark
@@ -0,0 +1,13 @@
+# Runs a scene for a fixed number of steps without any window or GL context.
+# It still links the Qt GUI and OpenGL modules, see simulation.pri.
+
+TARGET = tp3-headless
+TEMPLATE = app
+
+include(simulation.pri)
+
+SOURCES += \
+    src/Headless/*.cpp
+
+OBJECTS_DIR = build/headless
+MOC_DIR = build/headless
@@ -0,0 +1,52 @@
+# Simulation sources and build flags shared by the command line targets
+# ( headless runs, benchmarks ). Everything except the main window and the
+# GL widget is included, so scenes can be built without a window.
+#
+# Limitation : the GUI and OpenGL modules are still linked. The simulation uses
+# the vector and matrix types of QtGui, and Geometry, Particles and the
+# marching tetrahedra hold QGLBuffer members for their render path. These
+# targets need no display and make no GL call, but the Qt GUI and OpenGL
+# libraries ( and libGL ) must be installed on the nodes that run them.
+
+QT += core gui opengl
+
+CONFIG += console silent
+CONFIG -= app_bundle
+
+DEFINES += _USE_MATH_DEFINES
+
+CONFIG(debug,debug|release) {
+} else {
+    QMAKE_CXXFLAGS -= -O2
+    QMAKE_CXXFLAGS += -O3 -fopenmp
+    QMAKE_LFLAGS -= -O1
+    QMAKE_LFLAGS += -O3 -fopenmp
+}
+
+CONFIG += c++11
+QMAKE_CFLAGS += -std=c99
+
+contains(QT_VERSION, ^4.*) {
+QMAKE_CXXFLAGS += -std=gnu++0x
+}
+
+SOURCES += \
+    src/Geometry/*.cpp \
+    src/Scenes/*.cpp \
+    src/SPH/*.cpp \
+    src/GLShader.cpp \
+    src/Material.cpp \
+    src/TimeState.cpp
+
+HEADERS += \
+    src/Geometry/*.h \
+    src/Scenes/*.h \
+    src/SPH/*.h \
+    src/GLShader.h \
+    src/Material.h \
+    src/TimeState.h
+
+INCLUDEPATH += \
+    src/
+
+DESTDIR = ./
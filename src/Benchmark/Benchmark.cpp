@@ -0,0 +1,437 @@
+#include "Benchmark.h"
+#include "Geometry/Cube.h"
+#include "Geometry/Cylinder.h"
+#include "Geometry/Sphere.h"
+#include "Geometry/TriangleMesh.h"
+#include <QElapsedTimer>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace
+{
+    // Same fluid properties as the scenes
+    const float Viscosity = 20;
+    const float Pressure = 5000;
+    const float SurfaceTension = 0.3;
+    const float RestDensity = 998.29;
+    const unsigned int NbSurfaceCubes = 30;
+
+    // The scenes use grid cells of about 2/3 of the smoothing radius
+    const float CellSizeRatio = 2.0 / 3.0;
+
+    // The scenes fill their whole container, which the incompressible solvers
+    // cannot fit. The fluid takes this fraction of the container instead.
+    const float FillRatio = 0.4;
+
+    // Mesh containers collide on a sampled distance, with this many cells along their longest side
+    const unsigned int SignedDistanceResolution = 64;
+}
+
+Benchmark::Benchmark()
+    : _nbWarmupFrames( 5 )
+    , _nbFrames( 50 )
+    , _deltaTime( 0.005 )
+    , _adaptiveTimeStep( false )
+{
+    _containers = containerNames();
+    _solvers << SPH::SolverEquationOfState;
+    _kernels << SPH::KernelPoly6Spiky;
+    _precisions << SPH::PrecisionSingle;
+    _particleCounts << 3000;
+    _smoothingRadii << 0.09;
+    _threadCounts << 0;
+    _reorderIntervals << 0;
+}
+
+void Benchmark::setContainers( const QStringList& containers )
+{
+    _containers = containers;
+}
+
+void Benchmark::setSolvers( const QVector<SPH::Solver>& solvers )
+{
+    _solvers = solvers;
+}
+
+void Benchmark::setKernels( const QVector<SPH::Kernel>& kernels )
+{
+    _kernels = kernels;
+}
+
+void Benchmark::setPrecisions( const QVector<SPH::Precision>& precisions )
+{
+    _precisions = precisions;
+}
+
+void Benchmark::setParticleCounts( const QVector<unsigned int>& particleCounts )
+{
+    _particleCounts = particleCounts;
+}
+
+void Benchmark::setSmoothingRadii( const QVector<float>& smoothingRadii )
+{
+    _smoothingRadii = smoothingRadii;
+}
+
+void Benchmark::setThreadCounts( const QVector<int>& threadCounts )
+{
+    _threadCounts = threadCounts;
+}
+
+void Benchmark::setReorderIntervals( const QVector<unsigned int>& reorderIntervals )
+{
+    _reorderIntervals = reorderIntervals;
+}
+
+void Benchmark::setFrames( unsigned int nbWarmupFrames, unsigned int nbFrames )
+{
+    _nbWarmupFrames = nbWarmupFrames;
+    _nbFrames = nbFrames;
+}
+
+void Benchmark::setTimeStep( float deltaTime )
+{
+    _deltaTime = deltaTime;
+}
+
+void Benchmark::setAdaptiveTimeStep( bool adaptiveTimeStep )
+{
+    _adaptiveTimeStep = adaptiveTimeStep;
+}
+
+QStringList Benchmark::containerNames()
+{
+    QStringList names;
+    names << "sphere" << "cube" << "cylinder";
+
+    return names;
+}
+
+bool Benchmark::isContainer( const QString& name )
+{
+    // Besides the analytic shapes, any OBJ or PLY mesh
+    QString lowerName = name.toLower();
+
+    return containerNames().contains( name ) || lowerName.endsWith( ".obj" ) || lowerName.endsWith( ".ply" );
+}
+
+QStringList Benchmark::solverNames()
+{
+    QStringList names;
+    names << SPH::solverName( SPH::SolverEquationOfState )
+          << SPH::solverName( SPH::SolverPCISPH )
+          << SPH::solverName( SPH::SolverDFSPH );
+
+    return names;
+}
+
+QStringList Benchmark::kernelNames()
+{
+    QStringList names;
+    names << SPH::kernelName( SPH::KernelPoly6Spiky )
+          << SPH::kernelName( SPH::KernelCubicSpline )
+          << SPH::kernelName( SPH::KernelWendlandC2 );
+
+    return names;
+}
+
+QStringList Benchmark::precisionNames()
+{
+    QStringList names;
+    names << SPH::precisionName( SPH::PrecisionSingle )
+          << SPH::precisionName( SPH::PrecisionMixed )
+          << SPH::precisionName( SPH::PrecisionDouble );
+
+    return names;
+}
+
+bool Benchmark::run( QTextStream& log )
+{
+    _results.clear();
+
+    // A thread count of 0 runs with the count OpenMP started with
+    int defaultThreads = 1;
+
+#ifdef _OPENMP
+    defaultThreads = omp_get_max_threads();
+#endif
+
+    for ( int c=0 ; c<_containers.size() ; ++c )
+        for ( int s=0 ; s<_solvers.size() ; ++s )
+            for ( int k=0 ; k<_kernels.size() ; ++k )
+                for ( int f=0 ; f<_precisions.size() ; ++f )
+                    for ( int p=0 ; p<_particleCounts.size() ; ++p )
+                        for ( int r=0 ; r<_smoothingRadii.size() ; ++r )
+                            for ( int t=0 ; t<_threadCounts.size() ; ++t )
+                                for ( int o=0 ; o<_reorderIntervals.size() ; ++o )
+                                {
+                                    Configuration configuration;
+                                    configuration.container = _containers[c];
+                                    configuration.solver = _solvers[s];
+                                    configuration.kernel = _kernels[k];
+                                    configuration.precision = _precisions[f];
+                                    configuration.nbParticles = _particleCounts[p];
+                                    configuration.smoothingRadius = _smoothingRadii[r];
+                                    configuration.nbThreads = _threadCounts[t];
+                                    configuration.reorderInterval = _reorderIntervals[o];
+
+                                    Result result;
+
+                                    if ( !runConfiguration( configuration, defaultThreads, result ) )
+                                    {
+                                        log << "Cannot load the container " << configuration.container << endl;
+                                        _results.clear();
+#ifdef _OPENMP
+                                        omp_set_num_threads( defaultThreads );
+#endif
+                                        return false;
+                                    }
+
+                                    _results.append( result );
+
+                                    log << result.configuration.container
+                                        << " solver=" << SPH::solverName( result.configuration.solver )
+                                        << " kernel=" << SPH::kernelName( result.configuration.kernel )
+                                        << " precision=" << SPH::precisionName( result.configuration.precision )
+                                        << " particles=" << result.configuration.nbParticles
+                                        << " h=" << result.configuration.smoothingRadius
+                                        << " threads=" << result.configuration.nbThreads
+                                        << " reorder=" << result.configuration.reorderInterval
+                                        << " : " << result.total << " ms/frame"
+                                        << " ( forces " << result.forces << " ms, reorder " << result.reorder << " ms ), "
+                                        << result.stepsPerSecond << " steps/s" << endl;
+                                }
+
+#ifdef _OPENMP
+    omp_set_num_threads( defaultThreads );
+#endif
+
+    return true;
+}
+
+const QVector<Benchmark::Result>& Benchmark::results() const
+{
+    return _results;
+}
+
+void Benchmark::writeCsv( QTextStream& stream ) const
+{
+    stream << "container,solver,kernel,precision,particles,smoothing_radius,threads,reorder_interval,frames,steps_per_second,"
+              "pressure_iterations,divergence_iterations,"
+              "neighbors_ms,densities_ms,forces_ms,pressure_ms,move_ms,reorder_ms,surface_ms,total_ms" << endl;
+
+    for ( int i=0 ; i<_results.size() ; ++i )
+    {
+        const Result& result = _results[i];
+
+        stream << result.configuration.container << ","
+               << SPH::solverName( result.configuration.solver ) << ","
+               << SPH::kernelName( result.configuration.kernel ) << ","
+               << SPH::precisionName( result.configuration.precision ) << ","
+               << result.configuration.nbParticles << ","
+               << result.configuration.smoothingRadius << ","
+               << result.configuration.nbThreads << ","
+               << result.configuration.reorderInterval << ","
+               << result.nbFrames << ","
+               << result.stepsPerSecond << ","
+               << result.pressureIterations << ","
+               << result.divergenceIterations << ","
+               << result.neighbors << ","
+               << result.densities << ","
+               << result.forces << ","
+               << result.pressure << ","
+               << result.move << ","
+               << result.reorder << ","
+               << result.surface << ","
+               << result.total << endl;
+    }
+}
+
+void Benchmark::writeJson( QTextStream& stream ) const
+{
+    stream << "[" << endl;
+
+    for ( int i=0 ; i<_results.size() ; ++i )
+    {
+        const Result& result = _results[i];
+
+        stream << "  { \"container\": \"" << result.configuration.container << "\""
+               << ", \"solver\": \"" << SPH::solverName( result.configuration.solver ) << "\""
+               << ", \"kernel\": \"" << SPH::kernelName( result.configuration.kernel ) << "\""
+               << ", \"precision\": \"" << SPH::precisionName( result.configuration.precision ) << "\""
+               << ", \"particles\": " << result.configuration.nbParticles
+               << ", \"smoothing_radius\": " << result.configuration.smoothingRadius
+               << ", \"threads\": " << result.configuration.nbThreads
+               << ", \"reorder_interval\": " << result.configuration.reorderInterval
+               << ", \"frames\": " << result.nbFrames
+               << ", \"steps_per_second\": " << result.stepsPerSecond
+               << ", \"pressure_iterations\": " << result.pressureIterations
+               << ", \"divergence_iterations\": " << result.divergenceIterations
+               << ", \"neighbors_ms\": " << result.neighbors
+               << ", \"densities_ms\": " << result.densities
+               << ", \"forces_ms\": " << result.forces
+               << ", \"pressure_ms\": " << result.pressure
+               << ", \"move_ms\": " << result.move
+               << ", \"reorder_ms\": " << result.reorder
+               << ", \"surface_ms\": " << result.surface
+               << ", \"total_ms\": " << result.total
+               << " }" << ( i+1 < _results.size() ? "," : "" ) << endl;
+    }
+
+    stream << "]" << endl;
+}
+
+bool Benchmark::runConfiguration( const Configuration& configuration, int defaultThreads, Result& result ) const
+{
+    result.configuration = configuration;
+    result.nbFrames = _nbFrames;
+    result.stepsPerSecond = 0;
+    result.pressureIterations = 0;
+    result.divergenceIterations = 0;
+    result.neighbors = 0;
+    result.densities = 0;
+    result.forces = 0;
+    result.pressure = 0;
+    result.move = 0;
+    result.reorder = 0;
+    result.surface = 0;
+    result.total = 0;
+
+#ifdef _OPENMP
+    omp_set_num_threads( configuration.nbThreads > 0 ? configuration.nbThreads : defaultThreads );
+    result.configuration.nbThreads = omp_get_max_threads();
+#else
+    Q_UNUSED( defaultThreads );
+    result.configuration.nbThreads = 1;
+#endif
+
+    float containerVolume = 0;
+    Geometry* container = createContainer( configuration.container, containerVolume );
+    if ( !container )
+        return false;
+
+    // Same grid resolution relative to the smoothing radius as the scenes
+    BoundingBox boundingBox = container->boundingBox();
+    QVector3D extent = ( boundingBox.maximum() - boundingBox.minimum() ) * 1.2;
+    float cellSize = configuration.smoothingRadius * CellSizeRatio;
+    unsigned int nbCellX = std::max( 1, int( extent.x() / cellSize ) );
+    unsigned int nbCellY = std::max( 1, int( extent.y() / cellSize ) );
+    unsigned int nbCellZ = std::max( 1, int( extent.z() / cellSize ) );
+
+    SPH sph( 0, *container,
+             configuration.smoothingRadius, Viscosity, Pressure, SurfaceTension,
+             nbCellX, nbCellY, nbCellZ,
+             NbSurfaceCubes, NbSurfaceCubes, NbSurfaceCubes,
+             configuration.nbParticles,
+             RestDensity,
+             containerVolume * FillRatio,
+             _deltaTime,
+             QVector3D( 0, -9.81, 0 ) );
+    container->setParent( &sph );
+    sph.update();
+    sph.setSolver( configuration.solver );
+    sph.setKernel( configuration.kernel );
+    sph.setPrecision( configuration.precision );
+    sph.setReorderInterval( configuration.reorderInterval );
+
+    for ( unsigned int i=0 ; i<_nbWarmupFrames ; ++i )
+    {
+        if ( _adaptiveTimeStep )
+            sph.advance( _deltaTime );
+        else
+            sph.step( _deltaTime );
+    }
+
+    QElapsedTimer timer;
+    double simulatedTime = 0;
+    unsigned int nbSteps = 0;
+
+    for ( unsigned int i=0 ; i<_nbFrames ; ++i )
+    {
+        if ( _adaptiveTimeStep )
+            simulatedTime += sph.advance( _deltaTime );
+        else
+        {
+            sph.step( _deltaTime );
+            simulatedTime += _deltaTime;
+        }
+
+        const SPH::StepTimings& timings = sph.lastStepTimings();
+        result.neighbors += timings.neighbors;
+        result.densities += timings.densities;
+        result.forces += timings.forces;
+        result.pressure += timings.pressure;
+        result.move += timings.move;
+        result.reorder += timings.reorder;
+
+        nbSteps += sph.lastSubstepCount();
+        result.pressureIterations += sph.lastPressureIterations();
+        result.divergenceIterations += sph.lastDivergenceIterations();
+
+        timer.start();
+        sph.computeSurfaceValues();
+        result.surface += timer.nsecsElapsed();
+    }
+
+    // Nanoseconds in total to milliseconds per frame
+    double scale = _nbFrames > 0 ? 1.0e-6 / _nbFrames : 0;
+    result.neighbors *= scale;
+    result.densities *= scale;
+    result.forces *= scale;
+    result.pressure *= scale;
+    result.move *= scale;
+    result.reorder *= scale;
+    result.surface *= scale;
+    result.total = result.neighbors + result.densities + result.forces + result.pressure + result.move + result.reorder + result.surface;
+
+    if ( nbSteps > 0 )
+    {
+        result.stepsPerSecond = nbSteps / simulatedTime;
+        result.pressureIterations /= nbSteps;
+        result.divergenceIterations /= nbSteps;
+    }
+
+    container->setParent( 0 );
+    delete container;
+    return true;
+}
+
+Geometry* Benchmark::createContainer( const QString& name, float& volume )
+{
+    if ( name == "sphere" )
+    {
+        volume = M_PI / 6;
+        return new Sphere( 0, Material() );
+    }
+
+    if ( name == "cube" )
+    {
+        volume = 1;
+        return new Cube( 0, Material() );
+    }
+
+    if ( name == "cylinder" )
+    {
+        volume = M_PI / 4;
+        return new Cylinder( 0, Material() );
+    }
+
+    if ( isContainer( name ) )
+    {
+        TriangleMesh* mesh = new TriangleMesh( 0, Material() );
+
+        if ( !mesh->load( name ) )
+        {
+            delete mesh;
+            return 0;
+        }
+
+        mesh->bakeSignedDistance( SignedDistanceResolution );
+        volume = mesh->volume();
+        return mesh;
+    }
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "SPH/SPH.h"
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+
+/* Runs the solver over every combination of container, pressure solver,
+ * smoothing kernel, precision, particle count, smoothing radius, thread count and reordering interval, and
+ * measures the mean time per frame of each phase ( neighbor search, densities,
+ * forces, pressure solve, integration with the grid update, Z-order sorts of
+ * the particles, and the implicit surface evaluation of the marching
+ * tetrahedra ).
+ *
+ * A frame is a single step of 'dt', or 'dt' seconds of substeps with adaptive
+ * time stepping. The number of steps per simulated second and the solver
+ * iterations per step are reported along the timings.
+ */
+
+class Benchmark
+{
+public:
+    struct Configuration
+    {
+        QString container;
+        SPH::Solver solver;
+        SPH::Kernel kernel;
+        SPH::Precision precision;
+        unsigned int nbParticles;
+        float smoothingRadius;
+        int nbThreads;
+        unsigned int reorderInterval;
+    };
+
+    // Mean time per frame of each phase, in milliseconds
+    struct Result
+    {
+        Configuration configuration;
+        unsigned int nbFrames;
+        double stepsPerSecond;
+        double pressureIterations;
+        double divergenceIterations;
+        double neighbors;
+        double densities;
+        double forces;
+        double pressure;
+        double move;
+        double reorder;
+        double surface;
+        double total;
+    };
+
+    Benchmark();
+
+    void setContainers( const QStringList& containers );
+    void setSolvers( const QVector<SPH::Solver>& solvers );
+    void setKernels( const QVector<SPH::Kernel>& kernels );
+    void setPrecisions( const QVector<SPH::Precision>& precisions );
+    void setParticleCounts( const QVector<unsigned int>& particleCounts );
+    void setSmoothingRadii( const QVector<float>& smoothingRadii );
+    void setThreadCounts( const QVector<int>& threadCounts );
+    void setReorderIntervals( const QVector<unsigned int>& reorderIntervals );
+    void setFrames( unsigned int nbWarmupFrames, unsigned int nbFrames );
+    void setTimeStep( float deltaTime );
+    void setAdaptiveTimeStep( bool adaptiveTimeStep );
+
+    static QStringList containerNames();
+    static bool isContainer( const QString& name );
+    static QStringList solverNames();
+    static QStringList kernelNames();
+    static QStringList precisionNames();
+
+    // Runs every configuration, reporting progress on 'log'. Fails, with no
+    // results, when a container cannot be loaded.
+    bool run( QTextStream& log );
+    const QVector<Result>& results() const;
+
+    void writeCsv( QTextStream& stream ) const;
+    void writeJson( QTextStream& stream ) const;
+
+private:
+    bool runConfiguration( const Configuration& configuration, int defaultThreads, Result& result ) const;
+    static Geometry* createContainer( const QString& name, float& volume );
+
+private:
+    QStringList _containers;
+    QVector<SPH::Solver> _solvers;
+    QVector<SPH::Kernel> _kernels;
+    QVector<SPH::Precision> _precisions;
+    QVector<unsigned int> _particleCounts;
+    QVector<float> _smoothingRadii;
+    QVector<int> _threadCounts;
+    QVector<unsigned int> _reorderIntervals;
+    unsigned int _nbWarmupFrames;
+    unsigned int _nbFrames;
+    float _deltaTime;
+    bool _adaptiveTimeStep;
+
+    QVector<Result> _results;
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,205 @@
+#include "Benchmark/Benchmark.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+
+/* Usage : tp3-benchmark [--containers sphere,cube,cylinder,mesh.obj] [--solvers eos,pcisph,dfsph]
+ *                       [--kernels poly6,cubic,wendland] [--precisions single,mixed,double]
+ *                       [--particles 1000,3000] [--radii 0.06,0.09] [--threads 1,2,4] [--reorder 0,20]
+ *                       [--frames N] [--warmup N] [--dt seconds] [--adaptive 0|1]
+ *                       [--csv file] [--json file]
+ *
+ * A thread count of 0 uses the OpenMP default, and a reorder interval of 0
+ * never sorts the particles. Containers ending with .obj or .ply are loaded as
+ * triangle meshes. Results are printed as CSV on the standard output when no
+ * output file is given.
+ */
+
+static void usage( QTextStream& out )
+{
+    out << "Usage: tp3-benchmark [--containers " << Benchmark::containerNames().join( "," ) << ",mesh.obj,mesh.ply]"
+        << " [--solvers " << Benchmark::solverNames().join( "," ) << "]"
+        << " [--kernels " << Benchmark::kernelNames().join( "," ) << "]"
+        << " [--precisions " << Benchmark::precisionNames().join( "," ) << "]"
+        << " [--particles N,...] [--radii h,...] [--threads N,...] [--reorder steps,...]"
+        << " [--frames N] [--warmup N] [--dt seconds] [--adaptive 0|1]"
+        << " [--csv file] [--json file]" << endl;
+}
+
+template<typename T>
+static bool parseList( const QString& argument, QVector<T>& values )
+{
+    QStringList items = argument.split( "," );
+
+    values.clear();
+    for ( int i=0 ; i<items.size() ; ++i )
+    {
+        bool ok;
+        double value = items[i].toDouble( &ok );
+        if ( !ok || value < 0 )
+            return false;
+
+        values.append( T( value ) );
+    }
+
+    return !values.isEmpty();
+}
+
+static bool writeResults( const Benchmark& benchmark, const QString& fileName, bool json )
+{
+    QFile file( fileName );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Text ) )
+        return false;
+
+    QTextStream stream( &file );
+    if ( json )
+        benchmark.writeJson( stream );
+    else
+        benchmark.writeCsv( stream );
+
+    return true;
+}
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication app( argc, argv );
+    QTextStream out( stdout );
+    QTextStream err( stderr );
+
+    Benchmark benchmark;
+    QString csvFile;
+    QString jsonFile;
+    unsigned int nbWarmupFrames = 5;
+    unsigned int nbFrames = 50;
+
+    // Every option takes a value
+    QStringList arguments = app.arguments();
+    for ( int i=1 ; i<arguments.size() ; i+=2 )
+    {
+        if ( i+1 >= arguments.size() )
+        {
+            usage( err );
+            return 1;
+        }
+
+        const QString& option = arguments[i];
+        const QString& value = arguments[i+1];
+        bool ok = true;
+
+        if ( option == "--containers" )
+        {
+            QStringList containers = value.split( "," );
+            for ( int c=0 ; c<containers.size() ; ++c )
+                ok = ok && Benchmark::isContainer( containers[c] );
+            benchmark.setContainers( containers );
+        }
+        else if ( option == "--solvers" )
+        {
+            QStringList names = value.split( "," );
+            QVector<SPH::Solver> solvers;
+            for ( int s=0 ; s<names.size() ; ++s )
+            {
+                int solver = Benchmark::solverNames().indexOf( names[s] );
+                ok = ok && solver >= 0;
+                solvers.append( SPH::Solver( solver ) );
+            }
+            benchmark.setSolvers( solvers );
+        }
+        else if ( option == "--kernels" )
+        {
+            QStringList names = value.split( "," );
+            QVector<SPH::Kernel> kernels;
+            for ( int k=0 ; k<names.size() ; ++k )
+            {
+                int kernel = Benchmark::kernelNames().indexOf( names[k] );
+                ok = ok && kernel >= 0;
+                kernels.append( SPH::Kernel( kernel ) );
+            }
+            benchmark.setKernels( kernels );
+        }
+        else if ( option == "--precisions" )
+        {
+            QStringList names = value.split( "," );
+            QVector<SPH::Precision> precisions;
+            for ( int f=0 ; f<names.size() ; ++f )
+            {
+                int precision = Benchmark::precisionNames().indexOf( names[f] );
+                ok = ok && precision >= 0;
+                precisions.append( SPH::Precision( precision ) );
+            }
+            benchmark.setPrecisions( precisions );
+        }
+        else if ( option == "--particles" )
+        {
+            QVector<unsigned int> particleCounts;
+            ok = parseList( value, particleCounts ) && !particleCounts.contains( 0 );
+            benchmark.setParticleCounts( particleCounts );
+        }
+        else if ( option == "--radii" )
+        {
+            QVector<float> smoothingRadii;
+            ok = parseList( value, smoothingRadii ) && !smoothingRadii.contains( 0 );
+            benchmark.setSmoothingRadii( smoothingRadii );
+        }
+        else if ( option == "--threads" )
+        {
+            QVector<int> threadCounts;
+            ok = parseList( value, threadCounts );
+            benchmark.setThreadCounts( threadCounts );
+        }
+        else if ( option == "--reorder" )
+        {
+            QVector<unsigned int> reorderIntervals;
+            ok = parseList( value, reorderIntervals );
+            benchmark.setReorderIntervals( reorderIntervals );
+        }
+        else if ( option == "--frames" )
+            nbFrames = value.toUInt( &ok );
+        else if ( option == "--warmup" )
+            nbWarmupFrames = value.toUInt( &ok );
+        else if ( option == "--dt" )
+        {
+            float deltaTime = value.toFloat( &ok );
+            ok = ok && deltaTime > 0;
+            benchmark.setTimeStep( deltaTime );
+        }
+        else if ( option == "--adaptive" )
+            benchmark.setAdaptiveTimeStep( value.toInt( &ok ) != 0 );
+        else if ( option == "--csv" )
+            csvFile = value;
+        else if ( option == "--json" )
+            jsonFile = value;
+        else
+            ok = false;
+
+        if ( !ok )
+        {
+            usage( err );
+            return 1;
+        }
+    }
+
+    benchmark.setFrames( nbWarmupFrames, nbFrames );
+
+    if ( !benchmark.run( err ) )
+        return 1;
+
+    if ( csvFile.isEmpty() && jsonFile.isEmpty() )
+        benchmark.writeCsv( out );
+
+    if ( !csvFile.isEmpty() && !writeResults( benchmark, csvFile, false ) )
+    {
+        err << "Cannot write " << csvFile << endl;
+        return 1;
+    }
+
+    if ( !jsonFile.isEmpty() && !writeResults( benchmark, jsonFile, true ) )
+    {
+        err << "Cannot write " << jsonFile << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include "GLWidget.h"
 #include <QKeyEvent>
 #include <QApplication>
+#include <QFileDialog>
+#include <algorithm>
 #include <cmath>
 
 GLWidget::GLWidget( QWidget* parent )
@@ -9,17 +11,85 @@ GLWidget::GLWidget( QWidget* parent )
     , _paused( false )
     , _mouseButtons( Qt::NoButton )
     , _moveContainer( false )
+    , _replayFrame( -1 )
+    , _replayTime( 0 )
 {
 }
 
 GLWidget::~GLWidget()
 {
+    _simulation.stop();
 }
 
 void GLWidget::setScene( Scene* scene )
 {
+    // The replay and the thread belong to the previous scene
+    _simulation.stop();
+
+    if ( _scene )
+        _scene->sph().hideFrame();
+
+    _replay.close();
+    _replayFrame = -1;
+    _replayTime = 0;
+
     _scene = scene;
+
+    if ( !_scene )
+        return;
+
     _scene->resizeViewport( size().width(), size().height() );
+    startSimulation();
+}
+
+bool GLWidget::startReplay( const QString& fileName )
+{
+    if ( !_scene )
+        return false;
+
+    _simulation.stop();
+
+    if ( !_replay.open( fileName ) || _replay.nbFrames() == 0 )
+    {
+        stopReplay();
+        return false;
+    }
+
+    _replayTime = _replay.frameHeader( 0 ).time;
+    showReplayFrame( 0 );
+
+    return true;
+}
+
+void GLWidget::stopReplay()
+{
+    // The simulation goes on from where the replay interrupted it
+    if ( _scene )
+        _scene->sph().hideFrame();
+
+    _replay.close();
+    _replayFrame = -1;
+    _replayTime = 0;
+
+    if ( _scene && !_simulation.isRunning() )
+        startSimulation();
+}
+
+void GLWidget::startSimulation()
+{
+    // The thread owns the SPH from here
+    _scene->update();
+    _containerTransformation = _scene->sph().localTransformation();
+    _simulation.setPaused( _paused );
+    _simulation.simulate( _scene );
+}
+
+void GLWidget::moveContainer()
+{
+    if ( _simulation.isRunning() )
+        _simulation.moveContainer( _containerTransformation );
+    else
+        _scene->sph().localTransformation() = _containerTransformation;
 }
 
 void GLWidget::onIdle()
@@ -49,17 +119,54 @@ void GLWidget::paintGL()
     if ( _scene )
     {
         _timeState.newFrame();
-        _scene->update();
 
-        if ( !_paused )
-            _scene->animate( _timeState );
+        // Only the camera belongs to this thread while the scene is simulated
+        if ( _simulation.isRunning() )
+            _scene->activeCamera().update();
+        else
+        {
+            _scene->update();
+
+            if ( _replay.isOpen() )
+                updateReplay();
+            else if ( !_paused )
+                _scene->animate( _timeState );
+
+            _scene->update();
+        }
 
-        _scene->update();
         _shader.setupCamera( _scene->activeCamera() );
         _scene->render( _shader );
     }
 }
 
+void GLWidget::updateReplay()
+{
+    if ( _paused )
+        return;
+
+    // Loops over the recording, at the pace of the recorded times
+    double firstTime = _replay.frameHeader( 0 ).time;
+    double lastTime = _replay.frameHeader( _replay.nbFrames() - 1 ).time;
+
+    _replayTime += _timeState.deltaTime();
+
+    if ( _replayTime > lastTime )
+        _replayTime = ( lastTime > firstTime ) ? firstTime + std::fmod( _replayTime - firstTime, lastTime - firstTime ) : firstTime;
+
+    int frame = _replay.frameAt( _replayTime );
+
+    if ( frame != _replayFrame )
+        showReplayFrame( frame );
+}
+
+void GLWidget::showReplayFrame( int frame )
+{
+    // A corrupted frame keeps the previous one on screen
+    if ( _scene->sph().showFrame( _replay, frame ) )
+        _replayFrame = frame;
+}
+
 void GLWidget::keyPressEvent( QKeyEvent* event )
 {
     if ( event->key() == Qt::Key_M )
@@ -69,13 +176,57 @@ void GLWidget::keyPressEvent( QKeyEvent* event )
         _scene->sph().changeMaterial();
 
     if ( event->key() == Qt::Key_0 )
-        _scene->sph().resetVelocities();
+    {
+        if ( _simulation.isRunning() )
+            _simulation.resetVelocities();
+        else
+            _scene->sph().resetVelocities();
+    }
 
     if ( event->key() == Qt::Key_Space )
         _moveContainer = true;
 
     if ( event->key() == Qt::Key_P )
+    {
         _paused = !_paused;
+        _simulation.setPaused( _paused );
+    }
+
+    if ( event->key() == Qt::Key_L && _scene )
+    {
+        QString fileName = QFileDialog::getOpenFileName( this, "Replay a trajectory", QString(), "Trajectories (*.traj);;All files (*)" );
+
+        if ( !fileName.isEmpty() )
+            startReplay( fileName );
+    }
+
+    if ( event->key() == Qt::Key_Escape )
+        stopReplay();
+
+    // Frame by frame, the replay then goes on from there
+    if ( _replay.isOpen() )
+    {
+        int lastFrame = _replay.nbFrames() - 1;
+        int frame = _replayFrame;
+
+        if ( event->key() == Qt::Key_Left )
+            frame = std::max( _replayFrame - 1, 0 );
+
+        if ( event->key() == Qt::Key_Right )
+            frame = std::min( _replayFrame + 1, lastFrame );
+
+        if ( event->key() == Qt::Key_Home )
+            frame = 0;
+
+        if ( event->key() == Qt::Key_End )
+            frame = lastFrame;
+
+        if ( frame != _replayFrame )
+        {
+            _replayTime = _replay.frameHeader( frame ).time;
+            showReplayFrame( frame );
+        }
+    }
 }
 
 void GLWidget::keyReleaseEvent( QKeyEvent* /*event*/ )
@@ -100,9 +251,8 @@ void GLWidget::mouseMoveEvent( QMouseEvent* event )
     if ( _scene )
     {
         Camera& camera = _scene->activeCamera();
-        SPH& sph = _scene->sph();
         QMatrix4x4& cameraTransformation = camera.localTransformation();
-        QMatrix4x4& sphTransformation = sph.localTransformation();
+        QMatrix4x4& sphTransformation = _containerTransformation;
         QPoint delta = event->pos() - _mousePosition;
         _mousePosition = event->pos();
 
@@ -121,7 +271,10 @@ void GLWidget::mouseMoveEvent( QMouseEvent* event )
             rotation.rotate( roll / 35.0, axisZ );
 
             if ( _moveContainer )
+            {
                 sphTransformation = rotation.inverted() * sphTransformation;
+                moveContainer();
+            }
             else
                 cameraTransformation = rotation * cameraTransformation;
         }
@@ -3,6 +3,8 @@
 
 #include "Scenes/Scene.h"
 #include "GLShader.h"
+#include "SimulationThread.h"
+#include "SPH/TrajectoryReader.h"
 #include "TimeState.h"
 #include <QGLWidget>
 #include <QLabel>
@@ -10,6 +12,13 @@
 
 /* The GLWidget displays a scene and move the scene camera on
  * mouse events.
+ *
+ * The scene is simulated on a SimulationThread, so that a step is computed
+ * while the previous one is rendered.
+ *
+ * It can also replay a trajectory recorded by the simulation ( see
+ * TrajectoryWriter ) : the recorded frames are then rendered instead of the
+ * particles of the scene at the pace of the frames, and the solver pauses.
  */
 
 class GLWidget : public QGLWidget
@@ -23,6 +32,11 @@ public:
     void setScene( Scene* scene );
     void onIdle();
 
+    // False when the file is not a trajectory or has no frame. The simulation
+    // thread is stopped during the replay.
+    bool startReplay( const QString& fileName );
+    void stopReplay();
+
 public slots:
     virtual void paintGL();
 
@@ -35,6 +49,12 @@ protected:
     virtual void mouseReleaseEvent( QMouseEvent* event );
     virtual void mouseMoveEvent( QMouseEvent* event );
 
+private:
+    void startSimulation();
+    void moveContainer();
+    void updateReplay();
+    void showReplayFrame( int frame );
+
 private:
     GLShader _shader;
     Scene* _scene;
@@ -43,6 +63,11 @@ private:
     Qt::MouseButtons _mouseButtons;
     QPoint _mousePosition;
     bool _moveContainer;
+    SimulationThread _simulation;
+    QMatrix4x4 _containerTransformation;
+    TrajectoryReader _replay;
+    int _replayFrame;
+    double _replayTime;
 };
 
 #endif // GL_WIDGET_H
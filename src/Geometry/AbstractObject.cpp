@@ -16,6 +16,11 @@ QMatrix4x4& AbstractObject::localTransformation()
     return _localTransformation;
 }
 
+const QMatrix4x4& AbstractObject::localTransformation() const
+{
+    return _localTransformation;
+}
+
 const QMatrix4x4& AbstractObject::globalTransformation() const
 {
     return _globalTransformation;
@@ -30,6 +30,7 @@ public:
     virtual ~AbstractObject();
 
     QMatrix4x4& localTransformation();
+    const QMatrix4x4& localTransformation() const;
     const QMatrix4x4& globalTransformation() const;
 
     virtual void update();
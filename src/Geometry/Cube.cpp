@@ -1,5 +1,6 @@
 #include "Cube.h"
 #include <cassert>
+#include <cmath>
 #include <cstdlib>
 #include <limits>
 
@@ -180,6 +181,37 @@ bool Cube::intersectFacet( const Ray& ray, Intersection& intersection, unsigned
     return false;
 }
 
+bool Cube::hasSignedDistance() const
+{
+    return true;
+}
+
+float Cube::signedDistance( const QVector3D& point, QVector3D& gradient ) const
+{
+    QVector3D distances( fabs( point.x() ) - side, fabs( point.y() ) - side, fabs( point.z() ) - side );
+    QVector3D signs( point.x() < 0 ? -1 : 1, point.y() < 0 ? -1 : 1, point.z() < 0 ? -1 : 1 );
+    QVector3D outside( std::max( distances.x(), 0.0f ), std::max( distances.y(), 0.0f ), std::max( distances.z(), 0.0f ) );
+    float outsideDistance = outside.length();
+
+    // Outside, the nearest point is on a face, an edge or a corner
+    if ( outsideDistance > 0 )
+    {
+        gradient = outside * signs / outsideDistance;
+        return outsideDistance;
+    }
+
+    // Inside, the nearest point is on the nearest face
+    unsigned int axis = 0;
+    for ( unsigned int i=1 ; i<3 ; ++i )
+        if ( vectorCoord( distances, i ) > vectorCoord( distances, axis ) )
+            axis = i;
+
+    gradient = QVector3D( ( axis == 0 ) ? signs.x() : 0,
+                          ( axis == 1 ) ? signs.y() : 0,
+                          ( axis == 2 ) ? signs.z() : 0 );
+    return vectorCoord( distances, axis );
+}
+
 float Cube::vectorCoord( const QVector3D& vector, unsigned int axis ) const
 {
     switch( axis )
@@ -190,6 +190,37 @@ bool Cylinder::intersect( const Ray& ray, Intersection& intersection ) const
     return false;
 }
 
+bool Cylinder::hasSignedDistance() const
+{
+    return true;
+}
+
+float Cylinder::signedDistance( const QVector3D& point, QVector3D& gradient ) const
+{
+    // Distances to the contour and to the caps, as a 2D box in the ( radial, y ) plane
+    float radialLength = QVector2D( point.x(), point.z() ).length();
+    QVector3D radial = ( radialLength > 0 ) ? QVector3D( point.x(), 0, point.z() ) / radialLength : QVector3D( 1, 0, 0 );
+    QVector3D axial( 0, point.y() < 0 ? -1 : 1, 0 );
+    float radialDistance = radialLength - radius;
+    float axialDistance = fabs( point.y() ) - side;
+
+    if ( radialDistance > 0 && axialDistance > 0 )
+    {
+        float distance = QVector2D( radialDistance, axialDistance ).length();
+        gradient = ( radialDistance * radial + axialDistance * axial ) / distance;
+        return distance;
+    }
+
+    if ( radialDistance > axialDistance )
+    {
+        gradient = radial;
+        return radialDistance;
+    }
+
+    gradient = axial;
+    return axialDistance;
+}
+
 BoundingBox Cylinder::boundingBox() const
 {
     return BoundingBox( QVector3D( -radius, -side, -radius ), QVector3D( radius, side, radius ) );
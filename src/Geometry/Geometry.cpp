@@ -54,6 +54,28 @@ bool Geometry::intersect( const Ray& /*ray*/, Intersection& /*intersection*/ ) c
     return false;
 }
 
+bool Geometry::hasSignedDistance() const
+{
+    return false;
+}
+
+float Geometry::signedDistance( const QVector3D& /*point*/, QVector3D& /*gradient*/ ) const
+{
+    assert( !"Not impemented" );
+    return 0;
+}
+
+bool Geometry::isInside( const QVector3D& point ) const
+{
+    QVector3D gradient;
+
+    if ( hasSignedDistance() )
+        return signedDistance( point, gradient ) < 0;
+
+    assert( !"Not impemented" );
+    return false;
+}
+
 void Geometry::createVertexBuffer( const QVector<QVector3D>& vertices )
 {
     _vertexBuffer.create();
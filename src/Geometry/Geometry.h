@@ -12,6 +12,10 @@
  *
  * It also requires derived class to implement an intersection test with a ray.
  *
+ * Derived classes may also provide a signed distance, negative inside, and its
+ * gradient, which is the outward normal of the nearest surface point. The
+ * inside test uses the signed distance unless overridden. Unlike
+ * 'randomInteriorPoint', both are safe to call from several threads.
  */
 
 class Geometry : public AbstractObject
@@ -22,6 +26,9 @@ public:
 
     virtual void render( GLShader& shader );
     virtual bool intersect( const Ray& ray, Intersection& intersection ) const;
+    virtual bool hasSignedDistance() const;
+    virtual float signedDistance( const QVector3D& point, QVector3D& gradient ) const;
+    virtual bool isInside( const QVector3D& point ) const;
     virtual BoundingBox boundingBox() const=0;
     virtual QVector3D randomInteriorPoint() const=0;
 
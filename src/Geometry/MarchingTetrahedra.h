@@ -16,11 +16,11 @@ public:
     MarchingTetrahedra( const BoundingBox& boundingBox, unsigned int nbCubeX, unsigned int nbCubeY, unsigned int nbCubeZ );
 
     void render( const QMatrix4x4& transformation, GLShader& shader, ImplicitSurface& implicitSurface );
+    void computeVertexInfo( ImplicitSurface& implicitSurface );
 
 private:
     void computeVertexPositions();
 
-    void computeVertexInfo( ImplicitSurface& implicitSurface );
     void renderCube( unsigned int x, unsigned int y, unsigned int z );
     void renderTetrahedron(int p1, int p2, int p3, int p4);
     void renderTriangle(int in1, int out2, int out3, int out4);
@@ -0,0 +1,130 @@
+#include "SignedDistanceField.h"
+#include <algorithm>
+#include <cmath>
+
+SignedDistanceField::SignedDistanceField()
+{
+    _nbCell[0] = _nbCell[1] = _nbCell[2] = 0;
+    _cellSize[0] = _cellSize[1] = _cellSize[2] = 0;
+}
+
+SignedDistanceField::SignedDistanceField( const BoundingBox& boundingBox, unsigned int nbCellX, unsigned int nbCellY, unsigned int nbCellZ )
+    : _boundingBox( boundingBox )
+{
+    QVector3D boxSize = _boundingBox.maximum() - _boundingBox.minimum();
+
+    _nbCell[0] = std::max( 1u, nbCellX );
+    _nbCell[1] = std::max( 1u, nbCellY );
+    _nbCell[2] = std::max( 1u, nbCellZ );
+    _cellSize[0] = boxSize.x() / _nbCell[0];
+    _cellSize[1] = boxSize.y() / _nbCell[1];
+    _cellSize[2] = boxSize.z() / _nbCell[2];
+
+    _samples.fill( 0, nbSamples( 0 ) * nbSamples( 1 ) * nbSamples( 2 ) );
+}
+
+bool SignedDistanceField::isEmpty() const
+{
+    return _samples.isEmpty();
+}
+
+const BoundingBox& SignedDistanceField::boundingBox() const
+{
+    return _boundingBox;
+}
+
+unsigned int SignedDistanceField::nbSamples( unsigned int axis ) const
+{
+    return _nbCell[axis] + 1;
+}
+
+QVector3D SignedDistanceField::samplePosition( unsigned int x, unsigned int y, unsigned int z ) const
+{
+    return _boundingBox.minimum() + QVector3D( x * _cellSize[0], y * _cellSize[1], z * _cellSize[2] );
+}
+
+void SignedDistanceField::setSample( unsigned int x, unsigned int y, unsigned int z, float distance )
+{
+    _samples[sampleIndex( x, y, z )] = distance;
+}
+
+float SignedDistanceField::distance( const QVector3D& point, QVector3D& gradient ) const
+{
+    const QVector3D& minimum = _boundingBox.minimum();
+    const QVector3D& maximum = _boundingBox.maximum();
+
+    // Nearest point of the box
+    QVector3D clamped( std::min( std::max( point.x(), minimum.x() ), maximum.x() ),
+                       std::min( std::max( point.y(), minimum.y() ), maximum.y() ),
+                       std::min( std::max( point.z(), minimum.z() ), maximum.z() ) );
+    QVector3D relative = clamped - minimum;
+
+    // Cell and position inside the cell
+    float coords[3] = { relative.x() / _cellSize[0], relative.y() / _cellSize[1], relative.z() / _cellSize[2] };
+    unsigned int cell[3];
+    float f[3];
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        cell[axis] = std::min<unsigned int>( (unsigned int)coords[axis], _nbCell[axis] - 1 );
+        f[axis] = coords[axis] - cell[axis];
+    }
+
+    const float* s = _samples.constData();
+    float d000 = s[sampleIndex( cell[0],     cell[1],     cell[2]     )];
+    float d100 = s[sampleIndex( cell[0] + 1, cell[1],     cell[2]     )];
+    float d010 = s[sampleIndex( cell[0],     cell[1] + 1, cell[2]     )];
+    float d110 = s[sampleIndex( cell[0] + 1, cell[1] + 1, cell[2]     )];
+    float d001 = s[sampleIndex( cell[0],     cell[1],     cell[2] + 1 )];
+    float d101 = s[sampleIndex( cell[0] + 1, cell[1],     cell[2] + 1 )];
+    float d011 = s[sampleIndex( cell[0],     cell[1] + 1, cell[2] + 1 )];
+    float d111 = s[sampleIndex( cell[0] + 1, cell[1] + 1, cell[2] + 1 )];
+
+    // Interpolate along x, then y, then z
+    float d00 = d000 + f[0] * ( d100 - d000 );
+    float d10 = d010 + f[0] * ( d110 - d010 );
+    float d01 = d001 + f[0] * ( d101 - d001 );
+    float d11 = d011 + f[0] * ( d111 - d011 );
+    float d0 = d00 + f[1] * ( d10 - d00 );
+    float d1 = d01 + f[1] * ( d11 - d01 );
+    float value = d0 + f[2] * ( d1 - d0 );
+
+    // Derivatives of the interpolation
+    float dx0 = ( d100 - d000 ) + f[1] * ( ( d110 - d010 ) - ( d100 - d000 ) );
+    float dx1 = ( d101 - d001 ) + f[1] * ( ( d111 - d011 ) - ( d101 - d001 ) );
+    float dy0 = d10 - d00;
+    float dy1 = d11 - d01;
+
+    gradient = QVector3D( ( dx0 + f[2] * ( dx1 - dx0 ) ) / _cellSize[0],
+                          ( dy0 + f[2] * ( dy1 - dy0 ) ) / _cellSize[1],
+                          ( d1 - d0 ) / _cellSize[2] );
+
+    float gradientLength = gradient.length();
+    gradient = ( gradientLength > 0 ) ? gradient / gradientLength : QVector3D( 0, 1, 0 );
+
+    // Outside of the box, extrapolate from the surface point nearest to the box point
+    QVector3D outside = point - clamped;
+    float outsideLength = outside.length();
+
+    if ( outsideLength > 0 )
+    {
+        QVector3D toSurface = outside + value * gradient;
+        float toSurfaceLength = toSurface.length();
+
+        if ( value < 0 || toSurfaceLength == 0 )
+        {
+            gradient = outside / outsideLength;
+            return value + outsideLength;
+        }
+
+        gradient = toSurface / toSurfaceLength;
+        return toSurfaceLength;
+    }
+
+    return value;
+}
+
+unsigned int SignedDistanceField::sampleIndex( unsigned int x, unsigned int y, unsigned int z ) const
+{
+    return ( z * nbSamples( 1 ) + y ) * nbSamples( 0 ) + x;
+}
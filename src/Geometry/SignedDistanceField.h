@@ -0,0 +1,41 @@
+#ifndef SIGNEDDISTANCEFIELD_H
+#define SIGNEDDISTANCEFIELD_H
+
+#include "Geometry/BoundingBox.h"
+#include <QVector3D>
+#include <QVector>
+
+/* A signed distance sampled on the nodes of a regular grid over a bounding
+ * box, and evaluated by trilinear interpolation. The gradient is the exact
+ * derivative of the interpolation, normalized. Outside of the box, the
+ * distance is extrapolated from the surface point nearest to the nearest
+ * point of the box.
+ */
+
+class SignedDistanceField
+{
+public:
+    SignedDistanceField();
+    SignedDistanceField( const BoundingBox& boundingBox, unsigned int nbCellX, unsigned int nbCellY, unsigned int nbCellZ );
+
+    bool isEmpty() const;
+    const BoundingBox& boundingBox() const;
+
+    // Samples are on the nodes, nbCell+1 per axis
+    unsigned int nbSamples( unsigned int axis ) const;
+    QVector3D samplePosition( unsigned int x, unsigned int y, unsigned int z ) const;
+    void setSample( unsigned int x, unsigned int y, unsigned int z, float distance );
+
+    float distance( const QVector3D& point, QVector3D& gradient ) const;
+
+private:
+    unsigned int sampleIndex( unsigned int x, unsigned int y, unsigned int z ) const;
+
+private:
+    BoundingBox _boundingBox;
+    unsigned int _nbCell[3];
+    float _cellSize[3];
+    QVector<float> _samples;
+};
+
+#endif // SIGNEDDISTANCEFIELD_H
@@ -129,6 +129,19 @@ bool Sphere::intersect( const Ray& ray, Intersection& intersection ) const
     return false;
 }
 
+bool Sphere::hasSignedDistance() const
+{
+    return true;
+}
+
+float Sphere::signedDistance( const QVector3D& point, QVector3D& gradient ) const
+{
+    float length = point.length();
+    gradient = ( length > 0 ) ? point / length : QVector3D( 0, 1, 0 );
+
+    return length - radius;
+}
+
 BoundingBox Sphere::boundingBox() const
 {
     return BoundingBox( QVector3D( -radius, -radius, -radius ),
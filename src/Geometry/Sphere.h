@@ -13,6 +13,8 @@ public:
     Sphere( AbstractObject* parent, const Material& material );
 
     virtual bool intersect( const Ray& ray, Intersection& intersection ) const;
+    virtual bool hasSignedDistance() const;
+    virtual float signedDistance( const QVector3D& point, QVector3D& gradient ) const;
     virtual BoundingBox boundingBox() const;
     virtual QVector3D randomInteriorPoint() const;
 
@@ -0,0 +1,879 @@
+#include "TriangleMesh.h"
+#include <QFile>
+#include <QList>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+    const unsigned int NbBins = 16;
+    const unsigned int MaxLeafTriangles = 4;
+    const unsigned int MaxStackSize = 128;
+
+    // A traversal stacks at most one node per level below the root, plus the
+    // two children of the node it expands, so deeper nodes are made leaves
+    const unsigned int MaxDepth = MaxStackSize - 2;
+
+    // Any direction works for the parity test, these avoid the axes and diagonals.
+    // A ray through an edge or a vertex may count a crossing twice, so the
+    // majority of three rays is used.
+    const QVector3D InsideRayDirections[3] = { QVector3D( 0.36, 0.48, 0.8 ),
+                                               QVector3D( -0.8, 0.36, 0.48 ),
+                                               QVector3D( 0.48, -0.8, -0.36 ) };
+
+    void growBox( QVector3D& minimum, QVector3D& maximum, const QVector3D& point )
+    {
+        minimum = QVector3D( std::min( minimum.x(), point.x() ), std::min( minimum.y(), point.y() ), std::min( minimum.z(), point.z() ) );
+        maximum = QVector3D( std::max( maximum.x(), point.x() ), std::max( maximum.y(), point.y() ), std::max( maximum.z(), point.z() ) );
+    }
+
+    void emptyBox( QVector3D& minimum, QVector3D& maximum )
+    {
+        float infinity = std::numeric_limits<float>::max();
+        minimum = QVector3D( infinity, infinity, infinity );
+        maximum = QVector3D( -infinity, -infinity, -infinity );
+    }
+
+    float surfaceArea( const QVector3D& minimum, const QVector3D& maximum )
+    {
+        QVector3D size = maximum - minimum;
+
+        if ( size.x() < 0 || size.y() < 0 || size.z() < 0 )
+            return 0;
+
+        return 2 * ( size.x() * size.y() + size.y() * size.z() + size.z() * size.x() );
+    }
+
+    float coordinate( const QVector3D& vector, unsigned int axis )
+    {
+        return ( axis == 0 ) ? vector.x() : ( axis == 1 ) ? vector.y() : vector.z();
+    }
+
+    // Parameter where the ray enters the box, or the maximum float when it misses it
+    float boxEntry( const QVector3D& minimum, const QVector3D& maximum, const Ray& ray, const QVector3D& inverseDirection )
+    {
+        QVector3D t0 = ( minimum - ray.origin() ) * inverseDirection;
+        QVector3D t1 = ( maximum - ray.origin() ) * inverseDirection;
+        float tMin = std::max( std::max( std::min( t0.x(), t1.x() ), std::min( t0.y(), t1.y() ) ), std::min( t0.z(), t1.z() ) );
+        float tMax = std::min( std::min( std::max( t0.x(), t1.x() ), std::max( t0.y(), t1.y() ) ), std::max( t0.z(), t1.z() ) );
+
+        if ( tMin > tMax || tMax < 0 )
+            return std::numeric_limits<float>::max();
+
+        return std::max( tMin, 0.0f );
+    }
+
+    float boxDistance2( const QVector3D& minimum, const QVector3D& maximum, const QVector3D& point )
+    {
+        QVector3D outside( std::max( std::max( minimum.x() - point.x(), point.x() - maximum.x() ), 0.0f ),
+                           std::max( std::max( minimum.y() - point.y(), point.y() - maximum.y() ), 0.0f ),
+                           std::max( std::max( minimum.z() - point.z(), point.z() - maximum.z() ), 0.0f ) );
+
+        return outside.lengthSquared();
+    }
+
+    // Closest point of a triangle ( Ericson, Real-Time Collision Detection 5.1.5 )
+    QVector3D closestPointOnTriangle( const QVector3D& p, const QVector3D& a, const QVector3D& b, const QVector3D& c )
+    {
+        QVector3D ab = b - a;
+        QVector3D ac = c - a;
+        QVector3D ap = p - a;
+        float d1 = QVector3D::dotProduct( ab, ap );
+        float d2 = QVector3D::dotProduct( ac, ap );
+
+        if ( d1 <= 0 && d2 <= 0 )
+            return a;
+
+        QVector3D bp = p - b;
+        float d3 = QVector3D::dotProduct( ab, bp );
+        float d4 = QVector3D::dotProduct( ac, bp );
+
+        if ( d3 >= 0 && d4 <= d3 )
+            return b;
+
+        float vc = d1 * d4 - d3 * d2;
+
+        if ( vc <= 0 && d1 >= 0 && d3 <= 0 )
+            return a + ab * ( d1 / ( d1 - d3 ) );
+
+        QVector3D cp = p - c;
+        float d5 = QVector3D::dotProduct( ab, cp );
+        float d6 = QVector3D::dotProduct( ac, cp );
+
+        if ( d6 >= 0 && d5 <= d6 )
+            return c;
+
+        float vb = d5 * d2 - d1 * d6;
+
+        if ( vb <= 0 && d2 >= 0 && d6 <= 0 )
+            return a + ac * ( d2 / ( d2 - d6 ) );
+
+        float va = d3 * d6 - d5 * d4;
+
+        if ( va <= 0 && ( d4 - d3 ) >= 0 && ( d5 - d6 ) >= 0 )
+            return b + ( c - b ) * ( ( d4 - d3 ) / ( ( d4 - d3 ) + ( d5 - d6 ) ) );
+
+        float denominator = 1 / ( va + vb + vc );
+        return a + ab * ( vb * denominator ) + ac * ( vc * denominator );
+    }
+
+    // Values of the PLY body, either as text or as little endian binary
+    class PlyReader
+    {
+    public:
+        enum Type { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64, Invalid };
+
+        PlyReader( const char* begin, const char* end, bool binary )
+            : _current( begin )
+            , _end( end )
+            , _binary( binary )
+        {
+        }
+
+        static Type type( const QByteArray& name )
+        {
+            if ( name == "char" || name == "int8" ) return Int8;
+            if ( name == "uchar" || name == "uint8" ) return UInt8;
+            if ( name == "short" || name == "int16" ) return Int16;
+            if ( name == "ushort" || name == "uint16" ) return UInt16;
+            if ( name == "int" || name == "int32" ) return Int32;
+            if ( name == "uint" || name == "uint32" ) return UInt32;
+            if ( name == "float" || name == "float32" ) return Float32;
+            if ( name == "double" || name == "float64" ) return Float64;
+            return Invalid;
+        }
+
+        bool read( Type type, double& value )
+        {
+            if ( !_binary )
+            {
+                char* next = 0;
+                value = strtod( _current, &next );
+
+                if ( next == _current || next > _end )
+                    return false;
+
+                _current = next;
+                return true;
+            }
+
+            static const int sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+            int size = sizes[type];
+
+            if ( _end - _current < size )
+                return false;
+
+            quint64 bits = 0;
+            for ( int i=0 ; i<size ; ++i )
+                bits |= (quint64)(unsigned char)_current[i] << ( 8 * i );
+
+            _current += size;
+
+            switch ( type )
+            {
+                case Int8 : value = (qint8)bits; break;
+                case UInt8 : value = (quint8)bits; break;
+                case Int16 : value = (qint16)bits; break;
+                case UInt16 : value = (quint16)bits; break;
+                case Int32 : value = (qint32)bits; break;
+                case UInt32 : value = (quint32)bits; break;
+                case Float32 : { quint32 b = bits; float f; memcpy( &f, &b, 4 ); value = f; break; }
+                case Float64 : { double d; memcpy( &d, &bits, 8 ); value = d; break; }
+                default : return false;
+            }
+
+            return true;
+        }
+
+    private:
+        const char* _current;
+        const char* _end;
+        bool _binary;
+    };
+
+    struct PlyProperty
+    {
+        QByteArray name;
+        PlyReader::Type type;
+        PlyReader::Type countType;
+        bool isList;
+    };
+
+    struct PlyElement
+    {
+        QByteArray name;
+        unsigned int count;
+        QList<PlyProperty> properties;
+    };
+}
+
+TriangleMesh::TriangleMesh( AbstractObject* parent, const Material& material )
+    : Geometry( parent, material )
+{
+}
+
+bool TriangleMesh::load( const QString& fileName )
+{
+    QFile file( fileName );
+
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    QByteArray data = file.readAll();
+    QString lowerFileName = fileName.toLower();
+
+    if ( lowerFileName.endsWith( ".obj" ) )
+        return loadObj( data );
+
+    if ( lowerFileName.endsWith( ".ply" ) )
+        return loadPly( data );
+
+    return false;
+}
+
+bool TriangleMesh::loadObj( const QByteArray& data )
+{
+    QVector<QVector3D> vertices;
+    QVector<unsigned int> indices;
+    QVector<int> face;
+    const char* current = data.constData();
+    const char* end = current + data.size();
+
+    while ( current < end )
+    {
+        const char* lineEnd = std::find( current, end, '\n' );
+
+        while ( current < lineEnd && ( *current == ' ' || *current == '\t' ) )
+            ++current;
+
+        if ( lineEnd - current > 2 && current[0] == 'v' && ( current[1] == ' ' || current[1] == '\t' ) )
+        {
+            char* next = 0;
+            float x = strtof( current + 2, &next );
+            float y = strtof( next, &next );
+            float z = strtof( next, &next );
+            vertices.append( QVector3D( x, y, z ) );
+        }
+        else if ( lineEnd - current > 2 && current[0] == 'f' && ( current[1] == ' ' || current[1] == '\t' ) )
+        {
+            face.clear();
+            current += 2;
+
+            // Vertex indices, ignoring the texture and normal indices after a '/'
+            while ( current < lineEnd )
+            {
+                char* next = 0;
+                long index = strtol( current, &next, 10 );
+
+                if ( next == current )
+                    break;
+
+                index = ( index < 0 ) ? vertices.size() + index : index - 1;
+                if ( index < 0 || index >= vertices.size() )
+                    return false;
+
+                face.append( index );
+                current = next;
+
+                while ( current < lineEnd && *current != ' ' && *current != '\t' )
+                    ++current;
+            }
+
+            // Fan triangulation of polygons
+            for ( int i=2 ; i<face.size() ; ++i )
+                indices << face[0] << face[i-1] << face[i];
+        }
+
+        current = lineEnd + 1;
+    }
+
+    if ( indices.isEmpty() )
+        return false;
+
+    setTriangles( vertices, indices );
+    return true;
+}
+
+bool TriangleMesh::loadPly( const QByteArray& data )
+{
+    QList<PlyElement> elements;
+    bool binary = false;
+    int headerEnd = data.indexOf( "end_header" );
+
+    if ( !data.startsWith( "ply" ) || headerEnd < 0 )
+        return false;
+
+    QList<QByteArray> lines = data.left( headerEnd ).split( '\n' );
+
+    for ( int l=1 ; l<lines.size() ; ++l )
+    {
+        QList<QByteArray> tokens = lines[l].simplified().split( ' ' );
+
+        if ( tokens[0] == "format" && tokens.size() > 1 )
+        {
+            if ( tokens[1] == "binary_little_endian" )
+                binary = true;
+            else if ( tokens[1] != "ascii" )
+                return false;
+        }
+        else if ( tokens[0] == "element" && tokens.size() > 2 )
+        {
+            PlyElement element;
+            element.name = tokens[1];
+            element.count = tokens[2].toUInt();
+            elements.append( element );
+        }
+        else if ( tokens[0] == "property" && !elements.isEmpty() )
+        {
+            PlyProperty property;
+            property.isList = ( tokens.size() > 4 && tokens[1] == "list" );
+            property.countType = property.isList ? PlyReader::type( tokens[2] ) : PlyReader::Invalid;
+            property.type = PlyReader::type( tokens[property.isList ? 3 : 1] );
+            property.name = tokens.back();
+
+            if ( property.type == PlyReader::Invalid || ( property.isList && property.countType == PlyReader::Invalid ) )
+                return false;
+
+            elements.back().properties.append( property );
+        }
+    }
+
+    // The body starts after the end of the header line
+    int bodyStart = data.indexOf( '\n', headerEnd ) + 1;
+    if ( bodyStart <= 0 )
+        return false;
+
+    PlyReader reader( data.constData() + bodyStart, data.constData() + data.size(), binary );
+    QVector<QVector3D> vertices;
+    QVector<unsigned int> indices;
+    QVector<unsigned int> face;
+
+    for ( int e=0 ; e<elements.size() ; ++e )
+    {
+        const PlyElement& element = elements[e];
+        bool isVertex = ( element.name == "vertex" );
+        bool isFace = ( element.name == "face" );
+
+        for ( unsigned int i=0 ; i<element.count ; ++i )
+        {
+            float position[3] = { 0, 0, 0 };
+
+            for ( int p=0 ; p<element.properties.size() ; ++p )
+            {
+                const PlyProperty& property = element.properties[p];
+                double value;
+
+                if ( !property.isList )
+                {
+                    if ( !reader.read( property.type, value ) )
+                        return false;
+
+                    if ( isVertex && property.name.size() == 1 && property.name[0] >= 'x' && property.name[0] <= 'z' )
+                        position[property.name[0] - 'x'] = value;
+
+                    continue;
+                }
+
+                double count;
+                if ( !reader.read( property.countType, count ) )
+                    return false;
+
+                bool isIndices = isFace && ( property.name == "vertex_indices" || property.name == "vertex_index" );
+                face.clear();
+
+                for ( int k=0 ; k<(int)count ; ++k )
+                {
+                    if ( !reader.read( property.type, value ) )
+                        return false;
+
+                    if ( isIndices )
+                        face.append( (unsigned int)value );
+                }
+
+                // Fan triangulation of polygons
+                for ( int k=2 ; k<face.size() ; ++k )
+                    indices << face[0] << face[k-1] << face[k];
+            }
+
+            if ( isVertex )
+                vertices.append( QVector3D( position[0], position[1], position[2] ) );
+        }
+    }
+
+    for ( int i=0 ; i<indices.size() ; ++i )
+        if ( indices[i] >= (unsigned int)vertices.size() )
+            return false;
+
+    if ( indices.isEmpty() )
+        return false;
+
+    setTriangles( vertices, indices );
+    return true;
+}
+
+void TriangleMesh::setTriangles( const QVector<QVector3D>& vertices, const QVector<unsigned int>& indices )
+{
+    _vertices = vertices;
+    _indices = indices;
+    _boundingBox = BoundingBox( _vertices );
+    _signedDistanceField = SignedDistanceField();
+
+    buildHierarchy();
+}
+
+unsigned int TriangleMesh::nbTriangles() const
+{
+    return _indices.size() / 3;
+}
+
+void TriangleMesh::buildHierarchy()
+{
+    unsigned int nbTriangles = this->nbTriangles();
+    QVector<QVector3D> centroids( nbTriangles );
+    QVector<BoundingBox> bounds( nbTriangles );
+
+    _triangleOrder.resize( nbTriangles );
+
+    for ( unsigned int i=0 ; i<nbTriangles ; ++i )
+    {
+        const QVector3D& a = _vertices[_indices[3*i]];
+        const QVector3D& b = _vertices[_indices[3*i+1]];
+        const QVector3D& c = _vertices[_indices[3*i+2]];
+        QVector3D minimum = a;
+        QVector3D maximum = a;
+
+        growBox( minimum, maximum, b );
+        growBox( minimum, maximum, c );
+        bounds[i] = BoundingBox( minimum, maximum );
+        centroids[i] = ( a + b + c ) / 3;
+        _triangleOrder[i] = i;
+    }
+
+    _nodes.clear();
+    _nodes.reserve( 2 * nbTriangles );
+    _nodes.append( Node() );
+    buildNode( 0, 0, nbTriangles, 0, centroids, bounds );
+}
+
+void TriangleMesh::buildNode( unsigned int node, unsigned int first, unsigned int count, unsigned int depth,
+                              const QVector<QVector3D>& centroids, const QVector<BoundingBox>& bounds )
+{
+    QVector3D minimum, maximum, centroidMinimum, centroidMaximum;
+    emptyBox( minimum, maximum );
+    emptyBox( centroidMinimum, centroidMaximum );
+
+    for ( unsigned int i=first ; i<first+count ; ++i )
+    {
+        unsigned int triangle = _triangleOrder[i];
+        growBox( minimum, maximum, bounds[triangle].minimum() );
+        growBox( minimum, maximum, bounds[triangle].maximum() );
+        growBox( centroidMinimum, centroidMaximum, centroids[triangle] );
+    }
+
+    _nodes[node].minimum = minimum;
+    _nodes[node].maximum = maximum;
+    _nodes[node].first = first;
+    _nodes[node].count = count;
+
+    // A degenerate split sequence keeps its triangles in a larger leaf
+    if ( count <= MaxLeafTriangles || depth >= MaxDepth )
+        return;
+
+    // Binned surface area heuristic over the three axes
+    float bestCost = std::numeric_limits<float>::max();
+    unsigned int bestAxis = 0;
+    unsigned int bestSplit = 0;
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        float axisMinimum = coordinate( centroidMinimum, axis );
+        float extent = coordinate( centroidMaximum, axis ) - axisMinimum;
+
+        if ( extent <= 0 )
+            continue;
+
+        unsigned int binCounts[NbBins] = { 0 };
+        QVector3D binMinimum[NbBins], binMaximum[NbBins];
+
+        for ( unsigned int b=0 ; b<NbBins ; ++b )
+            emptyBox( binMinimum[b], binMaximum[b] );
+
+        for ( unsigned int i=first ; i<first+count ; ++i )
+        {
+            unsigned int triangle = _triangleOrder[i];
+            unsigned int bin = std::min<unsigned int>( NbBins * ( coordinate( centroids[triangle], axis ) - axisMinimum ) / extent, NbBins - 1 );
+
+            ++binCounts[bin];
+            growBox( binMinimum[bin], binMaximum[bin], bounds[triangle].minimum() );
+            growBox( binMinimum[bin], binMaximum[bin], bounds[triangle].maximum() );
+        }
+
+        // Areas and counts on the right of each split, then sweep from the left
+        float rightAreas[NbBins];
+        unsigned int rightCounts[NbBins];
+        QVector3D sweepMinimum, sweepMaximum;
+        unsigned int sweepCount = 0;
+        emptyBox( sweepMinimum, sweepMaximum );
+
+        // The empty bins keep an inverted box, which must not grow the sweep
+        for ( unsigned int b=NbBins-1 ; b>0 ; --b )
+        {
+            if ( binCounts[b] > 0 )
+            {
+                growBox( sweepMinimum, sweepMaximum, binMinimum[b] );
+                growBox( sweepMinimum, sweepMaximum, binMaximum[b] );
+            }
+
+            sweepCount += binCounts[b];
+            rightAreas[b] = surfaceArea( sweepMinimum, sweepMaximum );
+            rightCounts[b] = sweepCount;
+        }
+
+        emptyBox( sweepMinimum, sweepMaximum );
+        sweepCount = 0;
+
+        for ( unsigned int b=1 ; b<NbBins ; ++b )
+        {
+            if ( binCounts[b-1] > 0 )
+            {
+                growBox( sweepMinimum, sweepMaximum, binMinimum[b-1] );
+                growBox( sweepMinimum, sweepMaximum, binMaximum[b-1] );
+            }
+
+            sweepCount += binCounts[b-1];
+
+            if ( sweepCount == 0 || rightCounts[b] == 0 )
+                continue;
+
+            float cost = sweepCount * surfaceArea( sweepMinimum, sweepMaximum ) + rightCounts[b] * rightAreas[b];
+
+            if ( cost < bestCost )
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b;
+            }
+        }
+    }
+
+    // Keep a leaf when splitting does not pay off, or when the centroids cannot be separated
+    if ( bestCost == std::numeric_limits<float>::max() ||
+         ( count <= 4 * MaxLeafTriangles && bestCost >= count * surfaceArea( minimum, maximum ) ) )
+        return;
+
+    float axisMinimum = coordinate( centroidMinimum, bestAxis );
+    float extent = coordinate( centroidMaximum, bestAxis ) - axisMinimum;
+    unsigned int* begin = _triangleOrder.data() + first;
+    unsigned int* middle = std::partition( begin, begin + count, [&]( unsigned int triangle )
+    {
+        unsigned int bin = std::min<unsigned int>( NbBins * ( coordinate( centroids[triangle], bestAxis ) - axisMinimum ) / extent, NbBins - 1 );
+        return bin < bestSplit;
+    } );
+    unsigned int leftCount = middle - begin;
+
+    // The left child directly follows its parent
+    unsigned int left = _nodes.size();
+    _nodes.append( Node() );
+    buildNode( left, first, leftCount, depth + 1, centroids, bounds );
+
+    unsigned int right = _nodes.size();
+    _nodes.append( Node() );
+    buildNode( right, first + leftCount, count - leftCount, depth + 1, centroids, bounds );
+
+    _nodes[node].first = right;
+    _nodes[node].count = 0;
+}
+
+bool TriangleMesh::intersectTriangle( unsigned int triangle, const Ray& ray, float& t ) const
+{
+    // Möller-Trumbore
+    const QVector3D& a = _vertices[_indices[3*triangle]];
+    QVector3D ab = _vertices[_indices[3*triangle+1]] - a;
+    QVector3D ac = _vertices[_indices[3*triangle+2]] - a;
+    QVector3D p = QVector3D::crossProduct( ray.direction(), ac );
+    float determinant = QVector3D::dotProduct( ab, p );
+
+    if ( fabs( determinant ) < 1e-12 )
+        return false;
+
+    float inverseDeterminant = 1 / determinant;
+    QVector3D s = ray.origin() - a;
+    float u = QVector3D::dotProduct( s, p ) * inverseDeterminant;
+
+    if ( u < 0 || u > 1 )
+        return false;
+
+    QVector3D q = QVector3D::crossProduct( s, ab );
+    float v = QVector3D::dotProduct( ray.direction(), q ) * inverseDeterminant;
+
+    if ( v < 0 || u + v > 1 )
+        return false;
+
+    t = QVector3D::dotProduct( ac, q ) * inverseDeterminant;
+    return t >= 0;
+}
+
+QVector3D TriangleMesh::triangleNormal( unsigned int triangle ) const
+{
+    const QVector3D& a = _vertices[_indices[3*triangle]];
+    const QVector3D& b = _vertices[_indices[3*triangle+1]];
+    const QVector3D& c = _vertices[_indices[3*triangle+2]];
+
+    return QVector3D::crossProduct( b - a, c - a ).normalized();
+}
+
+bool TriangleMesh::intersect( const Ray& ray, Intersection& intersection ) const
+{
+    if ( _nodes.isEmpty() )
+        return false;
+
+    QVector3D inverseDirection( 1 / ray.direction().x(), 1 / ray.direction().y(), 1 / ray.direction().z() );
+    float nearestT = std::numeric_limits<float>::max();
+    int nearestTriangle = -1;
+    unsigned int stack[MaxStackSize];
+    float stackEntries[MaxStackSize];
+    unsigned int stackSize = 0;
+
+    stackEntries[stackSize] = boxEntry( _nodes[0].minimum, _nodes[0].maximum, ray, inverseDirection );
+    stack[stackSize++] = 0;
+
+    while ( stackSize > 0 )
+    {
+        --stackSize;
+        unsigned int index = stack[stackSize];
+        const Node& node = _nodes[index];
+
+        // Also skips the boxes missed by the ray
+        if ( stackEntries[stackSize] >= nearestT )
+            continue;
+
+        if ( node.count > 0 )
+        {
+            for ( unsigned int i=node.first ; i<node.first+node.count ; ++i )
+            {
+                float t;
+
+                if ( intersectTriangle( _triangleOrder[i], ray, t ) && t < nearestT )
+                {
+                    nearestT = t;
+                    nearestTriangle = _triangleOrder[i];
+                }
+            }
+        }
+        else
+        {
+            // Visit the nearest child first
+            unsigned int left = index + 1;
+            unsigned int right = node.first;
+            float leftEntry = boxEntry( _nodes[left].minimum, _nodes[left].maximum, ray, inverseDirection );
+            float rightEntry = boxEntry( _nodes[right].minimum, _nodes[right].maximum, ray, inverseDirection );
+            bool leftFirst = leftEntry < rightEntry;
+
+            stackEntries[stackSize] = leftFirst ? rightEntry : leftEntry;
+            stack[stackSize++] = leftFirst ? right : left;
+            stackEntries[stackSize] = leftFirst ? leftEntry : rightEntry;
+            stack[stackSize++] = leftFirst ? left : right;
+        }
+    }
+
+    if ( nearestTriangle < 0 )
+        return false;
+
+    intersection = Intersection( ray.origin() + nearestT * ray.direction(), triangleNormal( nearestTriangle ), nearestT );
+    return true;
+}
+
+unsigned int TriangleMesh::countIntersections( const Ray& ray ) const
+{
+    if ( _nodes.isEmpty() )
+        return 0;
+
+    QVector3D inverseDirection( 1 / ray.direction().x(), 1 / ray.direction().y(), 1 / ray.direction().z() );
+    unsigned int nbIntersections = 0;
+    unsigned int stack[MaxStackSize];
+    unsigned int stackSize = 0;
+
+    stack[stackSize++] = 0;
+
+    while ( stackSize > 0 )
+    {
+        unsigned int index = stack[--stackSize];
+        const Node& node = _nodes[index];
+
+        if ( boxEntry( node.minimum, node.maximum, ray, inverseDirection ) == std::numeric_limits<float>::max() )
+            continue;
+
+        if ( node.count > 0 )
+        {
+            for ( unsigned int i=node.first ; i<node.first+node.count ; ++i )
+            {
+                float t;
+
+                if ( intersectTriangle( _triangleOrder[i], ray, t ) )
+                    ++nbIntersections;
+            }
+        }
+        else
+        {
+            stack[stackSize++] = node.first;
+            stack[stackSize++] = index + 1;
+        }
+    }
+
+    return nbIntersections;
+}
+
+bool TriangleMesh::isInside( const QVector3D& point ) const
+{
+    unsigned int nbInside = 0;
+
+    for ( unsigned int i=0 ; i<3 ; ++i )
+        nbInside += countIntersections( Ray( point, InsideRayDirections[i] ) ) % 2;
+
+    return nbInside >= 2;
+}
+
+float TriangleMesh::nearestDistance( const QVector3D& point ) const
+{
+    if ( _nodes.isEmpty() )
+        return std::numeric_limits<float>::max();
+
+    float nearestDistance2 = std::numeric_limits<float>::max();
+    unsigned int stack[MaxStackSize];
+    unsigned int stackSize = 0;
+
+    stack[stackSize++] = 0;
+
+    while ( stackSize > 0 )
+    {
+        unsigned int index = stack[--stackSize];
+        const Node& node = _nodes[index];
+
+        if ( boxDistance2( node.minimum, node.maximum, point ) >= nearestDistance2 )
+            continue;
+
+        if ( node.count > 0 )
+        {
+            for ( unsigned int i=node.first ; i<node.first+node.count ; ++i )
+            {
+                unsigned int triangle = _triangleOrder[i];
+                QVector3D closest = closestPointOnTriangle( point, _vertices[_indices[3*triangle]],
+                                                            _vertices[_indices[3*triangle+1]],
+                                                            _vertices[_indices[3*triangle+2]] );
+                nearestDistance2 = std::min( nearestDistance2, ( closest - point ).lengthSquared() );
+            }
+        }
+        else
+        {
+            // Visit the nearest child first
+            unsigned int left = index + 1;
+            unsigned int right = node.first;
+            float leftDistance2 = boxDistance2( _nodes[left].minimum, _nodes[left].maximum, point );
+            float rightDistance2 = boxDistance2( _nodes[right].minimum, _nodes[right].maximum, point );
+
+            stack[stackSize++] = ( leftDistance2 < rightDistance2 ) ? right : left;
+            stack[stackSize++] = ( leftDistance2 < rightDistance2 ) ? left : right;
+        }
+    }
+
+    return sqrt( nearestDistance2 );
+}
+
+void TriangleMesh::bakeSignedDistance( unsigned int resolution )
+{
+    // Margin around the mesh, so the particles pushed outside still get a sampled distance
+    QVector3D size = _boundingBox.maximum() - _boundingBox.minimum();
+    float maxSize = std::max( std::max( size.x(), size.y() ), size.z() );
+    float cellSize = maxSize / std::max( 1u, resolution );
+    QVector3D margin( 2 * cellSize, 2 * cellSize, 2 * cellSize );
+    BoundingBox box( _boundingBox.minimum() - margin, _boundingBox.maximum() + margin );
+    QVector3D boxSize = box.maximum() - box.minimum();
+
+    SignedDistanceField field( box,
+                               (unsigned int)ceilf( boxSize.x() / cellSize ),
+                               (unsigned int)ceilf( boxSize.y() / cellSize ),
+                               (unsigned int)ceilf( boxSize.z() / cellSize ) );
+
+    int nbSamplesZ = field.nbSamples( 2 );
+
+    #pragma omp parallel for schedule( dynamic )
+    for ( int z=0 ; z<nbSamplesZ ; ++z )
+        for ( unsigned int y=0 ; y<field.nbSamples( 1 ) ; ++y )
+            for ( unsigned int x=0 ; x<field.nbSamples( 0 ) ; ++x )
+            {
+                QVector3D position = field.samplePosition( x, y, z );
+                float distance = nearestDistance( position );
+                field.setSample( x, y, z, isInside( position ) ? -distance : distance );
+            }
+
+    _signedDistanceField = field;
+}
+
+bool TriangleMesh::hasSignedDistance() const
+{
+    return !_signedDistanceField.isEmpty();
+}
+
+float TriangleMesh::signedDistance( const QVector3D& point, QVector3D& gradient ) const
+{
+    return _signedDistanceField.distance( point, gradient );
+}
+
+float TriangleMesh::volume() const
+{
+    // Divergence theorem over the closed surface
+    float volume = 0;
+
+    for ( unsigned int i=0 ; i<nbTriangles() ; ++i )
+        volume += QVector3D::dotProduct( _vertices[_indices[3*i]],
+                                         QVector3D::crossProduct( _vertices[_indices[3*i+1]], _vertices[_indices[3*i+2]] ) );
+
+    return volume / 6;
+}
+
+BoundingBox TriangleMesh::boundingBox() const
+{
+    return _boundingBox;
+}
+
+QVector3D TriangleMesh::randomInteriorPoint() const
+{
+    QVector3D minimum = _boundingBox.minimum();
+    QVector3D size = _boundingBox.maximum() - minimum;
+
+    // Bounded, in case the mesh is not closed
+    for ( unsigned int i=0 ; i<10000 ; ++i )
+    {
+        QVector3D result = minimum + QVector3D( rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, rand() / (float)RAND_MAX ) * size;
+
+        if ( isInside( result ) )
+            return result;
+    }
+
+    return minimum + 0.5 * size;
+}
+
+void TriangleMesh::createOpenGLBuffers()
+{
+    // Area weighted vertex normals
+    QVector<QVector3D> normals( _vertices.size() );
+
+    for ( unsigned int i=0 ; i<nbTriangles() ; ++i )
+    {
+        const QVector3D& a = _vertices[_indices[3*i]];
+        QVector3D normal = QVector3D::crossProduct( _vertices[_indices[3*i+1]] - a, _vertices[_indices[3*i+2]] - a );
+
+        for ( unsigned int j=0 ; j<3 ; ++j )
+            normals[_indices[3*i+j]] += normal;
+    }
+
+    for ( int i=0 ; i<normals.size() ; ++i )
+        normals[i].normalize();
+
+    createVertexBuffer( _vertices );
+    createNormalBuffer( normals );
+    createIndexBuffer( _indices );
+}
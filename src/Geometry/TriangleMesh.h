@@ -0,0 +1,74 @@
+#ifndef TRIANGLEMESH_H
+#define TRIANGLEMESH_H
+
+#include "Geometry/Geometry.h"
+#include "Geometry/SignedDistanceField.h"
+#include <QByteArray>
+#include <QString>
+
+/* A closed triangle mesh that inherits from Geometry, loaded from an OBJ or
+ * PLY ( ASCII or binary little endian ) file. The triangles must be oriented
+ * with their normals pointing outside.
+ *
+ * Ray intersections go through a bounding volume hierarchy built with the
+ * surface area heuristic. A point is inside when rays from it cross the
+ * surface an odd number of times. The signed distance is only available once
+ * sampled on a grid with 'bakeSignedDistance', since exact queries are too slow
+ * for per-particle collisions on large meshes.
+ */
+
+class TriangleMesh : public Geometry
+{
+public:
+    TriangleMesh( AbstractObject* parent, const Material& material );
+
+    bool load( const QString& fileName );
+    void setTriangles( const QVector<QVector3D>& vertices, const QVector<unsigned int>& indices );
+    void bakeSignedDistance( unsigned int resolution );
+
+    unsigned int nbTriangles() const;
+    float volume() const;
+
+    virtual bool intersect( const Ray& ray, Intersection& intersection ) const;
+    virtual bool hasSignedDistance() const;
+    virtual float signedDistance( const QVector3D& point, QVector3D& gradient ) const;
+    virtual bool isInside( const QVector3D& point ) const;
+    virtual BoundingBox boundingBox() const;
+    virtual QVector3D randomInteriorPoint() const;
+
+private:
+    // Interior nodes have no triangles and their children at 'index + 1' and
+    // 'first'. Leaves own 'count' triangles of '_triangleOrder' from 'first'.
+    struct Node
+    {
+        QVector3D minimum;
+        QVector3D maximum;
+        unsigned int first;
+        unsigned int count;
+    };
+
+    bool loadObj( const QByteArray& data );
+    bool loadPly( const QByteArray& data );
+
+    void buildHierarchy();
+    void buildNode( unsigned int node, unsigned int first, unsigned int count, unsigned int depth,
+                    const QVector<QVector3D>& centroids, const QVector<BoundingBox>& bounds );
+
+    bool intersectTriangle( unsigned int triangle, const Ray& ray, float& t ) const;
+    unsigned int countIntersections( const Ray& ray ) const;
+    float nearestDistance( const QVector3D& point ) const;
+    QVector3D triangleNormal( unsigned int triangle ) const;
+
+private:
+    virtual void createOpenGLBuffers();
+
+private:
+    QVector<QVector3D> _vertices;
+    QVector<unsigned int> _indices;
+    QVector<Node> _nodes;
+    QVector<unsigned int> _triangleOrder;
+    BoundingBox _boundingBox;
+    SignedDistanceField _signedDistanceField;
+};
+
+#endif // TRIANGLEMESH_H
@@ -0,0 +1,420 @@
+#include "Scenes/SceneFactory.h"
+#include "SPH/SlabDecomposition.h"
+#include "SPH/TrajectoryWriter.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QTextStream>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Runs a scene without any window or OpenGL context, and prints the time
+ * spent in each simulation step.
+ *
+ * With '--ranks', the particles are split between as many processes, forked
+ * at startup and connected by the given transport ( see SlabDecomposition ).
+ * The threads are then shared between the processes, and only the first one
+ * prints the timings.
+ *
+ * '--load' starts from a snapshot of the same scene instead of its initial
+ * particles, with the parameters of the snapshot, and '--save' writes one
+ * after the last step ( see Snapshot ).
+ *
+ * '--record' writes the particles every '--record-interval' steps to a
+ * trajectory file from a background thread ( see TrajectoryWriter ).
+ *
+ * Usage : tp3-headless [--scene name] [--steps N] [--dt seconds] [--threads N]
+ *                      [--seeding random|lattice|poisson] [--seed N] [--sleep N]
+ *                      [--kernel poly6|cubic|wendland] [--precision single|mixed|double]
+ *                      [--ranks N] [--transport socket|shm] [--load file] [--save file]
+ *                      [--record file] [--record-interval N] [--record-buffers N]
+ *                      [--quantize] [--compress level] [--overflow block|drop]
+ */
+
+static void usage( QTextStream& out )
+{
+    out << "Usage: tp3-headless [--scene " << SceneFactory::names().join( "|" ) << "]"
+        << " [--steps N] [--dt seconds] [--threads N]"
+        << " [--seeding random|lattice|poisson] [--seed N] [--sleep N]"
+        << " [--kernel poly6|cubic|wendland] [--precision single|mixed|double]"
+        << " [--ranks N] [--transport socket|shm] [--load file] [--save file]"
+        << " [--record file] [--record-interval N] [--record-buffers N]"
+        << " [--quantize] [--compress level] [--overflow block|drop]" << endl;
+}
+
+static bool parseSeedingMode( const QString& name, ParticleSeeder::Mode& mode )
+{
+    const ParticleSeeder::Mode modes[] = { ParticleSeeder::SeedingRandom, ParticleSeeder::SeedingLattice, ParticleSeeder::SeedingPoissonDisk };
+
+    for ( unsigned int i=0 ; i<sizeof( modes ) / sizeof( modes[0] ) ; ++i )
+        if ( name == ParticleSeeder::modeName( modes[i] ) )
+        {
+            mode = modes[i];
+            return true;
+        }
+
+    return false;
+}
+
+static bool parseKernel( const QString& name, SPH::Kernel& kernel )
+{
+    const SPH::Kernel kernels[] = { SPH::KernelPoly6Spiky, SPH::KernelCubicSpline, SPH::KernelWendlandC2 };
+
+    for ( unsigned int i=0 ; i<sizeof( kernels ) / sizeof( kernels[0] ) ; ++i )
+        if ( name == SPH::kernelName( kernels[i] ) )
+        {
+            kernel = kernels[i];
+            return true;
+        }
+
+    return false;
+}
+
+static bool parsePrecision( const QString& name, SPH::Precision& precision )
+{
+    const SPH::Precision precisions[] = { SPH::PrecisionSingle, SPH::PrecisionMixed, SPH::PrecisionDouble };
+
+    for ( unsigned int i=0 ; i<sizeof( precisions ) / sizeof( precisions[0] ) ; ++i )
+        if ( name == SPH::precisionName( precisions[i] ) )
+        {
+            precision = precisions[i];
+            return true;
+        }
+
+    return false;
+}
+
+static bool parseTransport( const QString& name, Transport::Kind& kind )
+{
+    const Transport::Kind kinds[] = { Transport::TransportSocket, Transport::TransportSharedMemory };
+
+    for ( unsigned int i=0 ; i<sizeof( kinds ) / sizeof( kinds[0] ) ; ++i )
+        if ( name == Transport::kindName( kinds[i] ) )
+        {
+            kind = kinds[i];
+            return true;
+        }
+
+    return false;
+}
+
+static bool parseOverflow( const QString& name, TrajectoryWriter::Overflow& overflow )
+{
+    const TrajectoryWriter::Overflow overflows[] = { TrajectoryWriter::OverflowBlock, TrajectoryWriter::OverflowDrop };
+
+    for ( unsigned int i=0 ; i<sizeof( overflows ) / sizeof( overflows[0] ) ; ++i )
+        if ( name == TrajectoryWriter::overflowName( overflows[i] ) )
+        {
+            overflow = overflows[i];
+            return true;
+        }
+
+    return false;
+}
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication app( argc, argv );
+    QTextStream out( stdout );
+
+    QString sceneName = "sphere";
+    unsigned int nbSteps = 100;
+    float deltaTime = 0.01;
+    int nbThreads = 0;
+    bool seeding = false;
+    ParticleSeeder::Mode seedingMode = ParticleSeeder::SeedingRandom;
+    quint64 seed = 0;
+    unsigned int sleepSteps = 0;
+    SPH::Kernel kernel = SPH::KernelPoly6Spiky;
+    SPH::Precision precision = SPH::PrecisionSingle;
+    int nbRanks = 1;
+    Transport::Kind transportKind = Transport::TransportSocket;
+    QString loadFileName;
+    QString saveFileName;
+    QString recordFileName;
+    unsigned int recordInterval = 1;
+    unsigned int recordBuffers = 4;
+    bool quantize = false;
+    int compressionLevel = 0;
+    TrajectoryWriter::Overflow overflow = TrajectoryWriter::OverflowBlock;
+
+    QStringList arguments = app.arguments();
+    for ( int i=1; i<arguments.size(); ++i )
+    {
+        const QString& argument = arguments[i];
+        bool ok = i+1 < arguments.size();
+
+        if ( argument == "--scene" && ok )
+            sceneName = arguments[++i];
+        else if ( argument == "--steps" && ok )
+            nbSteps = arguments[++i].toUInt( &ok );
+        else if ( argument == "--dt" && ok )
+            deltaTime = arguments[++i].toFloat( &ok );
+        else if ( argument == "--threads" && ok )
+            nbThreads = arguments[++i].toInt( &ok );
+        else if ( argument == "--seeding" && ok )
+            ok = seeding = parseSeedingMode( arguments[++i], seedingMode );
+        else if ( argument == "--seed" && ok )
+        {
+            seed = arguments[++i].toULongLong( &ok );
+            seeding = true;
+        }
+        else if ( argument == "--sleep" && ok )
+            sleepSteps = arguments[++i].toUInt( &ok );
+        else if ( argument == "--kernel" && ok )
+            ok = parseKernel( arguments[++i], kernel );
+        else if ( argument == "--precision" && ok )
+            ok = parsePrecision( arguments[++i], precision );
+        else if ( argument == "--ranks" && ok )
+            ok = ( nbRanks = arguments[++i].toInt( &ok ) ) > 0 && ok;
+        else if ( argument == "--transport" && ok )
+            ok = parseTransport( arguments[++i], transportKind );
+        else if ( argument == "--load" && ok )
+            loadFileName = arguments[++i];
+        else if ( argument == "--save" && ok )
+            saveFileName = arguments[++i];
+        else if ( argument == "--record" && ok )
+            recordFileName = arguments[++i];
+        else if ( argument == "--record-interval" && ok )
+            recordInterval = arguments[++i].toUInt( &ok );
+        else if ( argument == "--record-buffers" && ok )
+            recordBuffers = arguments[++i].toUInt( &ok );
+        else if ( argument == "--quantize" )
+            ok = quantize = true;
+        else if ( argument == "--compress" && ok )
+            ok = ( compressionLevel = arguments[++i].toInt( &ok ) ) >= 0 && compressionLevel <= 9 && ok;
+        else if ( argument == "--overflow" && ok )
+            ok = parseOverflow( arguments[++i], overflow );
+        else
+            ok = false;
+
+        if ( !ok )
+        {
+            usage( out );
+            return 1;
+        }
+    }
+
+    // A snapshot holds the particles of a single process
+    bool snapshot = !loadFileName.isEmpty() || !saveFileName.isEmpty();
+
+    if ( !SceneFactory::names().contains( sceneName ) || deltaTime <= 0 || ( snapshot && nbRanks > 1 ) )
+    {
+        usage( out );
+        return 1;
+    }
+
+    // Before the scene, whose particles are initialized by OpenMP loops
+    Transport* transport = 0;
+    if ( nbRanks > 1 )
+    {
+        transport = Transport::launch( transportKind, nbRanks );
+        if ( !transport )
+        {
+            out << "cannot launch " << nbRanks << " ranks" << endl;
+            return 1;
+        }
+    }
+
+    // The other ranks run silently
+    bool verbose = !transport || transport->rank() == 0;
+
+#ifdef _OPENMP
+    if ( nbThreads == 0 && nbRanks > 1 )
+        nbThreads = std::max( 1, omp_get_num_procs() / nbRanks );
+    if ( nbThreads > 0 )
+        omp_set_num_threads( nbThreads );
+    nbThreads = omp_get_max_threads();
+#else
+    nbThreads = 1;
+#endif
+
+    Scene* scene = SceneFactory::create( sceneName );
+
+    SPH& sph = scene->sph();
+    QElapsedTimer timer;
+
+    sph.setKernel( kernel );
+    sph.setPrecision( precision );
+
+    if ( sleepSteps > 0 )
+        sph.setSleeping( sleepSteps );
+
+    if ( seeding )
+    {
+        timer.start();
+        sph.setSeeding( seedingMode, seed );
+        if ( verbose )
+            out << "seeding " << ParticleSeeder::modeName( seedingMode ) << " with seed " << seed
+                << " in " << timer.nsecsElapsed() / 1.0e6 << " ms" << endl;
+    }
+
+    if ( !loadFileName.isEmpty() )
+    {
+        timer.start();
+
+        if ( !sph.loadSnapshot( loadFileName ) )
+        {
+            out << "cannot load a snapshot of scene " << sceneName << " from " << loadFileName << endl;
+            delete scene;
+            return 1;
+        }
+
+        out << "loaded " << loadFileName << " in " << timer.nsecsElapsed() / 1.0e6 << " ms" << endl;
+    }
+
+    if ( verbose )
+        out << "scene " << sceneName
+            << ", " << sph.particles().size() << " particles"
+            << ", " << SPH::kernelName( sph.kernel() ) << " kernel"
+            << ", " << SPH::precisionName( sph.precision() ) << " precision"
+            << ", " << nbSteps << " steps of " << deltaTime << " s"
+            << ", " << nbThreads << " threads" << endl;
+
+    SlabDecomposition* decomposition = 0;
+    if ( transport )
+    {
+        decomposition = new SlabDecomposition( *transport );
+
+        if ( !sph.setDecomposition( decomposition ) )
+        {
+            out << "cannot split the " << SPH::solverName( sph.solver() ) << " solver between ranks" << endl;
+            delete scene;
+            delete decomposition;
+            delete transport;
+            return 1;
+        }
+
+        if ( verbose )
+            out << nbRanks << " ranks over " << Transport::kindName( transportKind )
+                << ", " << decomposition->nbOwnedParticles() << " particles on rank 0" << endl;
+    }
+
+    // Each rank records its own particles
+    TrajectoryWriter writer;
+    bool recording = !recordFileName.isEmpty();
+
+    if ( recording )
+    {
+        if ( transport )
+            recordFileName += QString( ".%1" ).arg( transport->rank() );
+
+        writer.setInterval( recordInterval );
+        writer.setBufferCount( recordBuffers );
+        writer.setQuantization( quantize );
+        writer.setCompressionLevel( compressionLevel );
+        writer.setOverflow( overflow );
+
+        if ( !writer.open( recordFileName ) )
+        {
+            out << "cannot record to " << recordFileName << endl;
+            delete scene;
+            delete decomposition;
+            delete transport;
+            return 1;
+        }
+    }
+
+    qint64 totalTime = 0;
+    qint64 minTime = 0;
+    qint64 maxTime = 0;
+    qint64 recordTime = 0;
+    double time = 0;
+    unsigned int nbSimulatedSteps = 0;
+
+    for ( unsigned int i=0; i<nbSteps; ++i )
+    {
+        scene->update();
+
+        timer.start();
+        sph.step( deltaTime );
+        qint64 stepTime = timer.nsecsElapsed();
+        time += deltaTime;
+
+        // The other ranks cannot be reached anymore
+        if ( decomposition && decomposition->failed() )
+            break;
+
+        ++nbSimulatedSteps;
+
+        if ( recording )
+        {
+            timer.start();
+            writer.record( sph.particles(), decomposition ? decomposition->nbOwnedParticles() : sph.particles().size(), time );
+            recordTime += timer.nsecsElapsed();
+        }
+
+        totalTime += stepTime;
+        minTime = ( i == 0 || stepTime < minTime ) ? stepTime : minTime;
+        maxTime = ( stepTime > maxTime ) ? stepTime : maxTime;
+
+        if ( !verbose )
+            continue;
+
+        out << "step " << i << " " << stepTime / 1.0e6 << " ms";
+        if ( sleepSteps > 0 )
+            out << ", " << sph.nbSleepingParticles() << " asleep";
+        out << endl;
+    }
+
+    if ( nbSimulatedSteps > 0 && verbose )
+    {
+        out << "total " << totalTime / 1.0e6 << " ms"
+            << ", mean " << totalTime / 1.0e6 / nbSimulatedSteps << " ms"
+            << ", min " << minTime / 1.0e6 << " ms"
+            << ", max " << maxTime / 1.0e6 << " ms" << endl;
+    }
+
+    int status = 0;
+    if ( recording )
+    {
+        bool closed = writer.close();
+
+        if ( verbose )
+            out << "recorded " << writer.nbWrittenFrames() << " frames"
+                << ", " << writer.nbDroppedFrames() << " dropped"
+                << ", " << writer.nbWrittenBytes() << " bytes"
+                << ", " << recordTime / 1.0e6 << " ms in the simulation thread" << endl;
+
+        if ( !closed )
+        {
+            out << "cannot write to " << recordFileName << endl;
+            status = 1;
+        }
+    }
+
+    if ( !saveFileName.isEmpty() )
+    {
+        timer.start();
+
+        if ( sph.saveSnapshot( saveFileName ) )
+            out << "saved " << saveFileName << " in " << timer.nsecsElapsed() / 1.0e6 << " ms" << endl;
+        else
+        {
+            out << "cannot save a snapshot to " << saveFileName << endl;
+            status = 1;
+        }
+    }
+
+    if ( decomposition )
+    {
+        qint64 nbParticles = decomposition->nbOwnedParticles();
+
+        if ( decomposition->failed() || !transport->sum( nbParticles ) )
+        {
+            QTextStream( stderr ) << "rank " << transport->rank() << " lost its connection" << endl;
+            status = 1;
+        }
+        else if ( verbose )
+            out << nbParticles << " particles on all ranks" << endl;
+    }
+
+    delete scene;
+    delete decomposition;
+    delete transport;
+    return status;
+}
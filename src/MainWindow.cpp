@@ -21,6 +21,9 @@ MainWindow::MainWindow( QWidget* parent )
 
 MainWindow::~MainWindow()
 {
+    // Stops the simulation thread before its scene goes away
+    ui->glWidget->setScene( 0 );
+
     for ( int i=0 ; i<ui->sceneList->count() ; ++i )
         delete (Scene*)ui->sceneList->item(i)->data(Qt::UserRole).value<void*>();
 
@@ -0,0 +1,55 @@
+#ifndef COUNTERRANDOM_H
+#define COUNTERRANDOM_H
+
+#include <QtGlobal>
+
+/* A counter-based random number generator : each number is a hash of the seed
+ * and of its index, so that any thread can draw the i-th number without
+ * sharing a state, and the sequence does not depend on the thread count nor on
+ * the platform's rand().
+ *
+ * The hash is the finalizer of SplitMix64, see G. Steele, D. Lea et C. Flood. 2014
+ *     Fast splittable pseudorandom number generators.
+ */
+
+class CounterRandom
+{
+public:
+    explicit CounterRandom( quint64 seed );
+
+    quint64 bits( quint64 counter ) const;
+
+    // Uniform in [0,1)
+    float uniform( quint64 counter ) const;
+
+private:
+    static quint64 mix( quint64 value );
+
+private:
+    quint64 _key;
+};
+
+inline CounterRandom::CounterRandom( quint64 seed )
+    : _key( mix( seed ) )
+{
+}
+
+inline quint64 CounterRandom::bits( quint64 counter ) const
+{
+    return mix( _key + ( counter + 1 ) * Q_UINT64_C( 0x9e3779b97f4a7c15 ) );
+}
+
+inline float CounterRandom::uniform( quint64 counter ) const
+{
+    // The 24 high bits, exactly representable as a float
+    return ( bits( counter ) >> 40 ) * ( 1.0f / 16777216.0f );
+}
+
+inline quint64 CounterRandom::mix( quint64 value )
+{
+    value = ( value ^ ( value >> 30 ) ) * Q_UINT64_C( 0xbf58476d1ce4e5b9 );
+    value = ( value ^ ( value >> 27 ) ) * Q_UINT64_C( 0x94d049bb133111eb );
+    return value ^ ( value >> 31 );
+}
+
+#endif // COUNTERRANDOM_H
@@ -0,0 +1,80 @@
+#ifndef FRAMEEXCHANGE_H
+#define FRAMEEXCHANGE_H
+
+#include <atomic>
+
+/* Hands the latest frame from a producer thread to a consumer thread without
+ * locks, and without either of them ever waiting for the other.
+ *
+ * The producer fills its own frame, then swaps it with the shared one in a
+ * single atomic exchange. The consumer swaps its own frame with the shared
+ * one when a newer frame was published, so the frame it reads is never the
+ * one being written. The frames are recycled, and only the latest one is
+ * kept when the producer is faster.
+ */
+
+template <typename Frame>
+class FrameExchange
+{
+public:
+    explicit FrameExchange( const Frame& frame = Frame() );
+
+    // Producer : fills 'writeFrame', then publishes it
+    Frame& writeFrame();
+    void publish();
+
+    // Consumer : takes the latest published frame, and returns false when
+    // there is none since the previous call
+    bool acquire();
+    const Frame& readFrame() const;
+
+private:
+    // The shared slot, with a flag when it holds an unread frame
+    static const unsigned int SlotMask = 3;
+    static const unsigned int Fresh = 4;
+
+    Frame _frames[3];
+    unsigned int _writeSlot;
+    unsigned int _readSlot;
+    std::atomic<unsigned int> _shared;
+};
+
+template <typename Frame>
+inline FrameExchange<Frame>::FrameExchange( const Frame& frame )
+    : _frames{ frame, frame, frame }
+    , _writeSlot( 0 )
+    , _readSlot( 1 )
+    , _shared( 2 )
+{
+}
+
+template <typename Frame>
+inline Frame& FrameExchange<Frame>::writeFrame()
+{
+    return _frames[_writeSlot];
+}
+
+template <typename Frame>
+inline void FrameExchange<Frame>::publish()
+{
+    // Releases the frame to the consumer, and takes back a frame it released
+    _writeSlot = _shared.exchange( _writeSlot | Fresh, std::memory_order_acq_rel ) & SlotMask;
+}
+
+template <typename Frame>
+inline bool FrameExchange<Frame>::acquire()
+{
+    if ( !( _shared.load( std::memory_order_relaxed ) & Fresh ) )
+        return false;
+
+    _readSlot = _shared.exchange( _readSlot, std::memory_order_acq_rel ) & SlotMask;
+    return true;
+}
+
+template <typename Frame>
+inline const Frame& FrameExchange<Frame>::readFrame() const
+{
+    return _frames[_readSlot];
+}
+
+#endif // FRAMEEXCHANGE_H
@@ -1,8 +1,114 @@
 #include "Grid.h"
+#include <algorithm>
 #include <cmath>
 
-Grid::Grid( const BoundingBox& boundingBox, unsigned int nbCellX, unsigned int nbCellY, unsigned int nbCellZ, float radius )
-    : _boundingBox( boundingBox )
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace
+{
+    // Sorts the items by key in parallel, and stably. 'sortedIndex' lists the
+    // items key after key, with 'keyCount[k]' items of key 'k' from 'keyStart[k]'
+    template <typename Key>
+    void countingSort( const Key* keys, unsigned int nbItems, unsigned int nbKeys,
+                       QVector<unsigned int>& keyStart, QVector<unsigned int>& keyCount,
+                       QVector<unsigned int>& sortedIndex, QVector<unsigned int>& threadOffsets )
+    {
+        int nbThreads = 1;
+
+#ifdef _OPENMP
+        nbThreads = omp_get_max_threads();
+#endif
+
+        // One row of per-key offsets per thread
+        if ( threadOffsets.size() != (int)( nbThreads * nbKeys ) )
+            threadOffsets.resize( nbThreads * nbKeys );
+
+        if ( keyStart.size() != (int)nbKeys )
+        {
+            keyStart.resize( nbKeys );
+            keyCount.resize( nbKeys );
+        }
+
+        sortedIndex.resize( nbItems );
+
+        unsigned int* start = keyStart.data();
+        unsigned int* count = keyCount.data();
+        unsigned int* sorted = sortedIndex.data();
+        unsigned int* allOffsets = threadOffsets.data();
+        int nbOffsets = threadOffsets.size();
+
+        // Both item loops use the same static schedule, so every thread sees the
+        // same items when counting and when scattering. Items thus stay sorted by
+        // index inside a key, and the result does not depend on the thread count.
+        #pragma omp parallel num_threads( nbThreads )
+        {
+            int thread = 0;
+
+#ifdef _OPENMP
+            thread = omp_get_thread_num();
+#endif
+
+            unsigned int* offsets = allOffsets + thread * nbKeys;
+
+            // The team may be smaller than requested, so clear every row
+            #pragma omp for schedule( static )
+            for ( int j=0 ; j<nbOffsets ; ++j )
+                allOffsets[j] = 0;
+
+            // Count the items of each key seen by this thread
+            #pragma omp for schedule( static )
+            for ( int i=0 ; i<(int)nbItems ; ++i )
+                ++offsets[keys[i]];
+
+            // Turn the per-thread counts into per-thread offsets inside each key
+            #pragma omp for schedule( static )
+            for ( int key=0 ; key<(int)nbKeys ; ++key )
+            {
+                unsigned int keyTotal = 0;
+
+                for ( int t=0 ; t<nbThreads ; ++t )
+                {
+                    unsigned int threadCount = allOffsets[t * nbKeys + key];
+                    allOffsets[t * nbKeys + key] = keyTotal;
+                    keyTotal += threadCount;
+                }
+
+                count[key] = keyTotal;
+            }
+
+            // Exclusive prefix sum of the key counts
+            #pragma omp single
+            {
+                unsigned int first = 0;
+
+                for ( unsigned int key=0 ; key<nbKeys ; ++key )
+                {
+                    start[key] = first;
+                    first += count[key];
+                }
+            }
+
+            // Scatter the item indices in their key
+            #pragma omp for schedule( static )
+            for ( int i=0 ; i<(int)nbItems ; ++i )
+            {
+                unsigned int key = keys[i];
+                sorted[start[key] + offsets[key]++] = i;
+            }
+        }
+    }
+}
+
+Grid::Grid( const BoundingBox& boundingBox, unsigned int nbCellX, unsigned int nbCellY, unsigned int nbCellZ, float radius,
+            StorageMode storageMode, NeighborhoodMode neighborhoodMode )
+    : _radius( radius )
+    , _extendedRadius( radius )
+    , _neighborhoodMode( neighborhoodMode )
+    , _storageMode( storageMode )
+    , _hashBits( 0 )
+    , _boundingBox( boundingBox )
 {
     QVector3D boxSize = _boundingBox.maximum() - _boundingBox.minimum();
 
@@ -13,26 +119,66 @@ Grid::Grid( const BoundingBox& boundingBox, unsigned int nbCellX, unsigned int n
     _cellSize[1] = boxSize.y() / _nbCell[1];
     _cellSize[2] = boxSize.z() / _nbCell[2];
 
-    buildNeighborhoods( radius );
+    setNeighborhoodMode( neighborhoodMode );
+    setStorageMode( storageMode );
+}
+
+void Grid::setRadius( float radius )
+{
+    _radius = radius;
+    setNeighborhoodMode( _neighborhoodMode );
+}
+
+void Grid::setExtendedRadius( float radius )
+{
+    _extendedRadius = radius;
+    setNeighborhoodMode( _neighborhoodMode );
+}
+
+Grid::NeighborhoodMode Grid::neighborhoodMode() const
+{
+    return _neighborhoodMode;
 }
 
-void Grid::buildNeighborhoods( float radius )
+void Grid::setNeighborhoodMode( NeighborhoodMode neighborhoodMode )
 {
-    unsigned int nbCells = _nbCell[0] * _nbCell[1] * _nbCell[2];
-    _neighborhoods.resize( nbCells );
-    _cellParticles.resize( nbCells );
+    // The hashed storage has no per-cell neighborhoods
+    if ( _storageMode == StorageHashed )
+        neighborhoodMode = NeighborhoodStencil;
+
+    _neighborhoodMode = neighborhoodMode;
+
+    // Only keep the neighborhoods of the active mode, and the half and
+    // extended stencils
+    _neighborhoods.clear();
+    _stencil.clear();
+    _halfStencil.clear();
+    _extendedStencil.clear();
+
+    if ( _neighborhoodMode == NeighborhoodExplicit )
+        buildNeighborhoods();
+    else
+        buildStencil( _stencil, _radius, false );
+
+    buildStencil( _halfStencil, _radius, true );
+    buildStencil( _extendedStencil, std::max( _radius, _extendedRadius ), false );
+}
+
+void Grid::buildNeighborhoods()
+{
+    _neighborhoods.resize( nbCells() );
 
     for ( unsigned int x=0 ; x<_nbCell[0] ; ++x )
         for ( unsigned int y=0 ; y<_nbCell[1] ; ++y )
             for ( unsigned int z=0 ; z<_nbCell[2] ; ++z )
-                buildNeighborhood( x, y, z, radius );
+                buildNeighborhood( x, y, z );
 }
 
-void Grid::buildNeighborhood( unsigned int x, unsigned int y, unsigned int z, float radius )
+void Grid::buildNeighborhood( unsigned int x, unsigned int y, unsigned int z )
 {
-    int sizeX = (int)ceilf( radius / _cellSize[0] );
-    int sizeY = (int)ceilf( radius / _cellSize[1] );
-    int sizeZ = (int)ceilf( radius / _cellSize[2] );
+    int sizeX = (int)ceilf( _radius / _cellSize[0] );
+    int sizeY = (int)ceilf( _radius / _cellSize[1] );
+    int sizeZ = (int)ceilf( _radius / _cellSize[2] );
     int minX = std::max<int>( 0, x - sizeX );
     int minY = std::max<int>( 0, y - sizeY );
     int minZ = std::max<int>( 0, z - sizeZ );
@@ -43,32 +189,110 @@ void Grid::buildNeighborhood( unsigned int x, unsigned int y, unsigned int z, fl
     for ( int dx=minX ; dx<maxX ; ++dx )
         for ( int dy=minY ; dy<maxY ; ++dy )
             for ( int dz=minZ ; dz<maxZ ; ++dz )
-                if ( shortestDistance( x, y, z, dx, dy, dz ) < radius )
+                if ( shortestDistance( dx - x, dy - y, dz - z ) < _radius )
                     _neighborhoods[cellIndex(x,y,z)].append( cellIndex(dx,dy,dz) );
 }
 
-float Grid::shortestDistance( unsigned int x, unsigned int y, unsigned int z, unsigned int dx, unsigned int dy, unsigned int dz ) const
+void Grid::buildStencil( QVector<StencilOffset>& stencil, float radius, bool half ) const
+{
+    int sizeX = (int)ceilf( radius / _cellSize[0] );
+    int sizeY = (int)ceilf( radius / _cellSize[1] );
+    int sizeZ = (int)ceilf( radius / _cellSize[2] );
+
+    // Same order as the explicit neighborhoods. The half stencil keeps the
+    // offsets that come after the cell itself in this order, and the cell.
+    for ( int dx=-sizeX ; dx<=sizeX ; ++dx )
+        for ( int dy=-sizeY ; dy<=sizeY ; ++dy )
+            for ( int dz=-sizeZ ; dz<=sizeZ ; ++dz )
+            {
+                if ( half && ( dx < 0 || ( dx == 0 && ( dy < 0 || ( dy == 0 && dz < 0 ) ) ) ) )
+                    continue;
+
+                if ( shortestDistance( dx, dy, dz ) < radius )
+                {
+                    StencilOffset offset;
+                    offset.dx = dx;
+                    offset.dy = dy;
+                    offset.dz = dz;
+                    offset.offset = ( dz * (int)_nbCell[1] + dy ) * (int)_nbCell[0] + dx;
+                    stencil.append( offset );
+                }
+            }
+}
+
+float Grid::shortestDistance( int dx, int dy, int dz ) const
 {
     QVector3D difference;
 
-	if ( x != dx )
-        difference.setX( ( std::abs( (int)dx - (int)x ) - 1 ) * _cellSize[0] );
+    if ( dx != 0 )
+        difference.setX( ( std::abs( dx ) - 1 ) * _cellSize[0] );
 
-	if ( y != dy )
-        difference.setY( ( std::abs( (int)dy - (int)y ) - 1 ) * _cellSize[1] );
+    if ( dy != 0 )
+        difference.setY( ( std::abs( dy ) - 1 ) * _cellSize[1] );
 
-	if ( z != dz )
-        difference.setZ( ( std::abs( (int)dz - (int)z ) - 1 ) * _cellSize[2] );
+    if ( dz != 0 )
+        difference.setZ( ( std::abs( dz ) - 1 ) * _cellSize[2] );
 
     return difference.length();
 }
 
-void Grid::addParticle( unsigned int cellIndex, unsigned int particleIndex )
+Grid::StorageMode Grid::storageMode() const
+{
+    return _storageMode;
+}
+
+void Grid::setStorageMode( StorageMode storageMode )
+{
+    _storageMode = storageMode;
+
+    // Only keep the storage of the active mode
+    _cellParticles.clear();
+    _migrations.clear();
+    _editKeys.clear();
+    _editStart.clear();
+    _editCount.clear();
+    _sortedEdits.clear();
+    _editOffsets.clear();
+    _cellStart.clear();
+    _cellCount.clear();
+    _sortedIndex.clear();
+    _threadOffsets.clear();
+    _bucketKeys.clear();
+    _bucketStart.clear();
+    _bucketCount.clear();
+    _bucketCells.clear();
+    _hashedCells.clear();
+    _hashBits = 0;
+
+    if ( _storageMode == StorageIncremental )
+        _cellParticles.resize( nbCells() );
+    else if ( _storageMode == StorageCountingSort )
+    {
+        _cellStart.fill( 0, nbCells() );
+        _cellCount.fill( 0, nbCells() );
+    }
+    else if ( _neighborhoodMode != NeighborhoodStencil )
+        setNeighborhoodMode( NeighborhoodStencil );
+}
+
+void Grid::clear()
+{
+    for ( int i=0 ; i<_cellParticles.size() ; ++i )
+        _cellParticles[i].clear();
+
+    _cellStart.fill( 0 );
+    _cellCount.fill( 0 );
+    _sortedIndex.clear();
+    _bucketCells.clear();
+    _hashedCells.clear();
+}
+
+void Grid::addParticle( Cell cellIndex, unsigned int particleIndex )
 {
     _cellParticles[cellIndex].append( particleIndex );
 }
 
-void Grid::removeParticle( unsigned int cellIndex, unsigned int particleIndex )
+void Grid::removeParticle( Cell cellIndex, unsigned int particleIndex )
 {
     QVector<unsigned int>& cell = _cellParticles[cellIndex];
     unsigned int it = cell.indexOf( particleIndex );
@@ -77,9 +301,243 @@ void Grid::removeParticle( unsigned int cellIndex, unsigned int particleIndex )
     cell.pop_back();
 }
 
-unsigned int Grid::cellIndex( const QVector3D& position ) const
+void Grid::migrateParticles( const QVector<QVector<Migration> >& threadMigrations )
+{
+    int nbMigrations = 0;
+    QVector<int> listStart( threadMigrations.size() );
+
+    for ( int t=0 ; t<threadMigrations.size() ; ++t )
+    {
+        listStart[t] = nbMigrations;
+        nbMigrations += threadMigrations[t].size();
+    }
+
+    if ( nbMigrations == 0 )
+        return;
+
+    int nbThreads = 1;
+
+#ifdef _OPENMP
+    nbThreads = omp_get_max_threads();
+#endif
+
+    // The cells are dealt to the buckets in turn, so that the fluid, which
+    // only fills a part of the grid, still spreads over every bucket
+    unsigned int nbBuckets = std::min<unsigned int>( nbCells(), 8 * nbThreads );
+    unsigned int nbEdits = 2 * nbMigrations;
+
+    _migrations.resize( nbMigrations );
+    _editKeys.resize( nbEdits );
+
+    const int* starts = listStart.constData();
+    Migration* migrations = _migrations.data();
+    unsigned int* editKeys = _editKeys.data();
+
+    // Edit '2m' removes the particle of migration 'm' from its cell, and edit
+    // '2m+1' adds it to its new cell
+    #pragma omp parallel if( nbMigrations >= 256 )
+    {
+        #pragma omp for schedule( static )
+        for ( int t=0 ; t<threadMigrations.size() ; ++t )
+            std::copy( threadMigrations[t].constBegin(), threadMigrations[t].constEnd(), migrations + starts[t] );
+
+        #pragma omp for schedule( static )
+        for ( int m=0 ; m<nbMigrations ; ++m )
+        {
+            editKeys[2 * m] = migrations[m].from % nbBuckets;
+            editKeys[2 * m + 1] = migrations[m].to % nbBuckets;
+        }
+    }
+
+    // The sort is stable and the lists are expected in increasing particle
+    // order, so each cell goes through the same edits as with a serial update
+    // and its content does not depend on the thread count
+    countingSort( editKeys, nbEdits, nbBuckets, _editStart, _editCount, _sortedEdits, _editOffsets );
+
+    QVector<unsigned int>* cellParticles = _cellParticles.data();
+    const unsigned int* editStart = _editStart.constData();
+    const unsigned int* editCount = _editCount.constData();
+    const unsigned int* sortedEdits = _sortedEdits.constData();
+
+    // Every thread only reads the edits of the buckets it applies
+    #pragma omp parallel for schedule( dynamic, 1 ) if( nbMigrations >= 256 )
+    for ( int b=0 ; b<(int)nbBuckets ; ++b )
+    {
+        for ( unsigned int e=editStart[b] ; e<editStart[b] + editCount[b] ; ++e )
+        {
+            unsigned int edit = sortedEdits[e];
+            const Migration& migration = migrations[edit / 2];
+
+            if ( edit % 2 == 0 )
+            {
+                QVector<unsigned int>& cell = cellParticles[migration.from];
+                unsigned int it = cell.indexOf( migration.particle );
+
+                cell[it] = cell.back();
+                cell.pop_back();
+            }
+            else
+                cellParticles[migration.to].append( migration.particle );
+        }
+    }
+}
+
+void Grid::rebuild( const Cell* cellIndices, unsigned int nbParticles )
+{
+    if ( _storageMode == StorageHashed )
+        rebuildHashed( cellIndices, nbParticles );
+    else
+        rebuildCountingSort( cellIndices, nbParticles );
+}
+
+void Grid::rebuildCountingSort( const Cell* cellIndices, unsigned int nbParticles )
+{
+    countingSort( cellIndices, nbParticles, nbCells(), _cellStart, _cellCount, _sortedIndex, _threadOffsets );
+}
+
+void Grid::rebuildHashed( const Cell* cellIndices, unsigned int nbParticles )
+{
+    // About four particles per bucket, so that a bucket holds a few cells and
+    // the memory follows the particles
+    unsigned int hashBits = 1;
+    while ( hashBits < 30 && ( 1u << hashBits ) < nbParticles / 4 )
+        ++hashBits;
+
+    unsigned int nbBuckets = 1u << hashBits;
+    _hashBits = hashBits;
+
+    _bucketKeys.resize( nbParticles );
+    unsigned int* bucketKeys = _bucketKeys.data();
+
+    #pragma omp parallel for schedule( static )
+    for ( int i=0 ; i<(int)nbParticles ; ++i )
+        bucketKeys[i] = hashBucket( cellIndices[i] );
+
+    // Sort the particles by bucket, then by index
+    countingSort( bucketKeys, nbParticles, nbBuckets, _bucketStart, _bucketCount, _sortedIndex, _threadOffsets );
+
+    _bucketCells.resize( nbBuckets + 1 );
+
+    unsigned int* sortedIndex = _sortedIndex.data();
+    const unsigned int* bucketStart = _bucketStart.constData();
+    const unsigned int* bucketCount = _bucketCount.constData();
+    unsigned int* bucketCells = _bucketCells.data();
+
+    #pragma omp parallel
+    {
+        // Group the particles of each bucket by cell with a stable insertion
+        // sort, since the buckets are small, and count the cells of the bucket
+        #pragma omp for schedule( static )
+        for ( int b=0 ; b<(int)nbBuckets ; ++b )
+        {
+            unsigned int* particles = sortedIndex + bucketStart[b];
+            unsigned int nbCells = 0;
+
+            for ( unsigned int i=0 ; i<bucketCount[b] ; ++i )
+            {
+                unsigned int particle = particles[i];
+                Cell cell = cellIndices[particle];
+                unsigned int j = i;
+
+                for ( ; j>0 && cellIndices[particles[j-1]] > cell ; --j )
+                    particles[j] = particles[j-1];
+
+                particles[j] = particle;
+            }
+
+            for ( unsigned int i=0 ; i<bucketCount[b] ; ++i )
+                if ( i == 0 || cellIndices[particles[i]] != cellIndices[particles[i-1]] )
+                    ++nbCells;
+
+            bucketCells[b] = nbCells;
+        }
+
+        // Exclusive prefix sum of the cell counts
+        #pragma omp single
+        {
+            unsigned int first = 0;
+
+            for ( unsigned int b=0 ; b<=nbBuckets ; ++b )
+            {
+                unsigned int nbCells = b < nbBuckets ? bucketCells[b] : 0;
+                bucketCells[b] = first;
+                first += nbCells;
+            }
+
+            _hashedCells.resize( first );
+        }
+
+        HashedCell* hashedCells = _hashedCells.data();
+
+        // Record the particle range of every cell
+        #pragma omp for schedule( static )
+        for ( int b=0 ; b<(int)nbBuckets ; ++b )
+        {
+            unsigned int c = bucketCells[b];
+
+            for ( unsigned int i=bucketStart[b] ; i<bucketStart[b] + bucketCount[b] ; ++i )
+            {
+                Cell cell = cellIndices[sortedIndex[i]];
+
+                if ( i == bucketStart[b] || cell != cellIndices[sortedIndex[i-1]] )
+                {
+                    HashedCell hashedCell = { cell, i, 0 };
+                    hashedCells[c++] = hashedCell;
+                }
+
+                ++hashedCells[c-1].count;
+            }
+        }
+    }
+}
+
+unsigned int Grid::hashBucket( Cell cell ) const
+{
+    // Fibonacci hashing, keeping the well mixed high bits
+    return (unsigned int)( ( cell * Q_UINT64_C( 0x9e3779b97f4a7c15 ) ) >> ( 64 - _hashBits ) );
+}
+
+unsigned int Grid::nbCells() const
+{
+    return _nbCell[0] * _nbCell[1] * _nbCell[2];
+}
+
+int Grid::nbOccupiedCells() const
+{
+    if ( _storageMode == StorageHashed )
+        return _hashedCells.size();
+
+    return nbCells();
+}
+
+Grid::Cell Grid::occupiedCell( int i ) const
+{
+    if ( _storageMode == StorageHashed )
+        return _hashedCells[i].cell;
+
+    return i;
+}
+
+Grid::Cell Grid::cellIndex( const QVector3D& position ) const
 {
     QVector3D relativePosition = position - _boundingBox.minimum();
+
+    // Not clamped to the bounding box, only to the range of the packed coordinates
+    if ( _storageMode == StorageHashed )
+    {
+        float relative[3] = { relativePosition.x(), relativePosition.y(), relativePosition.z() };
+        unsigned int coordinates[3];
+
+        for ( int axis=0 ; axis<3 ; ++axis )
+        {
+            float coordinate = std::floor( relative[axis] / _cellSize[axis] );
+            coordinate = std::max<float>( -HashedBias, std::min<float>( coordinate, HashedBias - 1 ) );
+            coordinates[axis] = (unsigned int)( (int)coordinate + HashedBias );
+        }
+
+        return packCell( coordinates[0], coordinates[1], coordinates[2] );
+    }
+
     unsigned int x = (unsigned int)( relativePosition.x() / _cellSize[0] );
     unsigned int y = (unsigned int)( relativePosition.y() / _cellSize[1] );
     unsigned int z = (unsigned int)( relativePosition.z() / _cellSize[2] );
@@ -91,17 +549,107 @@ unsigned int Grid::cellIndex( const QVector3D& position ) const
     return cellIndex( x, y, z );
 }
 
+quint64 Grid::mortonCode( Cell cell ) const
+{
+    unsigned int coordinates[3];
+    cellCoordinates( cell, coordinates );
+
+    return spreadBits( coordinates[0] ) | ( spreadBits( coordinates[1] ) << 1 ) | ( spreadBits( coordinates[2] ) << 2 );
+}
+
+void Grid::colorCells( float distance, QVector<Cell>& cells, QVector<unsigned int>& colorStart ) const
+{
+    // Two cells of the same colour are at least 2 * reach + 1 cells apart
+    // along one axis, where 'reach' cells cover 'distance'
+    unsigned int period[3];
+
+    for ( int axis=0 ; axis<3 ; ++axis )
+        period[axis] = 2 * (unsigned int)ceilf( distance / _cellSize[axis] ) + 1;
+
+    unsigned int nbColors = period[0] * period[1] * period[2];
+    int nbCells = nbOccupiedCells();
+
+    QVector<unsigned int> colors( nbCells );
+    unsigned int* cellColors = colors.data();
+
+    #pragma omp parallel for schedule( static )
+    for ( int c=0 ; c<nbCells ; ++c )
+    {
+        unsigned int coordinates[3];
+        cellCoordinates( occupiedCell( c ), coordinates );
+
+        cellColors[c] = ( coordinates[2] % period[2] * period[1] + coordinates[1] % period[1] ) * period[0] + coordinates[0] % period[0];
+    }
+
+    QVector<unsigned int> colorCount;
+    QVector<unsigned int> sortedIndex;
+    QVector<unsigned int> threadOffsets;
+    countingSort( cellColors, nbCells, nbColors, colorStart, colorCount, sortedIndex, threadOffsets );
+    colorStart.append( nbCells );
+
+    cells.resize( nbCells );
+
+    #pragma omp parallel for schedule( static )
+    for ( int c=0 ; c<nbCells ; ++c )
+        cells[c] = occupiedCell( sortedIndex[c] );
+}
+
+quint64 Grid::spreadBits( unsigned int value )
+{
+    // Insert two zeros between the 21 low bits
+    quint64 bits = value & 0x1fffff;
+    bits = ( bits | ( bits << 32 ) ) & Q_UINT64_C( 0x001f00000000ffff );
+    bits = ( bits | ( bits << 16 ) ) & Q_UINT64_C( 0x001f0000ff0000ff );
+    bits = ( bits | ( bits << 8 ) )  & Q_UINT64_C( 0x100f00f00f00f00f );
+    bits = ( bits | ( bits << 4 ) )  & Q_UINT64_C( 0x10c30c30c30c30c3 );
+    bits = ( bits | ( bits << 2 ) )  & Q_UINT64_C( 0x1249249249249249 );
+    return bits;
+}
+
 unsigned int Grid::cellIndex( unsigned int x, unsigned int y, unsigned int z ) const
 {
     return z * _nbCell[0] * _nbCell[1] + y * _nbCell[0] + x;
 }
 
-const QVector<unsigned int>& Grid::neighborhood( unsigned int cell ) const
+void Grid::cellCoordinates( Cell cell, unsigned int coordinates[3] ) const
 {
-    return _neighborhoods[cell];
+    if ( _storageMode == StorageHashed )
+    {
+        coordinates[0] = cell & HashedMask;
+        coordinates[1] = ( cell >> HashedBits ) & HashedMask;
+        coordinates[2] = cell >> ( 2 * HashedBits );
+        return;
+    }
+
+    coordinates[0] = cell % _nbCell[0];
+    coordinates[1] = ( cell / _nbCell[0] ) % _nbCell[1];
+    coordinates[2] = cell / ( _nbCell[0] * _nbCell[1] );
 }
 
-const QVector<unsigned int>& Grid::cellParticles( unsigned int cell ) const
+ParticleRange Grid::cellParticles( Cell cell ) const
 {
-    return _cellParticles[cell];
+    if ( _storageMode == StorageHashed )
+    {
+        const unsigned int* begin = _sortedIndex.constData();
+
+        if ( _bucketCells.isEmpty() )
+            return ParticleRange( begin, begin );
+
+        unsigned int bucket = hashBucket( cell );
+
+        for ( unsigned int c=_bucketCells[bucket] ; c<_bucketCells[bucket + 1] ; ++c )
+            if ( _hashedCells[c].cell == cell )
+                return ParticleRange( begin + _hashedCells[c].start, begin + _hashedCells[c].start + _hashedCells[c].count );
+
+        return ParticleRange( begin, begin );
+    }
+
+    if ( _storageMode == StorageCountingSort )
+    {
+        const unsigned int* begin = _sortedIndex.constData() + _cellStart[cell];
+        return ParticleRange( begin, begin + _cellCount[cell] );
+    }
+
+    const QVector<unsigned int>& particles = _cellParticles[cell];
+    return ParticleRange( particles.constData(), particles.constData() + particles.size() );
 }
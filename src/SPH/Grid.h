@@ -2,39 +2,256 @@
 #define GRID_H
 
 #include "Geometry/BoundingBox.h"
+#include "SPH/ParticleRange.h"
 #include <QVector>
+#include <QtGlobal>
 #include <vector>
 
 /* A acceleration structure for the SPH simulation. The grid is a set of
  * cells. Each cell contain a list of particles, and a list of neighboring
  * cells that can be reached within a given radius.
+ *
+ * The particles of the cells can be stored in three ways :
+ *   - StorageIncremental : one list per cell, updated particle by particle
+ *     with 'addParticle' and 'removeParticle'.
+ *   - StorageCountingSort : flat 'cellStart'/'cellCount'/'sortedIndex' arrays
+ *     rebuilt from scratch at every step by a parallel counting sort ( see
+ *     'rebuild' ). No memory is allocated per cell.
+ *   - StorageHashed : the cells are keyed by their integer coordinates, which
+ *     are not clamped to the bounding box, and the particles are grouped by
+ *     a parallel counting sort over hash buckets, then by cell inside each
+ *     bucket, also at every step. The memory grows with the particles instead
+ *     of the grid volume, and the neighborhoods always use the stencil.
+ *
+ * The incremental storage can also be updated in parallel from lists of cell
+ * changes ( see 'migrateParticles' ).
+ *
+ * The neighboring cells are found in two ways :
+ *   - NeighborhoodExplicit : one precomputed list of cell indices per cell.
+ *   - NeighborhoodStencil : a single table of cell offsets, clamped to the
+ *     grid bounds when visited. Its memory does not depend on the resolution.
+ * Both modes visit the neighboring cells in the same order.
+ *
+ * A cell is identified by its linear index in the bounding box, or with
+ * StorageHashed by its packed coordinates ( 21 bits per axis, centered on the
+ * bounding box minimum, so about a million cells on each side of it ).
  */
 
 class Grid
 {
 public:
-    Grid( const BoundingBox& boundingBox, unsigned int nbCellX, unsigned int nbCellY, unsigned int nbCellZ, float radius );
+    enum StorageMode { StorageIncremental, StorageCountingSort, StorageHashed };
+    enum NeighborhoodMode { NeighborhoodExplicit, NeighborhoodStencil };
+    typedef quint64 Cell;
 
-    const QVector<unsigned int>& neighborhood( unsigned int cell ) const;
-    const QVector<unsigned int>& cellParticles( unsigned int cell ) const;
+    // A particle moving from one cell to another
+    struct Migration
+    {
+        unsigned int particle;
+        Cell from;
+        Cell to;
+    };
 
-    void addParticle( unsigned int cellIndex, unsigned int particleIndex );
-    void removeParticle( unsigned int cellIndex, unsigned int particleIndex );
-    unsigned int cellIndex( const QVector3D& position ) const;
+    Grid( const BoundingBox& boundingBox, unsigned int nbCellX, unsigned int nbCellY, unsigned int nbCellZ, float radius,
+          StorageMode storageMode = StorageIncremental, NeighborhoodMode neighborhoodMode = NeighborhoodExplicit );
+
+    // Calls 'function' with the index of every cell within the radius of 'cell'
+    template <typename Function>
+    void forEachNeighborCell( Cell cell, Function function ) const;
+
+    // The same for 'cell' and the neighbors that come after it, from a half
+    // stencil, so that every pair of neighboring cells is visited once
+    template <typename Function>
+    void forEachHalfNeighborCell( Cell cell, Function function ) const;
+
+    // The same within the extended radius, for the searches that reach further
+    // than the radius ( the neighbor lists ) without widening the others
+    template <typename Function>
+    void forEachExtendedNeighborCell( Cell cell, Function function ) const;
+
+    ParticleRange cellParticles( Cell cell ) const;
+    void setRadius( float radius );
+    void setExtendedRadius( float radius );
+
+    NeighborhoodMode neighborhoodMode() const;
+    void setNeighborhoodMode( NeighborhoodMode neighborhoodMode );
+
+    StorageMode storageMode() const;
+    void setStorageMode( StorageMode storageMode );
+    void clear();
+
+    // StorageIncremental
+    void addParticle( Cell cellIndex, unsigned int particleIndex );
+    void removeParticle( Cell cellIndex, unsigned int particleIndex );
+    void migrateParticles( const QVector<QVector<Migration> >& threadMigrations );
+
+    // StorageCountingSort and StorageHashed
+    void rebuild( const Cell* cellIndices, unsigned int nbParticles );
+
+    // Cells of the bounding box
+    unsigned int nbCells() const;
+
+    // The cells that may contain particles : every cell, or only the occupied
+    // cells with StorageHashed
+    int nbOccupiedCells() const;
+    Cell occupiedCell( int i ) const;
+    Cell cellIndex( const QVector3D& position ) const;
+
+    // Position of the cell along the Z-order curve, which keeps nearby cells
+    // close to each other ( interleaved bits of the cell coordinates )
+    quint64 mortonCode( Cell cell ) const;
+
+    // Sorts the occupied cells by colour, keeping their order inside a colour.
+    // The cells within 'distance' of two cells of the same colour are
+    // distinct, so the particles around the cells of a colour can be updated
+    // in parallel. Colour 'c' spans 'colorStart[c]' to 'colorStart[c+1]'.
+    void colorCells( float distance, QVector<Cell>& cells, QVector<unsigned int>& colorStart ) const;
 
 private:
-    void buildNeighborhoods( float radius );
-    void buildNeighborhood( unsigned int x, unsigned int y, unsigned int z, float radius );
-    float shortestDistance( unsigned int x, unsigned int y, unsigned int z, unsigned int dx, unsigned int dy, unsigned int dz ) const;
+    struct StencilOffset
+    {
+        int dx;
+        int dy;
+        int dz;
+        int offset;
+    };
+
+    // Packed coordinates of the hashed cells
+    static const int HashedBits = 21;
+    static const int HashedBias = 1 << ( HashedBits - 1 );
+    static const Cell HashedMask = ( Cell( 1 ) << HashedBits ) - 1;
+
+    struct HashedCell
+    {
+        Cell cell;
+        unsigned int start;
+        unsigned int count;
+    };
+
+    void buildNeighborhoods();
+    void buildNeighborhood( unsigned int x, unsigned int y, unsigned int z );
+    void buildStencil( QVector<StencilOffset>& stencil, float radius, bool half ) const;
+    float shortestDistance( int dx, int dy, int dz ) const;
+    template <typename Function>
+    void forEachStencilCell( Cell cell, const QVector<StencilOffset>& stencil, Function function ) const;
+    void rebuildCountingSort( const Cell* cellIndices, unsigned int nbParticles );
+    void rebuildHashed( const Cell* cellIndices, unsigned int nbParticles );
+    unsigned int hashBucket( Cell cell ) const;
+    static Cell packCell( unsigned int x, unsigned int y, unsigned int z );
+    static quint64 spreadBits( unsigned int value );
     unsigned int cellIndex( unsigned int x, unsigned int y, unsigned int z ) const;
+    void cellCoordinates( Cell cell, unsigned int coordinates[3] ) const;
 
 private:
+    float _radius;
+    float _extendedRadius;
+    NeighborhoodMode _neighborhoodMode;
     QVector<QVector<unsigned int> > _neighborhoods;
+    QVector<StencilOffset> _stencil;
+    QVector<StencilOffset> _halfStencil;
+    QVector<StencilOffset> _extendedStencil;
     QVector<QVector<unsigned int> > _cellParticles;
 
+    // Migrations of the incremental storage : the removals and additions of
+    // every migration, sorted by the bucket of cells they touch
+    QVector<Migration> _migrations;
+    QVector<unsigned int> _editKeys;
+    QVector<unsigned int> _editStart;
+    QVector<unsigned int> _editCount;
+    QVector<unsigned int> _sortedEdits;
+    QVector<unsigned int> _editOffsets;
+
+    // Counting sort storage
+    StorageMode _storageMode;
+    QVector<unsigned int> _cellStart;
+    QVector<unsigned int> _cellCount;
+    QVector<unsigned int> _sortedIndex;
+    QVector<unsigned int> _threadOffsets;
+
+    // Hashed storage : the particles sorted by bucket, then by cell inside each
+    // bucket, and the cells of the buckets ( '_bucketCells[b]' is the first
+    // cell of bucket 'b' in '_hashedCells' )
+    QVector<unsigned int> _bucketKeys;
+    QVector<unsigned int> _bucketStart;
+    QVector<unsigned int> _bucketCount;
+    QVector<unsigned int> _bucketCells;
+    QVector<HashedCell> _hashedCells;
+    unsigned int _hashBits;
+
     BoundingBox _boundingBox;
     unsigned int _nbCell[3];
     float _cellSize[3];
 };
 
+template <typename Function>
+inline void Grid::forEachNeighborCell( Cell cell, Function function ) const
+{
+    // The hashed storage always uses the stencil
+    if ( _neighborhoodMode == NeighborhoodExplicit )
+    {
+        const QVector<unsigned int>& neighborhood = _neighborhoods[cell];
+
+        for ( int j=0 ; j<neighborhood.size() ; ++j )
+            function( neighborhood[j] );
+
+        return;
+    }
+
+    forEachStencilCell( cell, _stencil, function );
+}
+
+template <typename Function>
+inline void Grid::forEachHalfNeighborCell( Cell cell, Function function ) const
+{
+    forEachStencilCell( cell, _halfStencil, function );
+}
+
+template <typename Function>
+inline void Grid::forEachExtendedNeighborCell( Cell cell, Function function ) const
+{
+    forEachStencilCell( cell, _extendedStencil, function );
+}
+
+template <typename Function>
+inline void Grid::forEachStencilCell( Cell cell, const QVector<StencilOffset>& stencil, Function function ) const
+{
+    if ( _storageMode == StorageHashed )
+    {
+        unsigned int x = cell & HashedMask;
+        unsigned int y = ( cell >> HashedBits ) & HashedMask;
+        unsigned int z = cell >> ( 2 * HashedBits );
+
+        for ( int j=0 ; j<stencil.size() ; ++j )
+        {
+            const StencilOffset& offset = stencil[j];
+
+            if ( Cell( x + offset.dx ) <= HashedMask &&
+                 Cell( y + offset.dy ) <= HashedMask &&
+                 Cell( z + offset.dz ) <= HashedMask )
+                function( packCell( x + offset.dx, y + offset.dy, z + offset.dz ) );
+        }
+
+        return;
+    }
+
+    int x = cell % _nbCell[0];
+    int y = ( cell / _nbCell[0] ) % _nbCell[1];
+    int z = cell / ( _nbCell[0] * _nbCell[1] );
+
+    for ( int j=0 ; j<stencil.size() ; ++j )
+    {
+        const StencilOffset& offset = stencil[j];
+
+        if ( (unsigned int)( x + offset.dx ) < _nbCell[0] &&
+             (unsigned int)( y + offset.dy ) < _nbCell[1] &&
+             (unsigned int)( z + offset.dz ) < _nbCell[2] )
+            function( cell + offset.offset );
+    }
+}
+
+inline Grid::Cell Grid::packCell( unsigned int x, unsigned int y, unsigned int z )
+{
+    return Cell( x ) | ( Cell( y ) << HashedBits ) | ( Cell( z ) << ( 2 * HashedBits ) );
+}
+
 #endif //GRID_H
@@ -0,0 +1,132 @@
+#include "NeighborList.h"
+#include <algorithm>
+#include <cstring>
+
+NeighborList::NeighborList()
+{
+    _statistics.steps = 0;
+    _statistics.rebuilds = 0;
+    _statistics.averageNeighbors = 0;
+}
+
+void NeighborList::update( const Particles& particles, const Grid& grid, float radius, float skin )
+{
+    ++_statistics.steps;
+
+    if ( needsRebuild( particles, skin ) )
+        build( particles, grid, radius + skin );
+}
+
+void NeighborList::clear()
+{
+    _start.clear();
+    _neighbors.clear();
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+        _referencePositions[axis].clear();
+}
+
+ParticleRange NeighborList::neighbors( unsigned int particle ) const
+{
+    const unsigned int* neighbors = _neighbors.constData();
+    return ParticleRange( neighbors + _start[particle], neighbors + _start[particle+1] );
+}
+
+const NeighborList::Statistics& NeighborList::statistics() const
+{
+    return _statistics;
+}
+
+bool NeighborList::needsRebuild( const Particles& particles, float skin ) const
+{
+    if ( _start.size() != particles.size() + 1 )
+        return true;
+
+    const float* x = particles.positions( 0 );
+    const float* y = particles.positions( 1 );
+    const float* z = particles.positions( 2 );
+    const float* x0 = _referencePositions[0].constData();
+    const float* y0 = _referencePositions[1].constData();
+    const float* z0 = _referencePositions[2].constData();
+    float maxDisplacement2 = 0;
+
+    #pragma omp parallel for schedule( static ) reduction( max : maxDisplacement2 )
+    for ( int i=0 ; i<particles.size() ; ++i )
+    {
+        float dx = x[i] - x0[i];
+        float dy = y[i] - y0[i];
+        float dz = z[i] - z0[i];
+        maxDisplacement2 = std::max( maxDisplacement2, dx * dx + dy * dy + dz * dz );
+    }
+
+    // Two particles moving towards each other close the gap twice as fast
+    return maxDisplacement2 > 0.25f * skin * skin;
+}
+
+void NeighborList::build( const Particles& particles, const Grid& grid, float radius )
+{
+    int nbParticles = particles.size();
+    float radius2 = radius * radius;
+
+    _start.resize( nbParticles + 1 );
+    unsigned int* start = _start.data();
+
+    // First pass : count the neighbors of each particle
+    #pragma omp parallel for schedule( guided )
+    for ( int i=0 ; i<nbParticles ; ++i )
+        start[i+1] = gatherNeighbors( particles, grid, i, radius2, 0 );
+
+    start[0] = 0;
+
+    for ( int i=0 ; i<nbParticles ; ++i )
+        start[i+1] += start[i];
+
+    // Second pass : fill the lists
+    _neighbors.resize( start[nbParticles] );
+    unsigned int* neighbors = _neighbors.data();
+
+    #pragma omp parallel for schedule( guided )
+    for ( int i=0 ; i<nbParticles ; ++i )
+        gatherNeighbors( particles, grid, i, radius2, neighbors + start[i] );
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        _referencePositions[axis].resize( nbParticles );
+        ::memcpy( _referencePositions[axis].data(), particles.positions( axis ), nbParticles * sizeof( float ) );
+    }
+
+    ++_statistics.rebuilds;
+    _statistics.averageNeighbors = nbParticles ? (float)start[nbParticles] / nbParticles : 0;
+}
+
+unsigned int NeighborList::gatherNeighbors( const Particles& particles, const Grid& grid, unsigned int particle,
+                                            float radius2, unsigned int* neighbors ) const
+{
+    const float* x = particles.positions( 0 );
+    const float* y = particles.positions( 1 );
+    const float* z = particles.positions( 2 );
+    unsigned int nbNeighbors = 0;
+
+    grid.forEachExtendedNeighborCell( particles.cellIndex( particle ), [&]( Grid::Cell neighborCell )
+    {
+        ParticleRange cell = grid.cellParticles( neighborCell );
+
+        for ( int k=0 ; k<cell.size() ; ++k )
+        {
+            unsigned int n = cell[k];
+            float dx = x[particle] - x[n];
+            float dy = y[particle] - y[n];
+            float dz = z[particle] - z[n];
+
+            if ( dx * dx + dy * dy + dz * dz < radius2 )
+            {
+                if ( neighbors )
+                    neighbors[nbNeighbors] = n;
+
+                ++nbNeighbors;
+            }
+        }
+    } );
+
+    return nbNeighbors;
+}
@@ -0,0 +1,49 @@
+#ifndef NEIGHBORLIST_H
+#define NEIGHBORLIST_H
+
+#include "SPH/Grid.h"
+#include "SPH/Particles.h"
+#include "SPH/ParticleRange.h"
+
+/* Verlet neighbor lists. For every particle, the list stores the particles
+ * closer than 'radius' + 'skin' at build time. As long as no particle has
+ * moved more than half the skin since then, every pair closer than 'radius'
+ * is still in the lists, so they can be reused by the solver passes instead
+ * of walking the grid again.
+ *
+ * The extended radius of the grid used to build the lists must reach
+ * 'radius' + 'skin' ( see Grid::setExtendedRadius ).
+ */
+
+class NeighborList
+{
+public:
+    struct Statistics
+    {
+        unsigned int steps;
+        unsigned int rebuilds;
+        float averageNeighbors;
+    };
+
+    NeighborList();
+
+    void update( const Particles& particles, const Grid& grid, float radius, float skin );
+    void clear();
+
+    ParticleRange neighbors( unsigned int particle ) const;
+    const Statistics& statistics() const;
+
+private:
+    bool needsRebuild( const Particles& particles, float skin ) const;
+    void build( const Particles& particles, const Grid& grid, float radius );
+    unsigned int gatherNeighbors( const Particles& particles, const Grid& grid, unsigned int particle,
+                                  float radius2, unsigned int* neighbors ) const;
+
+private:
+    QVector<unsigned int> _start;
+    QVector<unsigned int> _neighbors;
+    QVector<float> _referencePositions[3];
+    Statistics _statistics;
+};
+
+#endif // NEIGHBORLIST_H
@@ -0,0 +1,49 @@
+#ifndef PARTICLERANGE_H
+#define PARTICLERANGE_H
+
+/* A contiguous range of particle indices, e.g. the particles of a grid cell
+ * or the neighbors of a particle. It does not own the indices.
+ */
+
+class ParticleRange
+{
+public:
+    ParticleRange( const unsigned int* begin, const unsigned int* end );
+
+    const unsigned int* begin() const;
+    const unsigned int* end() const;
+    int size() const;
+    unsigned int operator[]( int i ) const;
+
+private:
+    const unsigned int* _begin;
+    const unsigned int* _end;
+};
+
+inline ParticleRange::ParticleRange( const unsigned int* begin, const unsigned int* end )
+    : _begin( begin )
+    , _end( end )
+{
+}
+
+inline const unsigned int* ParticleRange::begin() const
+{
+    return _begin;
+}
+
+inline const unsigned int* ParticleRange::end() const
+{
+    return _end;
+}
+
+inline int ParticleRange::size() const
+{
+    return _end - _begin;
+}
+
+inline unsigned int ParticleRange::operator[]( int i ) const
+{
+    return _begin[i];
+}
+
+#endif // PARTICLERANGE_H
@@ -0,0 +1,313 @@
+#include "ParticleSeeder.h"
+#include "SPH/Grid.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+// Rejection sampling tries per random particle
+static const unsigned int MaxAttempts = 1024;
+
+// Spacing reductions when the container cannot hold the particles
+static const unsigned int MaxRefinements = 16;
+
+// Poisson-disk candidates drawn per grid cell, the cells being as large as
+// the minimum distance
+static const unsigned int CandidatesPerCell = 4;
+
+// Poisson-disk candidates drawn per particle at first, as the selection keeps
+// about one candidate out of 8
+static const unsigned int CandidatesPerSample = 12;
+
+// Samples per cubed minimum distance that the selection above produces
+static const float PoissonDiskDensity = 0.5;
+
+enum SampleState { SampleUndecided, SampleAccepted, SampleRejected };
+
+ParticleSeeder::ParticleSeeder( const Geometry& container, const QVector3D& gravity, quint64 seed )
+    : _container( container )
+    , _gravity( gravity )
+    , _random( seed )
+{
+}
+
+QVector<QVector3D> ParticleSeeder::seed( Mode mode, unsigned int nbParticles, float totalVolume ) const
+{
+    if ( nbParticles == 0 )
+        return QVector<QVector3D>();
+
+    switch ( mode )
+    {
+        case SeedingRandom : return randomPoints( nbParticles );
+        case SeedingLattice : return latticePoints( nbParticles, totalVolume );
+        case SeedingPoissonDisk : return poissonDiskPoints( nbParticles, totalVolume );
+    }
+
+    return randomPoints( nbParticles );
+}
+
+const char* ParticleSeeder::modeName( Mode mode )
+{
+    switch ( mode )
+    {
+        case SeedingRandom : return "random";
+        case SeedingLattice : return "lattice";
+        case SeedingPoissonDisk : return "poisson";
+    }
+
+    return "";
+}
+
+QVector<QVector3D> ParticleSeeder::randomPoints( unsigned int nbParticles ) const
+{
+    QVector<QVector3D> points( nbParticles );
+    QVector3D* data = points.data();
+
+    #pragma omp parallel for schedule( static )
+    for ( int i=0 ; i<(int)nbParticles ; ++i )
+        data[i] = randomInteriorPoint( i );
+
+    return points;
+}
+
+QVector<QVector3D> ParticleSeeder::latticePoints( unsigned int nbParticles, float totalVolume ) const
+{
+    BoundingBox boundingBox = _container.boundingBox();
+    QVector3D boxSize = boundingBox.maximum() - boundingBox.minimum();
+    float spacing = cbrtf( totalVolume / nbParticles );
+
+    for ( unsigned int refinement=0 ; refinement<MaxRefinements ; ++refinement )
+    {
+        // Centered in the bounding box
+        unsigned int nbNodes[3] = { std::max( 1u, (unsigned int)( boxSize.x() / spacing ) ),
+                                    std::max( 1u, (unsigned int)( boxSize.y() / spacing ) ),
+                                    std::max( 1u, (unsigned int)( boxSize.z() / spacing ) ) };
+        QVector3D latticeSize( nbNodes[0] - 1, nbNodes[1] - 1, nbNodes[2] - 1 );
+        QVector3D origin = boundingBox.minimum() + 0.5 * ( boxSize - latticeSize * spacing );
+
+        int nbTotalNodes = nbNodes[0] * nbNodes[1] * nbNodes[2];
+        QVector<char> inside( nbTotalNodes );
+        char* insideData = inside.data();
+
+        #pragma omp parallel for schedule( static )
+        for ( int i=0 ; i<nbTotalNodes ; ++i )
+        {
+            QVector3D node( i % nbNodes[0], ( i / nbNodes[0] ) % nbNodes[1], i / ( nbNodes[0] * nbNodes[1] ) );
+            insideData[i] = _container.isInside( origin + node * spacing );
+        }
+
+        QVector<QVector3D> points;
+        for ( int i=0 ; i<nbTotalNodes ; ++i )
+            if ( inside[i] )
+                points.append( origin + QVector3D( i % nbNodes[0], ( i / nbNodes[0] ) % nbNodes[1], i / ( nbNodes[0] * nbNodes[1] ) ) * spacing );
+
+        if ( (unsigned int)points.size() >= nbParticles )
+        {
+            keepLowest( points, nbParticles );
+            return points;
+        }
+
+        spacing *= 0.98 * cbrtf( std::max( points.size(), 1 ) / (float)nbParticles );
+    }
+
+    return randomPoints( nbParticles );
+}
+
+QVector<QVector3D> ParticleSeeder::poissonDiskPoints( unsigned int nbParticles, float totalVolume ) const
+{
+    float radius = cbrtf( PoissonDiskDensity * totalVolume / nbParticles );
+    unsigned int maxCandidates = nbParticles * CandidatesPerSample;
+
+    for ( unsigned int refinement=0 ; refinement<MaxRefinements ; ++refinement )
+    {
+        bool truncated = false;
+        QVector<QVector3D> points = poissonDiskSamples( radius, maxCandidates, truncated );
+
+        if ( (unsigned int)points.size() >= nbParticles )
+        {
+            keepLowest( points, nbParticles );
+            return points;
+        }
+
+        // Draw higher candidates, or tighten the spacing when the whole
+        // container was used
+        if ( truncated )
+            maxCandidates *= 2;
+        else
+            radius *= 0.98 * cbrtf( std::max( points.size(), 1 ) / (float)nbParticles );
+    }
+
+    return randomPoints( nbParticles );
+}
+
+QVector3D ParticleSeeder::randomInteriorPoint( quint64 index ) const
+{
+    BoundingBox boundingBox = _container.boundingBox();
+    QVector3D boxSize = boundingBox.maximum() - boundingBox.minimum();
+
+    for ( quint64 attempt=0 ; attempt<MaxAttempts ; ++attempt )
+    {
+        quint64 counter = 3 * ( index * MaxAttempts + attempt );
+        QVector3D point = boundingBox.minimum() + QVector3D( _random.uniform( counter ),
+                                                             _random.uniform( counter + 1 ),
+                                                             _random.uniform( counter + 2 ) ) * boxSize;
+
+        if ( _container.isInside( point ) )
+            return point;
+    }
+
+    return boundingBox.minimum() + 0.5 * boxSize;
+}
+
+QVector<QVector3D> ParticleSeeder::poissonDiskSamples( float radius, unsigned int maxCandidates, bool& truncated ) const
+{
+    BoundingBox boundingBox = _container.boundingBox();
+    QVector3D boxSize = boundingBox.maximum() - boundingBox.minimum();
+    unsigned int nbCell[3] = { std::max( 1u, (unsigned int)( boxSize.x() / radius ) ),
+                               std::max( 1u, (unsigned int)( boxSize.y() / radius ) ),
+                               std::max( 1u, (unsigned int)( boxSize.z() / radius ) ) };
+    QVector3D cellSize( boxSize.x() / nbCell[0], boxSize.y() / nbCell[1], boxSize.z() / nbCell[2] );
+
+    // Candidates inside the container, with 4 random numbers each : the
+    // position and the priority
+    int nbSlots = nbCell[0] * nbCell[1] * nbCell[2] * CandidatesPerCell;
+    QVector<QVector3D> slotPositions( nbSlots );
+    QVector<char> inside( nbSlots );
+    QVector3D* slotPositionData = slotPositions.data();
+    char* insideData = inside.data();
+
+    #pragma omp parallel for schedule( static )
+    for ( int i=0 ; i<nbSlots ; ++i )
+    {
+        unsigned int cell = i / CandidatesPerCell;
+        QVector3D corner( cell % nbCell[0], ( cell / nbCell[0] ) % nbCell[1], cell / ( nbCell[0] * nbCell[1] ) );
+        QVector3D offset( _random.uniform( 4 * (quint64)i ), _random.uniform( 4 * (quint64)i + 1 ), _random.uniform( 4 * (quint64)i + 2 ) );
+
+        slotPositionData[i] = boundingBox.minimum() + ( corner + offset ) * cellSize;
+        insideData[i] = _container.isInside( slotPositionData[i] );
+    }
+
+    // Only keep the lowest candidates along the gravity, since the fluid will
+    // not reach the others, in the order of the slots
+    std::vector<std::pair<float, int> > heights;
+    for ( int i=0 ; i<nbSlots ; ++i )
+        if ( inside[i] )
+            heights.push_back( std::make_pair( QVector3D::dotProduct( slotPositions[i], -_gravity ), i ) );
+
+    truncated = heights.size() > maxCandidates;
+    if ( truncated )
+    {
+        std::nth_element( heights.begin(), heights.begin() + maxCandidates, heights.end() );
+        heights.resize( maxCandidates );
+    }
+
+    std::vector<int> kept( heights.size() );
+    for ( unsigned int i=0 ; i<heights.size() ; ++i )
+        kept[i] = heights[i].second;
+
+    std::sort( kept.begin(), kept.end() );
+
+    QVector<QVector3D> candidates;
+    QVector<quint64> priorities;
+    for ( unsigned int i=0 ; i<kept.size() ; ++i )
+    {
+        candidates.append( slotPositions[kept[i]] );
+        priorities.append( _random.bits( 4 * (quint64)kept[i] + 3 ) );
+    }
+
+    int nbCandidates = candidates.size();
+    Grid grid( boundingBox, nbCell[0], nbCell[1], nbCell[2], radius, Grid::StorageCountingSort, Grid::NeighborhoodStencil );
+    QVector<Grid::Cell> cellIndices( nbCandidates );
+
+    for ( int i=0 ; i<nbCandidates ; ++i )
+        cellIndices[i] = grid.cellIndex( candidates[i] );
+
+    grid.rebuild( cellIndices.constData(), nbCandidates );
+
+    // Every round accepts the candidates of highest priority among their
+    // undecided neighbors, and rejects the neighbors of accepted candidates.
+    // The decisions of a round are applied after it, so that they do not depend
+    // on the order of the updates. The result is the greedy selection in
+    // priority order.
+    QVector<char> states( nbCandidates, SampleUndecided );
+    QVector<unsigned int> undecided( nbCandidates );
+    const char* stateData = states.constData();
+    const QVector3D* candidateData = candidates.constData();
+    const quint64* priorityData = priorities.constData();
+    float radius2 = radius * radius;
+
+    for ( int i=0 ; i<nbCandidates ; ++i )
+        undecided[i] = i;
+
+    while ( !undecided.isEmpty() )
+    {
+        int nbUndecided = undecided.size();
+        QVector<char> decisions( nbUndecided );
+        char* decisionData = decisions.data();
+
+        #pragma omp parallel for schedule( guided )
+        for ( int k=0 ; k<nbUndecided ; ++k )
+        {
+            unsigned int i = undecided[k];
+            bool rejected = false;
+            bool dominated = false;
+
+            grid.forEachNeighborCell( cellIndices[i], [&]( Grid::Cell cell )
+            {
+                if ( rejected )
+                    return;
+
+                ParticleRange range = grid.cellParticles( cell );
+
+                for ( const unsigned int* j=range.begin() ; j!=range.end() && !rejected ; ++j )
+                {
+                    if ( *j == i || stateData[*j] == SampleRejected ||
+                         ( candidateData[*j] - candidateData[i] ).lengthSquared() >= radius2 )
+                        continue;
+
+                    if ( stateData[*j] == SampleAccepted )
+                        rejected = true;
+                    else if ( priorityData[*j] > priorityData[i] || ( priorityData[*j] == priorityData[i] && *j < i ) )
+                        dominated = true;
+                }
+            } );
+
+            decisionData[k] = rejected ? SampleRejected : ( dominated ? SampleUndecided : SampleAccepted );
+        }
+
+        QVector<unsigned int> remaining;
+        for ( int k=0 ; k<nbUndecided ; ++k )
+        {
+            if ( decisions[k] == SampleUndecided )
+                remaining.append( undecided[k] );
+            else
+                states[undecided[k]] = decisions[k];
+        }
+
+        undecided.swap( remaining );
+    }
+
+    QVector<QVector3D> samples;
+    for ( int i=0 ; i<nbCandidates ; ++i )
+        if ( states[i] == SampleAccepted )
+            samples.append( candidates[i] );
+
+    return samples;
+}
+
+void ParticleSeeder::keepLowest( QVector<QVector3D>& points, unsigned int nbParticles ) const
+{
+    // Sort by height along the gravity, ties by index for a deterministic order
+    std::vector<std::pair<float, int> > heights( points.size() );
+
+    for ( int i=0 ; i<points.size() ; ++i )
+        heights[i] = std::make_pair( QVector3D::dotProduct( points[i], -_gravity ), i );
+
+    std::sort( heights.begin(), heights.end() );
+
+    QVector<QVector3D> lowest( nbParticles );
+    for ( unsigned int i=0 ; i<nbParticles ; ++i )
+        lowest[i] = points[heights[i].second];
+
+    points = lowest;
+}
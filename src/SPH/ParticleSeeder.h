@@ -0,0 +1,52 @@
+#ifndef PARTICLESEEDER_H
+#define PARTICLESEEDER_H
+
+#include "Geometry/Geometry.h"
+#include "SPH/CounterRandom.h"
+#include <QVector3D>
+#include <QVector>
+
+/* Places the initial particles inside a container, in parallel and with a
+ * result that only depends on the seed ( not on the thread count ) :
+ *   - SeedingRandom : uniform positions in the whole container, by rejection
+ *     sampling with a counter-based generator ( see CounterRandom ).
+ *   - SeedingLattice : a regular cubic lattice whose spacing gives each
+ *     particle its share of the fluid volume.
+ *   - SeedingPoissonDisk : random positions at least a minimum distance apart,
+ *     chosen among random candidates as a maximal independent set ( see
+ *     M. Luby. 1986. A simple parallel algorithm for the maximal independent set
+ *     problem ) with random priorities.
+ *
+ * The lattice and Poisson-disk modes fill the container from its bottom along
+ * the gravity with the fluid volume, instead of spreading the particles over
+ * the whole container, and never put two particles too close to each other.
+ * They tighten their spacing if the container is too small for the volume.
+ */
+
+class ParticleSeeder
+{
+public:
+    enum Mode { SeedingRandom, SeedingLattice, SeedingPoissonDisk };
+
+    ParticleSeeder( const Geometry& container, const QVector3D& gravity, quint64 seed );
+
+    QVector<QVector3D> seed( Mode mode, unsigned int nbParticles, float totalVolume ) const;
+
+    static const char* modeName( Mode mode );
+
+private:
+    QVector<QVector3D> randomPoints( unsigned int nbParticles ) const;
+    QVector<QVector3D> latticePoints( unsigned int nbParticles, float totalVolume ) const;
+    QVector<QVector3D> poissonDiskPoints( unsigned int nbParticles, float totalVolume ) const;
+
+    QVector3D randomInteriorPoint( quint64 index ) const;
+    QVector<QVector3D> poissonDiskSamples( float radius, unsigned int maxCandidates, bool& truncated ) const;
+    void keepLowest( QVector<QVector3D>& points, unsigned int nbParticles ) const;
+
+private:
+    const Geometry& _container;
+    QVector3D _gravity;
+    CounterRandom _random;
+};
+
+#endif // PARTICLESEEDER_H
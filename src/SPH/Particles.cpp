@@ -5,18 +5,413 @@ namespace
 {
     static unsigned int nbThetas = 10;
     static unsigned int nbPhis = 10;
+
+    template <typename T>
+    void permute( QVector<T>& stream, const QVector<unsigned int>& order, QVector<T>& buffer )
+    {
+        buffer.resize( order.size() );
+
+        const T* source = stream.constData();
+        const unsigned int* indices = order.constData();
+        T* destination = buffer.data();
+
+        #pragma omp parallel for schedule( static )
+        for ( int i=0 ; i<order.size() ; ++i )
+            destination[i] = source[indices[i]];
+
+        stream.swap( buffer );
+    }
 }
 
 Particles::Particles( unsigned int nbParticles )
-    : QVector<Particle>( nbParticles )
+    : _masses( nbParticles )
+    , _densities( nbParticles )
+    , _volumes( nbParticles )
+    , _pressures( nbParticles )
+    , _cellIndices( nbParticles )
+    , _stillSteps( nbParticles )
+    , _sleeping( nbParticles )
+    , _identifiers( nbParticles )
+    , _doublePrecision( false )
     , _vertexBuffer( QGLBuffer::VertexBuffer )
     , _normalBuffer( QGLBuffer::VertexBuffer )
     , _indexBuffer( QGLBuffer::IndexBuffer )
     , _nbIndices( 0 )
 {
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        _positions[axis].resize( nbParticles );
+        _velocities[axis].resize( nbParticles );
+        _accelerations[axis].resize( nbParticles );
+    }
+}
+
+int Particles::size() const
+{
+    return _masses.size();
+}
+
+void Particles::resize( int nbParticles )
+{
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        _positions[axis].resize( nbParticles );
+        _velocities[axis].resize( nbParticles );
+        _accelerations[axis].resize( nbParticles );
+
+        if ( _doublePrecision )
+        {
+            _precisePositions[axis].resize( nbParticles );
+            _preciseVelocities[axis].resize( nbParticles );
+        }
+    }
+
+    _masses.resize( nbParticles );
+    _densities.resize( nbParticles );
+    _volumes.resize( nbParticles );
+    _pressures.resize( nbParticles );
+    _cellIndices.resize( nbParticles );
+    _stillSteps.resize( nbParticles );
+    _sleeping.resize( nbParticles );
+    _identifiers.resize( nbParticles );
+}
+
+void Particles::setPosition( int i, const QVector3D& position )
+{
+    float components[3] = { position.x(), position.y(), position.z() };
+
+    setPosition( i, components );
+}
+
+void Particles::setVelocity( int i, const QVector3D& velocity )
+{
+    float components[3] = { velocity.x(), velocity.y(), velocity.z() };
+
+    setVelocity( i, components );
+}
+
+void Particles::setPosition( int i, const float position[3] )
+{
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        _positions[axis][i] = position[axis];
+
+        if ( _doublePrecision )
+            _precisePositions[axis][i] = position[axis];
+    }
+}
+
+void Particles::setVelocity( int i, const float velocity[3] )
+{
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        _velocities[axis][i] = velocity[axis];
+
+        if ( _doublePrecision )
+            _preciseVelocities[axis][i] = velocity[axis];
+    }
+}
+
+void Particles::setPosition( int i, const double position[3] )
+{
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        _positions[axis][i] = position[axis];
+
+        if ( _doublePrecision )
+            _precisePositions[axis][i] = position[axis];
+    }
+}
+
+void Particles::setVelocity( int i, const double velocity[3] )
+{
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        _velocities[axis][i] = velocity[axis];
+
+        if ( _doublePrecision )
+            _preciseVelocities[axis][i] = velocity[axis];
+    }
+}
+
+void Particles::setAcceleration( int i, const QVector3D& acceleration )
+{
+    _accelerations[0][i] = acceleration.x();
+    _accelerations[1][i] = acceleration.y();
+    _accelerations[2][i] = acceleration.z();
+}
+
+void Particles::setMass( int i, float mass )
+{
+    _masses[i] = mass;
+}
+
+void Particles::setDensity( int i, float density )
+{
+    _densities[i] = density;
+}
+
+void Particles::setVolume( int i, float volume )
+{
+    _volumes[i] = volume;
+}
+
+void Particles::setPressure( int i, float pressure )
+{
+    _pressures[i] = pressure;
+}
+
+void Particles::setCellIndex( int i, quint64 cellIndex )
+{
+    _cellIndices[i] = cellIndex;
+}
+
+QVector3D Particles::position( int i ) const
+{
+    return QVector3D( _positions[0][i], _positions[1][i], _positions[2][i] );
+}
+
+QVector3D Particles::velocity( int i ) const
+{
+    return QVector3D( _velocities[0][i], _velocities[1][i], _velocities[2][i] );
+}
+
+QVector3D Particles::acceleration( int i ) const
+{
+    return QVector3D( _accelerations[0][i], _accelerations[1][i], _accelerations[2][i] );
+}
+
+float Particles::mass( int i ) const
+{
+    return _masses[i];
+}
+
+float Particles::density( int i ) const
+{
+    return _densities[i];
+}
+
+float Particles::volume( int i ) const
+{
+    return _volumes[i];
+}
+
+float Particles::pressure( int i ) const
+{
+    return _pressures[i];
+}
+
+quint64 Particles::cellIndex( int i ) const
+{
+    return _cellIndices[i];
+}
+
+float* Particles::positions( unsigned int axis )
+{
+    return _positions[axis].data();
+}
+
+float* Particles::velocities( unsigned int axis )
+{
+    return _velocities[axis].data();
+}
+
+float* Particles::accelerations( unsigned int axis )
+{
+    return _accelerations[axis].data();
+}
+
+float* Particles::masses()
+{
+    return _masses.data();
+}
+
+float* Particles::densities()
+{
+    return _densities.data();
+}
+
+float* Particles::volumes()
+{
+    return _volumes.data();
+}
+
+float* Particles::pressures()
+{
+    return _pressures.data();
+}
+
+quint64* Particles::cellIndices()
+{
+    return _cellIndices.data();
+}
+
+const float* Particles::positions( unsigned int axis ) const
+{
+    return _positions[axis].constData();
+}
+
+const float* Particles::velocities( unsigned int axis ) const
+{
+    return _velocities[axis].constData();
+}
+
+const float* Particles::accelerations( unsigned int axis ) const
+{
+    return _accelerations[axis].constData();
+}
+
+const float* Particles::masses() const
+{
+    return _masses.constData();
+}
+
+const float* Particles::densities() const
+{
+    return _densities.constData();
+}
+
+const float* Particles::volumes() const
+{
+    return _volumes.constData();
+}
+
+const float* Particles::pressures() const
+{
+    return _pressures.constData();
+}
+
+const quint64* Particles::cellIndices() const
+{
+    return _cellIndices.constData();
+}
+
+unsigned int* Particles::stillSteps()
+{
+    return _stillSteps.data();
+}
+
+unsigned char* Particles::sleeping()
+{
+    return _sleeping.data();
+}
+
+const unsigned int* Particles::stillSteps() const
+{
+    return _stillSteps.constData();
+}
+
+const unsigned char* Particles::sleeping() const
+{
+    return _sleeping.constData();
+}
+
+unsigned int* Particles::identifiers()
+{
+    return _identifiers.data();
+}
+
+const unsigned int* Particles::identifiers() const
+{
+    return _identifiers.constData();
+}
+
+void Particles::setDoublePrecision( bool doublePrecision )
+{
+    _doublePrecision = doublePrecision;
+
+    // Start from the current float state
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        _precisePositions[axis].clear();
+        _preciseVelocities[axis].clear();
+
+        if ( !doublePrecision )
+            continue;
+
+        _precisePositions[axis].resize( size() );
+        _preciseVelocities[axis].resize( size() );
+
+        for ( int i=0 ; i<size() ; ++i )
+        {
+            _precisePositions[axis][i] = _positions[axis][i];
+            _preciseVelocities[axis][i] = _velocities[axis][i];
+        }
+    }
+}
+
+bool Particles::doublePrecision() const
+{
+    return _doublePrecision;
+}
+
+double* Particles::precisePositions( unsigned int axis )
+{
+    return _precisePositions[axis].data();
+}
+
+double* Particles::preciseVelocities( unsigned int axis )
+{
+    return _preciseVelocities[axis].data();
+}
+
+const double* Particles::precisePositions( unsigned int axis ) const
+{
+    return _precisePositions[axis].constData();
+}
+
+const double* Particles::preciseVelocities( unsigned int axis ) const
+{
+    return _preciseVelocities[axis].constData();
+}
+
+void Particles::reorder( const QVector<unsigned int>& order )
+{
+    // Each stream is gathered into the previous one's storage
+    QVector<float> buffer;
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        permute( _positions[axis], order, buffer );
+        permute( _velocities[axis], order, buffer );
+        permute( _accelerations[axis], order, buffer );
+    }
+
+    permute( _masses, order, buffer );
+    permute( _densities, order, buffer );
+    permute( _volumes, order, buffer );
+    permute( _pressures, order, buffer );
+
+    QVector<quint64> cellBuffer;
+    permute( _cellIndices, order, cellBuffer );
+
+    QVector<unsigned int> stepsBuffer;
+    permute( _stillSteps, order, stepsBuffer );
+    permute( _identifiers, order, stepsBuffer );
+
+    QVector<unsigned char> sleepingBuffer;
+    permute( _sleeping, order, sleepingBuffer );
+
+    if ( !_doublePrecision )
+        return;
+
+    QVector<double> preciseBuffer;
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        permute( _precisePositions[axis], order, preciseBuffer );
+        permute( _preciseVelocities[axis], order, preciseBuffer );
+    }
 }
 
 void Particles::render( const QMatrix4x4& transformation, GLShader& shader )
+{
+    const float* positions[3] = { _positions[0].constData(), _positions[1].constData(), _positions[2].constData() };
+
+    render( transformation, shader, positions, _volumes.constData(), size() );
+}
+
+void Particles::render( const QMatrix4x4& transformation, GLShader& shader, const float* const positions[3], const float* volumes, int nbParticles )
 {
     if ( !_indexBuffer.isCreated() )
         createOpenGLBuffers();
@@ -33,14 +428,13 @@ void Particles::render( const QMatrix4x4& transformation, GLShader& shader )
 
     _indexBuffer.bind();
 
-    for ( int i=0 ; i<size() ; ++i )
+    for ( int i=0 ; i<nbParticles ; ++i )
     {
-        const Particle& particle = (*this)[i];
         QMatrix4x4 translation;
-        float radius = ::pow( ( 3.0 * particle.volume() ) / ( 4.0 * M_PI ), 1.0 / 3.0 );
+        float radius = ::pow( ( 3.0 * volumes[i] ) / ( 4.0 * M_PI ), 1.0 / 3.0 );
 
         translation.scale( radius );
-        translation.setColumn( 3, QVector4D( particle.position(), 1 ) );
+        translation.setColumn( 3, QVector4D( positions[0][i], positions[1][i], positions[2][i], 1 ) );
         shader.setGlobalTransformation( transformation * translation );
 
         glDrawElements( GL_TRIANGLES, _nbIndices, GL_UNSIGNED_INT, 0 );
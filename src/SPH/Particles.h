@@ -1,22 +1,108 @@
 #ifndef PARTICLES_H
 #define PARTICLES_H
 
-#include "SPH/Particle.h"
 #include "GLShader.h"
 #include <QGLBuffer>
+#include <QVector>
+#include <QVector3D>
 
 #define M_PI 3.14159265358979323846264338327950288
 
-/* A list of particles + a render function.
+/* A set of particles stored as a structure of arrays + a render function.
+ *
+ * Each attribute lives in its own contiguous stream ( one per component for
+ * vectors ) so the solver loops only pull the data they actually use through
+ * the cache. The per-particle accessors are convenient for non critical code,
+ * the raw streams are meant for the hot loops.
  */
 
-class Particles : public QVector<Particle>
+class Particles
 {
 public:
     Particles( unsigned int nbParticles );
 
+    int size() const;
+
+    // Keeps the first particles, or adds particles with zero attributes
+    void resize( int nbParticles );
+
+    // 'Setters'
+    void setPosition( int i, const QVector3D& position );
+    void setVelocity( int i, const QVector3D& velocity );
+    void setPosition( int i, const float position[3] );
+    void setVelocity( int i, const float velocity[3] );
+    void setPosition( int i, const double position[3] );
+    void setVelocity( int i, const double velocity[3] );
+    void setAcceleration( int i, const QVector3D& acceleration );
+    void setMass( int i, float mass );
+    void setDensity( int i, float density );
+    void setVolume( int i, float volume );
+    void setPressure( int i, float pressure );
+    void setCellIndex( int i, quint64 cellIndex );
+
+    // 'Getters'
+    QVector3D position( int i ) const;
+    QVector3D velocity( int i ) const;
+    QVector3D acceleration( int i ) const;
+    float mass( int i ) const;
+    float density( int i ) const;
+    float volume( int i ) const;
+    float pressure( int i ) const;
+    quint64 cellIndex( int i ) const;
+
+    // Attribute streams ( 'axis' selects the x, y or z component )
+    float* positions( unsigned int axis );
+    float* velocities( unsigned int axis );
+    float* accelerations( unsigned int axis );
+    float* masses();
+    float* densities();
+    float* volumes();
+    float* pressures();
+    quint64* cellIndices();
+    const float* positions( unsigned int axis ) const;
+    const float* velocities( unsigned int axis ) const;
+    const float* accelerations( unsigned int axis ) const;
+    const float* masses() const;
+    const float* densities() const;
+    const float* volumes() const;
+    const float* pressures() const;
+    const quint64* cellIndices() const;
+
+    // Double precision copies of the positions and velocities, only allocated
+    // when enabled ( see SPH::setPrecision ). The setters write both, so the
+    // float streams are always the rounded double ones.
+    void setDoublePrecision( bool doublePrecision );
+    bool doublePrecision() const;
+    double* precisePositions( unsigned int axis );
+    double* preciseVelocities( unsigned int axis );
+    const double* precisePositions( unsigned int axis ) const;
+    const double* preciseVelocities( unsigned int axis ) const;
+
+    // Sleep state ( see SPH::setSleeping ) : consecutive steps below the
+    // thresholds, and the state of the particle. A sleeping particle can be
+    // woken by a neighbor during a step. Halo particles are copies of the
+    // particles of another process ( see SlabDecomposition ), never updated.
+    enum SleepState { SleepAwake, SleepAsleep, SleepWoken, SleepHalo };
+    unsigned int* stillSteps();
+    unsigned char* sleeping();
+    const unsigned int* stillSteps() const;
+    const unsigned char* sleeping() const;
+
+    // Identifier of the particle, its index when seeded. It follows the
+    // particle through the reorders and the migrations between processes.
+    unsigned int* identifiers();
+    const unsigned int* identifiers() const;
+
+    // Moves the attributes of particle 'order[i]' to particle 'i', for every 'i'.
+    // The particles missing from 'order' are removed.
+    void reorder( const QVector<unsigned int>& order );
+
     void render( const QMatrix4x4& transformation, GLShader& shader );
 
+    // Renders copies of the position and volume streams with the sphere of
+    // these particles, for instance copies made by another thread
+    void render( const QMatrix4x4& transformation, GLShader& shader, const float* const positions[3], const float* volumes, int nbParticles );
+
 private:
     void createOpenGLBuffers();
     void createVerticesNormals();
@@ -26,10 +112,25 @@ private:
     void createIndexBuffer( const QVector<unsigned int>& indices );
 
 private:
+    QVector<float> _positions[3];
+    QVector<float> _velocities[3];
+    QVector<float> _accelerations[3];
+    QVector<float> _masses;
+    QVector<float> _densities;
+    QVector<float> _volumes;
+    QVector<float> _pressures;
+    QVector<quint64> _cellIndices; // see Grid::Cell
+    QVector<unsigned int> _stillSteps;
+    QVector<unsigned char> _sleeping;
+    QVector<unsigned int> _identifiers;
+    bool _doublePrecision;
+    QVector<double> _precisePositions[3];
+    QVector<double> _preciseVelocities[3];
+
     QGLBuffer _vertexBuffer;
     QGLBuffer _normalBuffer;
     QGLBuffer _indexBuffer;
     unsigned int _nbIndices;
 };
 
-#endif // PARTICLESET_H
+#endif // PARTICLES_H
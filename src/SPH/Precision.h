@@ -0,0 +1,79 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include "SPH/Particles.h"
+
+/* Floating point types of the solver loops, as policies like the smoothing
+ * kernels ( see SmoothingKernels ). 'Storage' is the type of the positions and
+ * velocities that the neighbor sums read and that the integration updates, and
+ * 'Scalar' the type of the kernels and of the sums :
+ *   - SinglePrecision : floats only, the one of the vectorized sums.
+ *   - MixedPrecision : float storage with double sums.
+ *   - DoublePrecision : double sums over the double precision copies of the
+ *     positions and velocities ( see Particles::setDoublePrecision ).
+ *
+ * The other attributes ( densities, pressures, accelerations... ) and the
+ * scratch buffers of the iterative solvers are stored as floats in all modes.
+ */
+
+struct SinglePrecision
+{
+    typedef float Storage;
+    typedef float Scalar;
+    static const bool Vectorized = true;
+
+    static const Storage* positions( const Particles& particles, unsigned int axis );
+    static const Storage* velocities( const Particles& particles, unsigned int axis );
+};
+
+struct MixedPrecision
+{
+    typedef float Storage;
+    typedef double Scalar;
+    static const bool Vectorized = false;
+
+    static const Storage* positions( const Particles& particles, unsigned int axis );
+    static const Storage* velocities( const Particles& particles, unsigned int axis );
+};
+
+struct DoublePrecision
+{
+    typedef double Storage;
+    typedef double Scalar;
+    static const bool Vectorized = false;
+
+    static const Storage* positions( const Particles& particles, unsigned int axis );
+    static const Storage* velocities( const Particles& particles, unsigned int axis );
+};
+
+inline const float* SinglePrecision::positions( const Particles& particles, unsigned int axis )
+{
+    return particles.positions( axis );
+}
+
+inline const float* SinglePrecision::velocities( const Particles& particles, unsigned int axis )
+{
+    return particles.velocities( axis );
+}
+
+inline const float* MixedPrecision::positions( const Particles& particles, unsigned int axis )
+{
+    return particles.positions( axis );
+}
+
+inline const float* MixedPrecision::velocities( const Particles& particles, unsigned int axis )
+{
+    return particles.velocities( axis );
+}
+
+inline const double* DoublePrecision::positions( const Particles& particles, unsigned int axis )
+{
+    return particles.precisePositions( axis );
+}
+
+inline const double* DoublePrecision::velocities( const Particles& particles, unsigned int axis )
+{
+    return particles.preciseVelocities( axis );
+}
+
+#endif // PRECISION_H
@@ -0,0 +1,402 @@
+#include "SIMDKernels.h"
+#include <cmath>
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define SIMDKERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Scalar sums, also used for the tail of the vectorized ranges
+
+    void densitySumScalar( const SIMDKernels::Coefficients& coefficients, const SIMDKernels::Streams& streams, unsigned int particle,
+                           const unsigned int* candidates, int nbCandidates, float& density, float& correction )
+    {
+        const float* x = streams.positions[0];
+        const float* y = streams.positions[1];
+        const float* z = streams.positions[2];
+
+        for ( int k=0 ; k<nbCandidates ; ++k )
+        {
+            unsigned int n = candidates[k];
+            float dx = x[particle] - x[n];
+            float dy = y[particle] - y[n];
+            float dz = z[particle] - z[n];
+            float r2 = dx * dx + dy * dy + dz * dz;
+
+            if ( r2 < coefficients.smoothingRadius2 )
+            {
+                float diff = coefficients.smoothingRadius2 - r2;
+                float kernelMass = coefficients.poly6 * diff * diff * diff * streams.masses[n];
+                density += kernelMass;
+                correction += kernelMass / streams.densities[n];
+            }
+        }
+    }
+
+    void forceSumsScalar( const SIMDKernels::Coefficients& coefficients, const SIMDKernels::Streams& streams, unsigned int particle,
+                          const unsigned int* candidates, int nbCandidates, SIMDKernels::ForceSums& sums )
+    {
+        for ( int k=0 ; k<nbCandidates ; ++k )
+        {
+            unsigned int n = candidates[k];
+            float difference[3];
+
+            for ( unsigned int axis=0 ; axis<3 ; ++axis )
+                difference[axis] = streams.positions[axis][particle] - streams.positions[axis][n];
+
+            float r2 = difference[0] * difference[0] + difference[1] * difference[1] + difference[2] * difference[2];
+
+            if ( r2 < coefficients.smoothingRadius2 )
+            {
+                float r = ::sqrt( r2 );
+                float diff = coefficients.smoothingRadius - r;
+                float diff2 = coefficients.smoothingRadius2 - r2;
+                float volume = streams.volumes[n];
+                float meanPressure = ( streams.pressures[n] + streams.pressures[particle] ) * 0.5f;
+                float pressureKernel = ( r == 0 ) ? 0 : coefficients.spiky * diff * diff / r;
+                float pressureScale = pressureKernel * meanPressure * volume;
+                float viscosityScale = coefficients.viscosity * diff * volume;
+                float kernelRR = coefficients.poly6 * diff2 * diff2 * diff2;
+
+                for ( unsigned int axis=0 ; axis<3 ; ++axis )
+                {
+                    sums.pressure[axis] -= difference[axis] * pressureScale;
+                    sums.viscosity[axis] += ( streams.velocities[axis][n] - streams.velocities[axis][particle] ) * viscosityScale;
+                    sums.tension[axis] += difference[axis] * kernelRR;
+                }
+
+                sums.correction += kernelRR * volume;
+            }
+        }
+    }
+
+#ifdef SIMDKERNELS_X86
+
+    // SSE2 : 4 candidates at once, loaded one by one since there is no gather
+
+    __attribute__(( target( "sse2" ) ))
+    inline __m128 gatherSSE( const float* stream, const unsigned int* indices )
+    {
+        return _mm_set_ps( stream[indices[3]], stream[indices[2]], stream[indices[1]], stream[indices[0]] );
+    }
+
+    __attribute__(( target( "sse2" ) ))
+    inline float horizontalSumSSE( __m128 value )
+    {
+        __m128 sum = _mm_add_ps( value, _mm_movehl_ps( value, value ) );
+        sum = _mm_add_ss( sum, _mm_shuffle_ps( sum, sum, 1 ) );
+        return _mm_cvtss_f32( sum );
+    }
+
+    __attribute__(( target( "sse2" ) ))
+    void densitySumSSE( const SIMDKernels::Coefficients& coefficients, const SIMDKernels::Streams& streams, unsigned int particle,
+                        const unsigned int* candidates, int nbCandidates, float& density, float& correction )
+    {
+        const __m128 h2 = _mm_set1_ps( coefficients.smoothingRadius2 );
+        const __m128 poly6 = _mm_set1_ps( coefficients.poly6 );
+        const __m128 xi = _mm_set1_ps( streams.positions[0][particle] );
+        const __m128 yi = _mm_set1_ps( streams.positions[1][particle] );
+        const __m128 zi = _mm_set1_ps( streams.positions[2][particle] );
+        __m128 densitySum = _mm_setzero_ps();
+        __m128 correctionSum = _mm_setzero_ps();
+        int k = 0;
+
+        for ( ; k+4<=nbCandidates ; k+=4 )
+        {
+            const unsigned int* indices = candidates + k;
+            __m128 dx = _mm_sub_ps( xi, gatherSSE( streams.positions[0], indices ) );
+            __m128 dy = _mm_sub_ps( yi, gatherSSE( streams.positions[1], indices ) );
+            __m128 dz = _mm_sub_ps( zi, gatherSSE( streams.positions[2], indices ) );
+            __m128 r2 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) ), _mm_mul_ps( dz, dz ) );
+            __m128 inside = _mm_cmplt_ps( r2, h2 );
+            __m128 diff = _mm_sub_ps( h2, r2 );
+            __m128 kernel = _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( poly6, diff ), diff ), diff );
+            __m128 kernelMass = _mm_and_ps( inside, _mm_mul_ps( kernel, gatherSSE( streams.masses, indices ) ) );
+
+            densitySum = _mm_add_ps( densitySum, kernelMass );
+            correctionSum = _mm_add_ps( correctionSum, _mm_div_ps( kernelMass, gatherSSE( streams.densities, indices ) ) );
+        }
+
+        density += horizontalSumSSE( densitySum );
+        correction += horizontalSumSSE( correctionSum );
+        densitySumScalar( coefficients, streams, particle, candidates + k, nbCandidates - k, density, correction );
+    }
+
+    __attribute__(( target( "sse2" ) ))
+    void forceSumsSSE( const SIMDKernels::Coefficients& coefficients, const SIMDKernels::Streams& streams, unsigned int particle,
+                       const unsigned int* candidates, int nbCandidates, SIMDKernels::ForceSums& sums )
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 half = _mm_set1_ps( 0.5f );
+        const __m128 h = _mm_set1_ps( coefficients.smoothingRadius );
+        const __m128 h2 = _mm_set1_ps( coefficients.smoothingRadius2 );
+        const __m128 poly6 = _mm_set1_ps( coefficients.poly6 );
+        const __m128 spiky = _mm_set1_ps( coefficients.spiky );
+        const __m128 viscosity = _mm_set1_ps( coefficients.viscosity );
+        const __m128 pi = _mm_set1_ps( streams.pressures[particle] );
+        __m128 positionI[3];
+        __m128 velocityI[3];
+        __m128 pressureSum[3];
+        __m128 viscositySum[3];
+        __m128 tensionSum[3];
+        __m128 correctionSum = zero;
+
+        for ( unsigned int axis=0 ; axis<3 ; ++axis )
+        {
+            positionI[axis] = _mm_set1_ps( streams.positions[axis][particle] );
+            velocityI[axis] = _mm_set1_ps( streams.velocities[axis][particle] );
+            pressureSum[axis] = zero;
+            viscositySum[axis] = zero;
+            tensionSum[axis] = zero;
+        }
+
+        int k = 0;
+
+        for ( ; k+4<=nbCandidates ; k+=4 )
+        {
+            const unsigned int* indices = candidates + k;
+            __m128 difference[3];
+
+            for ( unsigned int axis=0 ; axis<3 ; ++axis )
+                difference[axis] = _mm_sub_ps( positionI[axis], gatherSSE( streams.positions[axis], indices ) );
+
+            __m128 r2 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( difference[0], difference[0] ), _mm_mul_ps( difference[1], difference[1] ) ),
+                                    _mm_mul_ps( difference[2], difference[2] ) );
+            __m128 inside = _mm_cmplt_ps( r2, h2 );
+            __m128 notSelf = _mm_cmpgt_ps( r2, zero );
+            __m128 r = _mm_sqrt_ps( r2 );
+            __m128 diff = _mm_sub_ps( h, r );
+            __m128 diff2 = _mm_sub_ps( h2, r2 );
+            __m128 volume = gatherSSE( streams.volumes, indices );
+            __m128 meanPressure = _mm_mul_ps( _mm_add_ps( gatherSSE( streams.pressures, indices ), pi ), half );
+
+            // The spiky term divides by 'r', so the particle itself is masked out
+            __m128 pressureKernel = _mm_div_ps( _mm_mul_ps( _mm_mul_ps( spiky, diff ), diff ), r );
+            __m128 pressureScale = _mm_and_ps( _mm_and_ps( inside, notSelf ),
+                                               _mm_mul_ps( _mm_mul_ps( pressureKernel, meanPressure ), volume ) );
+            __m128 viscosityScale = _mm_and_ps( inside, _mm_mul_ps( _mm_mul_ps( viscosity, diff ), volume ) );
+            __m128 kernelRR = _mm_and_ps( inside, _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( poly6, diff2 ), diff2 ), diff2 ) );
+
+            for ( unsigned int axis=0 ; axis<3 ; ++axis )
+            {
+                __m128 velocityDifference = _mm_sub_ps( gatherSSE( streams.velocities[axis], indices ), velocityI[axis] );
+                pressureSum[axis] = _mm_sub_ps( pressureSum[axis], _mm_mul_ps( difference[axis], pressureScale ) );
+                viscositySum[axis] = _mm_add_ps( viscositySum[axis], _mm_mul_ps( velocityDifference, viscosityScale ) );
+                tensionSum[axis] = _mm_add_ps( tensionSum[axis], _mm_mul_ps( difference[axis], kernelRR ) );
+            }
+
+            correctionSum = _mm_add_ps( correctionSum, _mm_mul_ps( kernelRR, volume ) );
+        }
+
+        for ( unsigned int axis=0 ; axis<3 ; ++axis )
+        {
+            sums.pressure[axis] += horizontalSumSSE( pressureSum[axis] );
+            sums.viscosity[axis] += horizontalSumSSE( viscositySum[axis] );
+            sums.tension[axis] += horizontalSumSSE( tensionSum[axis] );
+        }
+
+        sums.correction += horizontalSumSSE( correctionSum );
+        forceSumsScalar( coefficients, streams, particle, candidates + k, nbCandidates - k, sums );
+    }
+
+    // AVX2 : 8 candidates at once, loaded with gathers
+
+    __attribute__(( target( "avx2" ) ))
+    inline __m256 gatherAVX2( const float* stream, __m256i indices )
+    {
+        return _mm256_i32gather_ps( stream, indices, 4 );
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    inline float horizontalSumAVX2( __m256 value )
+    {
+        __m128 sum = _mm_add_ps( _mm256_castps256_ps128( value ), _mm256_extractf128_ps( value, 1 ) );
+        sum = _mm_add_ps( sum, _mm_movehl_ps( sum, sum ) );
+        sum = _mm_add_ss( sum, _mm_shuffle_ps( sum, sum, 1 ) );
+        return _mm_cvtss_f32( sum );
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    void densitySumAVX2( const SIMDKernels::Coefficients& coefficients, const SIMDKernels::Streams& streams, unsigned int particle,
+                         const unsigned int* candidates, int nbCandidates, float& density, float& correction )
+    {
+        const __m256 h2 = _mm256_set1_ps( coefficients.smoothingRadius2 );
+        const __m256 poly6 = _mm256_set1_ps( coefficients.poly6 );
+        const __m256 xi = _mm256_set1_ps( streams.positions[0][particle] );
+        const __m256 yi = _mm256_set1_ps( streams.positions[1][particle] );
+        const __m256 zi = _mm256_set1_ps( streams.positions[2][particle] );
+        __m256 densitySum = _mm256_setzero_ps();
+        __m256 correctionSum = _mm256_setzero_ps();
+        int k = 0;
+
+        for ( ; k+8<=nbCandidates ; k+=8 )
+        {
+            __m256i indices = _mm256_loadu_si256( (const __m256i*)( candidates + k ) );
+            __m256 dx = _mm256_sub_ps( xi, gatherAVX2( streams.positions[0], indices ) );
+            __m256 dy = _mm256_sub_ps( yi, gatherAVX2( streams.positions[1], indices ) );
+            __m256 dz = _mm256_sub_ps( zi, gatherAVX2( streams.positions[2], indices ) );
+            __m256 r2 = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( dx, dx ), _mm256_mul_ps( dy, dy ) ), _mm256_mul_ps( dz, dz ) );
+            __m256 inside = _mm256_cmp_ps( r2, h2, _CMP_LT_OQ );
+            __m256 diff = _mm256_sub_ps( h2, r2 );
+            __m256 kernel = _mm256_mul_ps( _mm256_mul_ps( _mm256_mul_ps( poly6, diff ), diff ), diff );
+            __m256 kernelMass = _mm256_and_ps( inside, _mm256_mul_ps( kernel, gatherAVX2( streams.masses, indices ) ) );
+
+            densitySum = _mm256_add_ps( densitySum, kernelMass );
+            correctionSum = _mm256_add_ps( correctionSum, _mm256_div_ps( kernelMass, gatherAVX2( streams.densities, indices ) ) );
+        }
+
+        density += horizontalSumAVX2( densitySum );
+        correction += horizontalSumAVX2( correctionSum );
+        densitySumScalar( coefficients, streams, particle, candidates + k, nbCandidates - k, density, correction );
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    void forceSumsAVX2( const SIMDKernels::Coefficients& coefficients, const SIMDKernels::Streams& streams, unsigned int particle,
+                        const unsigned int* candidates, int nbCandidates, SIMDKernels::ForceSums& sums )
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 half = _mm256_set1_ps( 0.5f );
+        const __m256 h = _mm256_set1_ps( coefficients.smoothingRadius );
+        const __m256 h2 = _mm256_set1_ps( coefficients.smoothingRadius2 );
+        const __m256 poly6 = _mm256_set1_ps( coefficients.poly6 );
+        const __m256 spiky = _mm256_set1_ps( coefficients.spiky );
+        const __m256 viscosity = _mm256_set1_ps( coefficients.viscosity );
+        const __m256 pi = _mm256_set1_ps( streams.pressures[particle] );
+        __m256 positionI[3];
+        __m256 velocityI[3];
+        __m256 pressureSum[3];
+        __m256 viscositySum[3];
+        __m256 tensionSum[3];
+        __m256 correctionSum = zero;
+
+        for ( unsigned int axis=0 ; axis<3 ; ++axis )
+        {
+            positionI[axis] = _mm256_set1_ps( streams.positions[axis][particle] );
+            velocityI[axis] = _mm256_set1_ps( streams.velocities[axis][particle] );
+            pressureSum[axis] = zero;
+            viscositySum[axis] = zero;
+            tensionSum[axis] = zero;
+        }
+
+        int k = 0;
+
+        for ( ; k+8<=nbCandidates ; k+=8 )
+        {
+            __m256i indices = _mm256_loadu_si256( (const __m256i*)( candidates + k ) );
+            __m256 difference[3];
+
+            for ( unsigned int axis=0 ; axis<3 ; ++axis )
+                difference[axis] = _mm256_sub_ps( positionI[axis], gatherAVX2( streams.positions[axis], indices ) );
+
+            __m256 r2 = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( difference[0], difference[0] ), _mm256_mul_ps( difference[1], difference[1] ) ),
+                                       _mm256_mul_ps( difference[2], difference[2] ) );
+            __m256 inside = _mm256_cmp_ps( r2, h2, _CMP_LT_OQ );
+            __m256 notSelf = _mm256_cmp_ps( r2, zero, _CMP_GT_OQ );
+            __m256 r = _mm256_sqrt_ps( r2 );
+            __m256 diff = _mm256_sub_ps( h, r );
+            __m256 diff2 = _mm256_sub_ps( h2, r2 );
+            __m256 volume = gatherAVX2( streams.volumes, indices );
+            __m256 meanPressure = _mm256_mul_ps( _mm256_add_ps( gatherAVX2( streams.pressures, indices ), pi ), half );
+
+            // The spiky term divides by 'r', so the particle itself is masked out
+            __m256 pressureKernel = _mm256_div_ps( _mm256_mul_ps( _mm256_mul_ps( spiky, diff ), diff ), r );
+            __m256 pressureScale = _mm256_and_ps( _mm256_and_ps( inside, notSelf ),
+                                                  _mm256_mul_ps( _mm256_mul_ps( pressureKernel, meanPressure ), volume ) );
+            __m256 viscosityScale = _mm256_and_ps( inside, _mm256_mul_ps( _mm256_mul_ps( viscosity, diff ), volume ) );
+            __m256 kernelRR = _mm256_and_ps( inside, _mm256_mul_ps( _mm256_mul_ps( _mm256_mul_ps( poly6, diff2 ), diff2 ), diff2 ) );
+
+            for ( unsigned int axis=0 ; axis<3 ; ++axis )
+            {
+                __m256 velocityDifference = _mm256_sub_ps( gatherAVX2( streams.velocities[axis], indices ), velocityI[axis] );
+                pressureSum[axis] = _mm256_sub_ps( pressureSum[axis], _mm256_mul_ps( difference[axis], pressureScale ) );
+                viscositySum[axis] = _mm256_add_ps( viscositySum[axis], _mm256_mul_ps( velocityDifference, viscosityScale ) );
+                tensionSum[axis] = _mm256_add_ps( tensionSum[axis], _mm256_mul_ps( difference[axis], kernelRR ) );
+            }
+
+            correctionSum = _mm256_add_ps( correctionSum, _mm256_mul_ps( kernelRR, volume ) );
+        }
+
+        for ( unsigned int axis=0 ; axis<3 ; ++axis )
+        {
+            sums.pressure[axis] += horizontalSumAVX2( pressureSum[axis] );
+            sums.viscosity[axis] += horizontalSumAVX2( viscositySum[axis] );
+            sums.tension[axis] += horizontalSumAVX2( tensionSum[axis] );
+        }
+
+        sums.correction += horizontalSumAVX2( correctionSum );
+        forceSumsScalar( coefficients, streams, particle, candidates + k, nbCandidates - k, sums );
+    }
+
+#endif // SIMDKERNELS_X86
+}
+
+SIMDKernels::SIMDKernels()
+{
+    setInstructionSet( bestInstructionSet() );
+}
+
+SIMDKernels::InstructionSet SIMDKernels::bestInstructionSet()
+{
+#ifdef SIMDKERNELS_X86
+    __builtin_cpu_init();
+
+    if ( __builtin_cpu_supports( "avx2" ) )
+        return InstructionSetAVX2;
+
+    if ( __builtin_cpu_supports( "sse2" ) )
+        return InstructionSetSSE;
+#endif
+
+    return InstructionSetScalar;
+}
+
+const char* SIMDKernels::instructionSetName( InstructionSet instructionSet )
+{
+    switch ( instructionSet )
+    {
+        case InstructionSetScalar : return "scalar";
+        case InstructionSetSSE : return "sse";
+        case InstructionSetAVX2 : return "avx2";
+    }
+
+    return "unknown";
+}
+
+SIMDKernels::InstructionSet SIMDKernels::instructionSet() const
+{
+    return _instructionSet;
+}
+
+void SIMDKernels::setInstructionSet( InstructionSet instructionSet )
+{
+    // Never go above what the CPU supports
+    if ( instructionSet > bestInstructionSet() )
+        instructionSet = bestInstructionSet();
+
+    _instructionSet = instructionSet;
+    _densitySum = densitySumScalar;
+    _forceSums = forceSumsScalar;
+
+#ifdef SIMDKERNELS_X86
+    switch ( instructionSet )
+    {
+        case InstructionSetScalar : break;
+        case InstructionSetSSE : _densitySum = densitySumSSE; _forceSums = forceSumsSSE; break;
+        case InstructionSetAVX2 : _densitySum = densitySumAVX2; _forceSums = forceSumsAVX2; break;
+    }
+#endif
+}
+
+void SIMDKernels::densitySum( const Coefficients& coefficients, const Streams& streams, unsigned int particle,
+                              const ParticleRange& candidates, float& density, float& correction ) const
+{
+    _densitySum( coefficients, streams, particle, candidates.begin(), candidates.size(), density, correction );
+}
+
+void SIMDKernels::forceSums( const Coefficients& coefficients, const Streams& streams, unsigned int particle,
+                             const ParticleRange& candidates, ForceSums& sums ) const
+{
+    _forceSums( coefficients, streams, particle, candidates.begin(), candidates.size(), sums );
+}
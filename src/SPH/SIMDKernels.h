@@ -0,0 +1,76 @@
+#ifndef SIMDKERNELS_H
+#define SIMDKERNELS_H
+
+#include "SPH/ParticleRange.h"
+
+/* Vectorized versions of the density and force sums of the SPH solver. The
+ * sums work on a contiguous range of candidate neighbors and process 4 ( SSE )
+ * or 8 ( AVX2 ) candidates at once. Candidates outside the smoothing radius are
+ * masked out instead of branched on.
+ *
+ * The instruction set is picked at runtime from the CPU features. The AVX2 and
+ * SSE paths are compiled with function level target attributes, so the rest of
+ * the program does not need to be built for these instruction sets. On other
+ * compilers or CPUs only the scalar path is available.
+ */
+
+class SIMDKernels
+{
+public:
+    enum InstructionSet { InstructionSetScalar, InstructionSetSSE, InstructionSetAVX2 };
+
+    // Particle streams read by the sums
+    struct Streams
+    {
+        const float* positions[3];
+        const float* velocities[3];
+        const float* masses;
+        const float* densities;
+        const float* volumes;
+        const float* pressures;
+    };
+
+    // Poly6, spiky and viscosity kernel coefficients ( see Poly6SpikyKernel )
+    struct Coefficients
+    {
+        float smoothingRadius;
+        float smoothingRadius2;
+        float poly6;
+        float spiky;
+        float viscosity;
+    };
+
+    // Unnormalized force sums of a particle ( see SPH::computeForces )
+    struct ForceSums
+    {
+        float pressure[3];
+        float viscosity[3];
+        float tension[3];
+        float correction;
+    };
+
+    typedef void (*DensityFunction)( const Coefficients& coefficients, const Streams& streams, unsigned int particle,
+                                     const unsigned int* candidates, int nbCandidates, float& density, float& correction );
+    typedef void (*ForceFunction)( const Coefficients& coefficients, const Streams& streams, unsigned int particle,
+                                   const unsigned int* candidates, int nbCandidates, ForceSums& sums );
+
+    SIMDKernels();
+
+    static InstructionSet bestInstructionSet();
+    static const char* instructionSetName( InstructionSet instructionSet );
+
+    InstructionSet instructionSet() const;
+    void setInstructionSet( InstructionSet instructionSet );
+
+    void densitySum( const Coefficients& coefficients, const Streams& streams, unsigned int particle,
+                     const ParticleRange& candidates, float& density, float& correction ) const;
+    void forceSums( const Coefficients& coefficients, const Streams& streams, unsigned int particle,
+                    const ParticleRange& candidates, ForceSums& sums ) const;
+
+private:
+    InstructionSet _instructionSet;
+    DensityFunction _densitySum;
+    ForceFunction _forceSums;
+};
+
+#endif // SIMDKERNELS_H
@@ -1,5 +1,35 @@
 #include "SPH.h"
+#include <QElapsedTimer>
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <limits>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace
+{
+    // Whether the 'count' values are finite, and above 0 or not below it
+    bool isValid( const float* values, int count, bool positive )
+    {
+        for ( int i=0 ; i<count ; ++i )
+            if ( !std::isfinite( values[i] ) || values[i] < 0 || ( positive && values[i] == 0 ) )
+                return false;
+
+        return true;
+    }
+
+    bool isFinite( const float* values, int count )
+    {
+        for ( int i=0 ; i<count ; ++i )
+            if ( !std::isfinite( values[i] ) )
+                return false;
+
+        return true;
+    }
+}
 
 SPH::SPH( AbstractObject* parent, const Geometry& container, float smoothingRadius, float viscosity, float pressure, float surfaceTension,
           unsigned int nbCellX, unsigned int nbCellY, unsigned int nbCellZ, unsigned int nbCubeX,
@@ -7,10 +37,8 @@ SPH::SPH( AbstractObject* parent, const Geometry& container, float smoothingRadi
           float totalVolume, float maxDTime, const QVector3D& gravity )
     : AbstractObject( parent )
     , _container( container )
-    , _coeffPoly6( 0 )
-    , _coeffSpiky( 0 )
-    , _coeffVisc( 0 )
     , _restDensity( restDensity )
+    , _totalVolume( totalVolume )
     , _smoothingRadius( smoothingRadius )
     , _smoothingRadius2( smoothingRadius * smoothingRadius )
     , _viscosity( viscosity )
@@ -19,36 +47,112 @@ SPH::SPH( AbstractObject* parent, const Geometry& container, float smoothingRadi
     , _maxDeltaTime( maxDTime )
     , _gravity( gravity )
     , _particles( nbParticles )
+    , _seedingMode( ParticleSeeder::SeedingRandom )
+    , _seed( 0 )
     , _grid( inflatedContainerBoundingBox(), nbCellX, nbCellY, nbCellZ, smoothingRadius )
+    , _reorderInterval( 0 )
+    , _stepsSinceReorder( 0 )
+    , _decomposition( 0 )
+    , _sleepSteps( 0 )
+    , _sleepVelocity( 0 )
+    , _sleepAcceleration( 0 )
     , _marchingTetrahedra( inflatedContainerBoundingBox(), nbCubeX, nbCubeY, nbCubeZ )
+    , _neighborSkin( 0 )
+    , _kernel( KernelPoly6Spiky )
+    , _precision( PrecisionSingle )
+    , _symmetricForces( false )
+    , _containerCollision( CollisionSignedDistance )
+    , _solver( SolverEquationOfState )
+    , _pressureTolerance( 0.01 )
+    , _maxPressureIterations( 50 )
+    , _lastPressureIterations( 0 )
+    , _lastDivergenceIterations( 0 )
+    , _lastDensityError( 0 )
+    , _adaptiveTimeStep( false )
+    , _courantFactor( 0.4 )
+    , _maxFrameTime( 1.0 / 30.0 )
+    , _maxSubsteps( 16 )
+    , _lastSubstepCount( 0 )
+    , _lastTimeStep( 0 )
     , _renderMode( RenderParticles )
     , _material( QColor( 0, 125, 200, 255 ) )
+    , _renderFrames( 0 )
+    , _renderedFrame( 0 )
+    , _replayFrame( 0 )
 {
-    initializeCoefficients();
-    initializeParticles( totalVolume );
+    resetStepStatistics();
+    initializeParticles();
 }
 
 SPH::~SPH()
 {
+    delete _renderFrames;
+    delete _replayFrame;
 }
 
 void SPH::animate( const TimeState& timeState )
 {
     float deltaTime = timeState.deltaTime();
 
-    // Clamp 'dt' to avoid instabilities
-    if ( deltaTime > _maxDeltaTime )
-        deltaTime = _maxDeltaTime;
+    if ( !_adaptiveTimeStep )
+    {
+        // Clamp 'dt' to avoid instabilities
+        if ( deltaTime > _maxDeltaTime )
+            deltaTime = _maxDeltaTime;
+
+        step( deltaTime );
+        return;
+    }
+
+    // Simulate the elapsed time with substeps, but do not try to catch up
+    // with arbitrarily slow frames
+    advance( std::min( deltaTime, _maxFrameTime ) );
+}
+
+void SPH::step( float deltaTime )
+{
+    resetStepStatistics();
+    simulateSubstep( deltaTime, false );
+
+    _lastSubstepCount = 1;
+}
+
+float SPH::advance( float frameTime )
+{
+    float simulatedTime = 0;
+
+    resetStepStatistics();
+    _lastSubstepCount = 0;
+
+    while ( simulatedTime < frameTime && _lastSubstepCount < _maxSubsteps )
+    {
+        simulatedTime += simulateSubstep( frameTime - simulatedTime, true );
+        ++_lastSubstepCount;
+    }
 
-    computeDensities();
-    computeForces();
-    moveParticles( deltaTime );
+    return simulatedTime;
 }
 
 void SPH::render( GLShader& shader )
 {
     shader.setMaterial( _material );
 
+    if ( _replayFrame )
+    {
+        // The recording follows the container
+        _replayFrame->transformation = globalTransformation();
+        renderFrame( *_replayFrame, shader );
+        return;
+    }
+
+    if ( _renderFrames )
+    {
+        // The latest frame of the simulation thread, or the previous one again
+        _renderFrames->acquire();
+        renderFrame( _renderFrames->readFrame(), shader );
+        return;
+    }
+
     switch( _renderMode )
     {
         case RenderParticles : _particles.render( globalTransformation(), shader ); break;
@@ -56,6 +160,27 @@ void SPH::render( GLShader& shader )
     }
 }
 
+void SPH::renderFrame( const RenderFrame& frame, GLShader& shader )
+{
+    switch( _renderMode )
+    {
+        case RenderParticles :
+        {
+            const float* positions[3] = { frame.positions[0].constData(), frame.positions[1].constData(), frame.positions[2].constData() };
+            _particles.render( frame.transformation, shader, positions, frame.volumes.constData(), frame.volumes.size() );
+            break;
+        }
+        case RenderImplicitSurface :
+        {
+            // 'surfaceInfo' samples the frame instead of the particles
+            _renderedFrame = &frame;
+            _marchingTetrahedra.render( frame.transformation, shader, *this );
+            _renderedFrame = 0;
+            break;
+        }
+    }
+}
+
 void SPH::changeRenderMode()
 {
     if ( _renderMode == RenderParticles )
@@ -69,255 +194,2246 @@ void SPH::changeMaterial()
     _material = Material( QColor( 0, 0, 255, 255 ) );
 }
 
-void SPH::resetVelocities()
+void SPH::setSeeding( ParticleSeeder::Mode seedingMode, quint64 seed )
 {
-    for ( int i=0 ; i<_particles.size() ; ++i )
-        _particles[i].setVelocity( QVector3D() );
+    _seedingMode = seedingMode;
+    _seed = seed;
+
+    // Drop the state of the previous placement
+    resetVelocities();
+    _densityStiffness.clear();
+    _divergenceStiffness.clear();
+    initializeParticles();
 }
 
-BoundingBox SPH::inflatedContainerBoundingBox() const
+ParticleSeeder::Mode SPH::seedingMode() const
 {
-    BoundingBox boundingBox = _container.boundingBox();
-    QVector3D center = ( boundingBox.minimum() + boundingBox.maximum() ) * 0.5;
+    return _seedingMode;
+}
 
-    return BoundingBox( ( boundingBox.minimum() - center ) * 1.2 + center,
-                        ( boundingBox.maximum() - center ) * 1.2 + center );
+void SPH::setGridStorageMode( Grid::StorageMode storageMode )
+{
+    // The hashed storage keys the cells by their coordinates
+    _grid.setStorageMode( storageMode );
+    updateCellIndices();
+    fillGrid();
+}
+
+void SPH::setGridNeighborhoodMode( Grid::NeighborhoodMode neighborhoodMode )
+{
+    _grid.setNeighborhoodMode( neighborhoodMode );
+}
+
+void SPH::setReorderInterval( unsigned int nbSteps )
+{
+    // Sort at the next step, then every 'nbSteps'
+    _reorderInterval = nbSteps;
+    _stepsSinceReorder = nbSteps;
+}
+
+unsigned int SPH::reorderInterval() const
+{
+    return _reorderInterval;
+}
+
+void SPH::reorderParticles()
+{
+    _stepsSinceReorder = 0;
+
+    // Non empty cells along the Z-order curve
+    std::vector<std::pair<quint64, Grid::Cell> > cells;
+
+    for ( int c=0 ; c<_grid.nbOccupiedCells() ; ++c )
+    {
+        Grid::Cell cell = _grid.occupiedCell( c );
+
+        if ( _grid.cellParticles( cell ).size() > 0 )
+            cells.push_back( std::make_pair( _grid.mortonCode( cell ), cell ) );
+    }
+
+    std::sort( cells.begin(), cells.end() );
+
+    // The particles of each cell keep their relative order
+    QVector<unsigned int> order;
+    order.reserve( _particles.size() );
+
+    for ( unsigned int c=0 ; c<cells.size() ; ++c )
+    {
+        ParticleRange range = _grid.cellParticles( cells[c].second );
+
+        for ( const unsigned int* i=range.begin() ; i!=range.end() ; ++i )
+            order.append( *i );
+    }
+
+    _particles.reorder( order );
+
+    // The stiffness of the previous step warm-starts DFSPH
+    QVector<float> buffer( _particles.size() );
+    QVector<float>* stiffnesses[2] = { &_densityStiffness, &_divergenceStiffness };
+
+    for ( unsigned int s=0 ; s<2 ; ++s )
+        if ( stiffnesses[s]->size() == _particles.size() )
+        {
+            for ( int i=0 ; i<_particles.size() ; ++i )
+                buffer[i] = ( *stiffnesses[s] )[order[i]];
+
+            stiffnesses[s]->swap( buffer );
+        }
+
+    fillGrid();
+}
+
+void SPH::setSleeping( unsigned int nbSteps, float velocity, float acceleration )
+{
+    _sleepSteps = nbSteps;
+    _sleepVelocity = velocity;
+    _sleepAcceleration = acceleration;
+    _sleepTransformation = localTransformation();
+    wakeParticles();
 }
 
-void SPH::initializeCoefficients()
+unsigned int SPH::sleepSteps() const
 {
-	// H^n
-    float h6 = _smoothingRadius2 * _smoothingRadius2 * _smoothingRadius2;
-    float h9 = h6 * _smoothingRadius2 * _smoothingRadius;
+    return _sleepSteps;
+}
 
-	// Poly6
-    _coeffPoly6 = 315.0 / ( 64.0 * M_PI * h9 );
+unsigned int SPH::nbSleepingParticles() const
+{
+    const unsigned char* sleeping = _particles.sleeping();
+    int nbSleeping = 0;
 
-	// Spiky
-    _coeffSpiky = 3.0 * 15.0 / ( M_PI * h6 );
+    #pragma omp parallel for schedule( static ) reduction( + : nbSleeping )
+    for ( int i=0 ; i<_particles.size() ; ++i )
+        nbSleeping += ( sleeping[i] == Particles::SleepAsleep );
 
-	// Visc
-    _coeffVisc = 45.0 / ( M_PI * h6 );
+    return nbSleeping;
 }
 
-void SPH::initializeParticles( float totalVolume )
+void SPH::wakeParticles()
 {
-    float totalMass = totalVolume * _restDensity;
-    float mass = totalMass / _particles.size();
+    unsigned int* stillSteps = _particles.stillSteps();
+    unsigned char* sleeping = _particles.sleeping();
 
-    // set particle position and mass
+    // The halo is never updated
+    #pragma omp parallel for schedule( static )
     for ( int i=0 ; i<_particles.size() ; ++i )
-	{
-        _particles[i].setMass( mass );
-        _particles[i].setDensity( _restDensity );
-        _particles[i].setVolume( mass / _restDensity );
-        _particles[i].setPosition( _container.randomInteriorPoint() );
-        _particles[i].setCellIndex( _grid.cellIndex( _particles[i].position() ) );
+    {
+        stillSteps[i] = 0;
 
-        _grid.addParticle( _particles[i].cellIndex(), i );
+        if ( sleeping[i] != Particles::SleepHalo )
+            sleeping[i] = Particles::SleepAwake;
     }
 }
 
-float SPH::densityKernel( float r2 ) const
+bool SPH::setDecomposition( SlabDecomposition* decomposition )
 {
-    float diff = _smoothingRadius2 - r2;
+    if ( decomposition && _solver != SolverEquationOfState )
+        return false;
+
+    _decomposition = decomposition;
+
+    // Start from the particles of the whole domain again
+    initializeParticles();
+    return true;
+}
 
-    return _coeffPoly6 * diff * diff * diff;
+SlabDecomposition* SPH::decomposition() const
+{
+    return _decomposition;
 }
 
-float SPH::densitykernelGradient( float r2 ) const
+void SPH::setNeighborSkin( float skin )
 {
-    float diff = _smoothingRadius2 - r2;
+    // Only the list build reaches further, the other searches keep 'h'
+    _neighborSkin = skin;
+    _grid.setExtendedRadius( _smoothingRadius + std::max( skin, 0.0f ) );
+    _neighborList.clear();
+}
 
-    return -3 * _coeffPoly6 * diff * diff;
+float SPH::neighborSkin() const
+{
+    return _neighborSkin;
 }
 
-float SPH::pressureKernel( float r ) const
+const NeighborList::Statistics& SPH::neighborListStatistics() const
 {
-    if ( r == 0 )
-		return 0;
+    return _neighborList.statistics();
+}
 
-    float diff = _smoothingRadius - r;
+void SPH::setInstructionSet( SIMDKernels::InstructionSet instructionSet )
+{
+    _simdKernels.setInstructionSet( instructionSet );
+}
 
-    return _coeffSpiky * diff * diff / r;
+SIMDKernels::InstructionSet SPH::instructionSet() const
+{
+    return _simdKernels.instructionSet();
 }
 
-float SPH::viscosityKernel( float r ) const
+void SPH::setKernel( Kernel kernel )
 {
-    return _coeffVisc * ( _smoothingRadius - r );
+    _kernel = kernel;
 }
 
-float SPH::pressure( float density ) const
+SPH::Kernel SPH::kernel() const
 {
-    return density / _restDensity - 1;
+    return _kernel;
 }
 
-void SPH::computeDensities()
+const char* SPH::kernelName( Kernel kernel )
 {
-    // For each particle
-    #pragma omp parallel for schedule( guided )
-    for ( int i=0 ; i<_particles.size() ; ++i )
-	{
-        float density = 0;
-        float correction = 0;
-        Particle& particle = _particles[i];
-        const QVector<unsigned int>& neighborhood = _grid.neighborhood( particle.cellIndex() );
+    switch ( kernel )
+    {
+        case KernelPoly6Spiky : return "poly6";
+        case KernelCubicSpline : return "cubic";
+        case KernelWendlandC2 : return "wendland";
+    }
 
-		// For each neighbor cell
-        for ( int j=0 ; j<neighborhood.size() ; ++j )
-		{
-            const QVector<unsigned int>& neighbors = _grid.cellParticles( neighborhood[j] );
+    return "";
+}
 
-			// For each particle in a neighboring cell
-            for ( int k=0 ; k<neighbors.size() ; ++k )
-			{
-                const Particle& neighbor = _particles[neighbors[k]];
-                QVector3D difference = particle.position() - neighbor.position();
-                float r2 = difference.lengthSquared();
+void SPH::setPrecision( Precision precision )
+{
+    _precision = precision;
+    _particles.setDoublePrecision( precision == PrecisionDouble );
+}
 
-				// If the neighboring particle is inside a sphere of radius 'h'
-                if ( r2 < _smoothingRadius2 )
-				{
-					// Add density contribution
-                    float kernelMass = densityKernel( r2 ) * neighbor.mass();
-                    density += kernelMass;
-                    correction += kernelMass / neighbor.density();
-				}
-			}
-		}
+SPH::Precision SPH::precision() const
+{
+    return _precision;
+}
 
-        particle.setDensity( density / correction );
-        particle.setVolume( particle.mass() / particle.density() );
-        particle.setPressure( pressure( density ) );
+const char* SPH::precisionName( Precision precision )
+{
+    switch ( precision )
+    {
+        case PrecisionSingle : return "single";
+        case PrecisionMixed : return "mixed";
+        case PrecisionDouble : return "double";
     }
+
+    return "";
 }
 
-void SPH::computeForces()
+bool SPH::setSolver( Solver solver )
 {
-	// Compute gravity vector
-    QVector3D gravity = localTransformation().inverted().mapVector( _gravity );
+    if ( _decomposition && solver != SolverEquationOfState )
+        return false;
 
-    // For each particle
-    #pragma omp parallel for schedule( guided )
-    for ( int i=0 ; i<_particles.size() ; ++i )
-	{
-        QVector3D pressureForce;
-        QVector3D viscosityForce;
-        QVector3D tensionForce;
-        float correction = 0;
+    _solver = solver;
+    return true;
+}
 
-        Particle& particle = _particles[i];
-        const QVector<unsigned int>& neighborhood = _grid.neighborhood( particle.cellIndex() );
+void SPH::setPressureTolerance( float tolerance )
+{
+    _pressureTolerance = tolerance;
+}
 
-		// For each neighbor cell
-        for ( int j=0 ; j<neighborhood.size() ; ++j )
-		{
-            const QVector<unsigned int>& neighbors = _grid.cellParticles( neighborhood[j] );
+void SPH::setMaxPressureIterations( unsigned int maxIterations )
+{
+    _maxPressureIterations = maxIterations;
+}
 
-			// For each particle in a neighboring cell
-            for ( int k=0 ; k<neighbors.size() ; ++k )
-			{
-                const Particle& neighbor = _particles[neighbors[k]];
-                QVector3D difference = particle.position() - neighbor.position();
-                float r2 = difference.lengthSquared();
+SPH::Solver SPH::solver() const
+{
+    return _solver;
+}
 
-				// If the neighboring particle is inside a sphere of radius 'h'
-                if ( r2 < _smoothingRadius2 )
-				{
-                    float r = ::sqrt( r2 );
-                    float volume = neighbor.volume();
-                    float meanPressure = ( neighbor.pressure() + particle.pressure() ) * 0.5;
+const char* SPH::solverName( Solver solver )
+{
+    switch ( solver )
+    {
+        case SolverEquationOfState : return "eos";
+        case SolverPCISPH : return "pcisph";
+        case SolverDFSPH : return "dfsph";
+    }
 
-					// Add forces contribution
-                    pressureForce -= difference * ( pressureKernel( r ) * meanPressure * volume );
-                    viscosityForce += ( neighbor.velocity() - particle.velocity() ) * ( viscosityKernel( r ) * volume );
+    return "";
+}
 
-                    float kernelRR = densityKernel( r2 );
-                    tensionForce += difference * kernelRR; // * Mass_b / Mass_a, but in our case, this equals 1
-                    correction += kernelRR * volume;
-				}
-			}
-		}
+unsigned int SPH::lastPressureIterations() const
+{
+    return _lastPressureIterations;
+}
 
-		// Normalize results and apply uniform coefficients;
-        pressureForce *= _pressure / correction;
-        viscosityForce *= _viscosity / correction;
-        tensionForce *= _surfaceTension / correction;
+unsigned int SPH::lastDivergenceIterations() const
+{
+    return _lastDivergenceIterations;
+}
 
-        // Compute the sum of all forces and convert it to an acceleration
-        particle.setAcceleration( ( viscosityForce - pressureForce - tensionForce ) / particle.density() + gravity );
-    }
+float SPH::lastDensityError() const
+{
+    return _lastDensityError;
 }
 
-void SPH::moveParticles(float deltaTime) {
-    const float epsilon = 2e-3f; // XXX
+void SPH::setAdaptiveTimeStep( bool adaptiveTimeStep )
+{
+    _adaptiveTimeStep = adaptiveTimeStep;
+}
 
-    // Mettre à jour la vitesse et la position de chaque particule à l'aide de la méthode d'intégration
-    // semi-explicite d'Euler, en traitant correctement les intersections avec la paroi (_container).
+void SPH::setCourantFactor( float courantFactor )
+{
+    _courantFactor = courantFactor;
+}
 
-    #pragma omp parallel for schedule(guided)
-    for (int i = 0; i < _particles.size(); ++i) {
-        QVector3D currPos = _particles[i].position();
-        QVector3D nextVel = _particles[i].velocity() + deltaTime * _particles[i].acceleration();
-        QVector3D nextPos = currPos + deltaTime * nextVel;
+void SPH::setMaxFrameTime( float maxFrameTime )
+{
+    _maxFrameTime = maxFrameTime;
+}
 
-        QVector3D remMove = nextPos - currPos;
-        QVector3D dirMove = remMove.normalized();
+void SPH::setMaxSubsteps( unsigned int maxSubsteps )
+{
+    _maxSubsteps = std::max( maxSubsteps, 1u );
+}
 
-        Intersection inter;
-        while (_container.intersect(Ray(currPos, dirMove), inter) &&
-               remMove.length() > (inter.rayParameterT() * dirMove).length()) {
-            remMove = nextPos - inter.position();
+bool SPH::adaptiveTimeStep() const
+{
+    return _adaptiveTimeStep;
+}
 
-            currPos = inter.position() - epsilon * inter.normal();
-            nextVel -= QVector3D::dotProduct(nextVel, inter.normal()) * inter.normal();
-            nextPos -= (QVector3D::dotProduct(remMove, inter.normal()) + epsilon) * inter.normal();
+unsigned int SPH::lastSubstepCount() const
+{
+    return _lastSubstepCount;
+}
 
-            dirMove = (nextPos - currPos).normalized();
-        }
+float SPH::lastTimeStep() const
+{
+    return _lastTimeStep;
+}
+
+const SPH::StepTimings& SPH::lastStepTimings() const
+{
+    return _lastStepTimings;
+}
+
+void SPH::computeSurfaceValues()
+{
+    _marchingTetrahedra.computeVertexInfo( *this );
+}
+
+void SPH::setSymmetricForces( bool symmetricForces )
+{
+    _symmetricForces = symmetricForces;
+    _forceSums.clear();
+    _preciseForceSums.clear();
+    _coloredCells.clear();
+    _colorStart.clear();
+}
+
+bool SPH::symmetricForces() const
+{
+    return _symmetricForces;
+}
+
+void SPH::setContainerCollision( ContainerCollision containerCollision )
+{
+    _containerCollision = containerCollision;
+}
 
-        _particles[i].setVelocity(nextVel);
-        _particles[i].setPosition(nextPos);
+SPH::ContainerCollision SPH::containerCollision() const
+{
+    return _containerCollision;
+}
+
+void SPH::resetVelocities()
+{
+    for ( int i=0 ; i<_particles.size() ; ++i )
+        _particles.setVelocity( i, QVector3D() );
+}
+
+const Particles& SPH::particles() const
+{
+    return _particles;
+}
+
+bool SPH::saveSnapshot( const QString& fileName ) const
+{
+    if ( _decomposition )
+        return false;
+
+    Snapshot::Parameters parameters;
+    std::memset( &parameters, 0, sizeof( parameters ) );
+
+    parameters.smoothingRadius = _smoothingRadius;
+    parameters.nbCells = _grid.nbCells();
+
+    BoundingBox gridBoundingBox = inflatedContainerBoundingBox();
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        parameters.gridMinimum[axis] = gridBoundingBox.minimum()[axis];
+        parameters.gridMaximum[axis] = gridBoundingBox.maximum()[axis];
     }
 
-    // Vérifiez si la particule a changé de cellule de la grille régulière (classe Grid). Si c'est le cas
-    // changez-la de cellule (méthodes 'removeParticle' et 'addParticle' avant de mettre à jour son index).
+    parameters.restDensity = _restDensity;
+    parameters.totalVolume = _totalVolume;
+    parameters.viscosity = _viscosity;
+    parameters.pressure = _pressure;
+    parameters.surfaceTension = _surfaceTension;
+    parameters.maxDeltaTime = _maxDeltaTime;
 
-    for (int i = 0; i < _particles.size(); ++i) {
-        unsigned int currCell = _particles[i].cellIndex();
-        unsigned int nextCell = _grid.cellIndex(_particles[i].position());
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+        parameters.gravity[axis] = _gravity[axis];
+
+    parameters.kernel = _kernel;
+    parameters.precision = _precision;
+    parameters.solver = _solver;
+    parameters.containerCollision = _containerCollision;
+    parameters.seedingMode = _seedingMode;
+    parameters.seed = _seed;
+    parameters.pressureTolerance = _pressureTolerance;
+    parameters.maxPressureIterations = _maxPressureIterations;
+    parameters.sleepSteps = _sleepSteps;
+    parameters.sleepVelocity = _sleepVelocity;
+    parameters.sleepAcceleration = _sleepAcceleration;
+    parameters.neighborSkin = _neighborSkin;
+    parameters.symmetricForces = _symmetricForces;
+    parameters.reorderInterval = _reorderInterval;
+    parameters.stepsSinceReorder = _stepsSinceReorder;
+    parameters.adaptiveTimeStep = _adaptiveTimeStep;
+    parameters.courantFactor = _courantFactor;
+    parameters.maxFrameTime = _maxFrameTime;
+    parameters.maxSubsteps = _maxSubsteps;
+    parameters.lastTimeStep = _lastTimeStep;
+    std::copy( localTransformation().constData(), localTransformation().constData() + 16, parameters.transformation );
+    std::copy( _sleepTransformation.constData(), _sleepTransformation.constData() + 16, parameters.sleepTransformation );
+
+    Snapshot snapshot;
+    qint64 nbParticles = _particles.size();
+    qint64 floatSize = nbParticles * sizeof( float );
+
+    snapshot.setParticleCount( nbParticles );
+    snapshot.setParameters( parameters );
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        snapshot.setArray( Snapshot::Array( Snapshot::ArrayPositionX + axis ), _particles.positions( axis ), floatSize );
+        snapshot.setArray( Snapshot::Array( Snapshot::ArrayVelocityX + axis ), _particles.velocities( axis ), floatSize );
+        snapshot.setArray( Snapshot::Array( Snapshot::ArrayAccelerationX + axis ), _particles.accelerations( axis ), floatSize );
+
+        if ( _particles.doublePrecision() )
+        {
+            snapshot.setArray( Snapshot::Array( Snapshot::ArrayPrecisePositionX + axis ), _particles.precisePositions( axis ), nbParticles * sizeof( double ) );
+            snapshot.setArray( Snapshot::Array( Snapshot::ArrayPreciseVelocityX + axis ), _particles.preciseVelocities( axis ), nbParticles * sizeof( double ) );
+        }
+    }
 
-        if (currCell != nextCell) {
-            _particles[i].setCellIndex(nextCell);
+    snapshot.setArray( Snapshot::ArrayMass, _particles.masses(), floatSize );
+    snapshot.setArray( Snapshot::ArrayDensity, _particles.densities(), floatSize );
+    snapshot.setArray( Snapshot::ArrayVolume, _particles.volumes(), floatSize );
+    snapshot.setArray( Snapshot::ArrayPressure, _particles.pressures(), floatSize );
+    snapshot.setArray( Snapshot::ArrayStillSteps, _particles.stillSteps(), nbParticles * sizeof( unsigned int ) );
+    snapshot.setArray( Snapshot::ArraySleeping, _particles.sleeping(), nbParticles * sizeof( unsigned char ) );
+    snapshot.setArray( Snapshot::ArrayIdentifier, _particles.identifiers(), nbParticles * sizeof( unsigned int ) );
+
+    // The DFSPH warm start, once it exists
+    if ( _densityStiffness.size() == nbParticles )
+        snapshot.setArray( Snapshot::ArrayDensityStiffness, _densityStiffness.constData(), floatSize );
+    if ( _divergenceStiffness.size() == nbParticles )
+        snapshot.setArray( Snapshot::ArrayDivergenceStiffness, _divergenceStiffness.constData(), floatSize );
+
+    QVector<unsigned int> cellOrder;
+
+    if ( _grid.storageMode() == Grid::StorageIncremental )
+    {
+        cellOrder.reserve( nbParticles );
 
-            _grid.removeParticle(currCell, unsigned(i));
-            _grid.addParticle(nextCell, unsigned(i));
+        for ( int c=0 ; c<_grid.nbOccupiedCells() ; ++c )
+        {
+            ParticleRange range = _grid.cellParticles( _grid.occupiedCell( c ) );
+            for ( const unsigned int* i=range.begin() ; i!=range.end() ; ++i )
+                cellOrder.append( *i );
         }
+
+        snapshot.setArray( Snapshot::ArrayCellOrder, cellOrder.constData(), nbParticles * sizeof( unsigned int ) );
     }
+
+    return snapshot.save( fileName );
 }
 
-void SPH::surfaceInfo(const QVector3D& position, float& value, QVector3D& normal) {
-    // Calculez la valeur de la fonction 'f' ainsi que l'approximation de la normale à
-    // la surface au point 'position'. Cette fonction est appelée par la classe
-    // 'MarchingTetrahedra' à chaque sommet de sa grille. Inspirez-vous de la fonction
-    // 'computeDensities' pour savoir comment accéder aux particules voisines.
+bool SPH::loadSnapshot( const QString& fileName )
+{
+    Snapshot snapshot;
 
-    float density = 0;
-    QVector3D gradient = QVector3D();
+    if ( _decomposition || !snapshot.map( fileName ) )
+        return false;
 
-    for (unsigned int neighborhood : _grid.neighborhood(_grid.cellIndex(position))) {
-        for (unsigned int neighbor : _grid.cellParticles(neighborhood)) {
-            Particle& particle = _particles[int(neighbor)];
-            QVector3D diffPos = position - particle.position();
+    // The cell order must refer to the same grid
+    const Snapshot::Parameters& parameters = snapshot.parameters();
 
-            float r2 = diffPos.lengthSquared();
-            if (r2 < _smoothingRadius2) {
-                density += particle.mass() * densityKernel(r2);
-                gradient -= particle.mass() * densitykernelGradient(r2) * diffPos;
-            }
+    BoundingBox gridBoundingBox = inflatedContainerBoundingBox();
+
+    if ( parameters.smoothingRadius != _smoothingRadius || parameters.nbCells != _grid.nbCells() )
+        return false;
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+        if ( parameters.gridMinimum[axis] != gridBoundingBox.minimum()[axis] || parameters.gridMaximum[axis] != gridBoundingBox.maximum()[axis] )
+            return false;
+
+    if ( snapshot.nbParticles() > quint64( std::numeric_limits<int>::max() ) )
+        return false;
+
+    int nbParticles = snapshot.nbParticles();
+    qint64 floatSize = qint64( nbParticles ) * sizeof( float );
+    bool doublePrecision = ( parameters.precision == PrecisionDouble );
+
+    // Every stream must be complete, the optional ones may be missing
+    for ( int a=0 ; a<Snapshot::ArrayCount ; ++a )
+    {
+        Snapshot::Array array = Snapshot::Array( a );
+        qint64 size = floatSize;
+
+        if ( array == Snapshot::ArraySleeping )
+            size = nbParticles * sizeof( unsigned char );
+        else if ( array >= Snapshot::ArrayPrecisePositionX && array <= Snapshot::ArrayPreciseVelocityZ )
+            size = doublePrecision ? nbParticles * sizeof( double ) : 0;
+
+        bool optional = ( array == Snapshot::ArrayDensityStiffness || array == Snapshot::ArrayDivergenceStiffness ||
+                          array == Snapshot::ArrayCellOrder );
+
+        if ( snapshot.arraySize( array ) != size && !( optional && snapshot.arraySize( array ) == 0 ) )
+            return false;
+    }
+
+    // The settings must be known values
+    if ( parameters.kernel < KernelPoly6Spiky || parameters.kernel > KernelWendlandC2 ||
+         parameters.precision < PrecisionSingle || parameters.precision > PrecisionDouble ||
+         parameters.solver < SolverEquationOfState || parameters.solver > SolverDFSPH ||
+         parameters.containerCollision < CollisionRayCast || parameters.containerCollision > CollisionSignedDistance ||
+         parameters.seedingMode < ParticleSeeder::SeedingRandom || parameters.seedingMode > ParticleSeeder::SeedingPoissonDisk )
+        return false;
+
+    // The solver divides by the scales and steps, the thresholds may be 0
+    if ( !isValid( &parameters.restDensity, 1, true ) || !isValid( &parameters.totalVolume, 1, true ) ||
+         !isValid( &parameters.maxDeltaTime, 1, true ) || !isValid( &parameters.courantFactor, 1, true ) ||
+         !isValid( &parameters.maxFrameTime, 1, true ) || !isValid( &parameters.pressureTolerance, 1, true ) ||
+         !isValid( &parameters.viscosity, 1, false ) || !isValid( &parameters.pressure, 1, false ) ||
+         !isValid( &parameters.surfaceTension, 1, false ) || !isValid( &parameters.sleepVelocity, 1, false ) ||
+         !isValid( &parameters.sleepAcceleration, 1, false ) || !isValid( &parameters.neighborSkin, 1, false ) ||
+         !isValid( &parameters.lastTimeStep, 1, false ) || !isFinite( parameters.gravity, 3 ) ||
+         !isFinite( parameters.transformation, 16 ) || !isFinite( parameters.sleepTransformation, 16 ) ||
+         parameters.maxSubsteps < 1 )
+        return false;
+
+    // The cell order must list every particle once, and there is no halo
+    // without a decomposition
+    const unsigned char* sleeping = static_cast<const unsigned char*>( snapshot.array( Snapshot::ArraySleeping ) );
+    const unsigned int* cellOrder = static_cast<const unsigned int*>( snapshot.array( Snapshot::ArrayCellOrder ) );
+
+    for ( int i=0 ; i<nbParticles ; ++i )
+        if ( sleeping[i] != Particles::SleepAwake && sleeping[i] != Particles::SleepAsleep && sleeping[i] != Particles::SleepWoken )
+            return false;
+
+    if ( cellOrder )
+    {
+        QVector<bool> listed( nbParticles, false );
+
+        for ( int k=0 ; k<nbParticles ; ++k )
+        {
+            if ( cellOrder[k] >= unsigned( nbParticles ) || listed[cellOrder[k]] )
+                return false;
+
+            listed[cellOrder[k]] = true;
         }
     }
 
+    _restDensity = parameters.restDensity;
+    _totalVolume = parameters.totalVolume;
+    _viscosity = parameters.viscosity;
+    _pressure = parameters.pressure;
+    _surfaceTension = parameters.surfaceTension;
+    _maxDeltaTime = parameters.maxDeltaTime;
+    _gravity = QVector3D( parameters.gravity[0], parameters.gravity[1], parameters.gravity[2] );
+    _kernel = Kernel( parameters.kernel );
+    _precision = Precision( parameters.precision );
+    _solver = Solver( parameters.solver );
+    _containerCollision = ContainerCollision( parameters.containerCollision );
+    _seedingMode = ParticleSeeder::Mode( parameters.seedingMode );
+    _seed = parameters.seed;
+    _pressureTolerance = parameters.pressureTolerance;
+    _maxPressureIterations = parameters.maxPressureIterations;
+    _sleepSteps = parameters.sleepSteps;
+    _sleepVelocity = parameters.sleepVelocity;
+    _sleepAcceleration = parameters.sleepAcceleration;
+    _symmetricForces = parameters.symmetricForces;
+    _reorderInterval = parameters.reorderInterval;
+    _stepsSinceReorder = parameters.stepsSinceReorder;
+    _adaptiveTimeStep = parameters.adaptiveTimeStep;
+    _courantFactor = parameters.courantFactor;
+    _maxFrameTime = parameters.maxFrameTime;
+    _maxSubsteps = parameters.maxSubsteps;
+    _lastTimeStep = parameters.lastTimeStep;
+    std::copy( parameters.transformation, parameters.transformation + 16, localTransformation().data() );
+    std::copy( parameters.sleepTransformation, parameters.sleepTransformation + 16, _sleepTransformation.data() );
+
+    // Rebuilds the neighborhoods of every cell
+    if ( parameters.neighborSkin != _neighborSkin )
+        setNeighborSkin( parameters.neighborSkin );
+
+    // The streams are copied from the mapping as they are
+    _particles.resize( nbParticles );
+    _particles.setDoublePrecision( doublePrecision );
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        std::memcpy( _particles.positions( axis ), snapshot.array( Snapshot::Array( Snapshot::ArrayPositionX + axis ) ), floatSize );
+        std::memcpy( _particles.velocities( axis ), snapshot.array( Snapshot::Array( Snapshot::ArrayVelocityX + axis ) ), floatSize );
+        std::memcpy( _particles.accelerations( axis ), snapshot.array( Snapshot::Array( Snapshot::ArrayAccelerationX + axis ) ), floatSize );
+
+        if ( doublePrecision )
+        {
+            std::memcpy( _particles.precisePositions( axis ), snapshot.array( Snapshot::Array( Snapshot::ArrayPrecisePositionX + axis ) ), nbParticles * sizeof( double ) );
+            std::memcpy( _particles.preciseVelocities( axis ), snapshot.array( Snapshot::Array( Snapshot::ArrayPreciseVelocityX + axis ) ), nbParticles * sizeof( double ) );
+        }
+    }
+
+    std::memcpy( _particles.masses(), snapshot.array( Snapshot::ArrayMass ), floatSize );
+    std::memcpy( _particles.densities(), snapshot.array( Snapshot::ArrayDensity ), floatSize );
+    std::memcpy( _particles.volumes(), snapshot.array( Snapshot::ArrayVolume ), floatSize );
+    std::memcpy( _particles.pressures(), snapshot.array( Snapshot::ArrayPressure ), floatSize );
+    std::memcpy( _particles.stillSteps(), snapshot.array( Snapshot::ArrayStillSteps ), nbParticles * sizeof( unsigned int ) );
+    std::memcpy( _particles.sleeping(), snapshot.array( Snapshot::ArraySleeping ), nbParticles * sizeof( unsigned char ) );
+    std::memcpy( _particles.identifiers(), snapshot.array( Snapshot::ArrayIdentifier ), nbParticles * sizeof( unsigned int ) );
+
+    // The cells follow from the positions
+    updateCellIndices();
+
+    QVector<float>* stiffnesses[2] = { &_densityStiffness, &_divergenceStiffness };
+    Snapshot::Array stiffnessArrays[2] = { Snapshot::ArrayDensityStiffness, Snapshot::ArrayDivergenceStiffness };
+
+    for ( unsigned int s=0 ; s<2 ; ++s )
+    {
+        stiffnesses[s]->resize( snapshot.arraySize( stiffnessArrays[s] ) / sizeof( float ) );
+
+        if ( !stiffnesses[s]->isEmpty() )
+            std::memcpy( stiffnesses[s]->data(), snapshot.array( stiffnessArrays[s] ), floatSize );
+    }
+
+    resetStepStatistics();
+
+    if ( !cellOrder || _grid.storageMode() != Grid::StorageIncremental )
+    {
+        fillGrid();
+        return true;
+    }
+
+    _grid.clear();
+    _neighborList.clear();
+
+    for ( int k=0 ; k<nbParticles ; ++k )
+        _grid.addParticle( _particles.cellIndex( cellOrder[k] ), cellOrder[k] );
+
+    return true;
+}
+
+bool SPH::showFrame( const TrajectoryReader& trajectory, int frame )
+{
+    if ( frame < 0 || frame >= trajectory.nbFrames() || !trajectory.readFrame( frame, _frameValues ) )
+        return false;
+
+    int nbParticles = trajectory.frameHeader( frame ).nbParticles;
+
+    if ( !_replayFrame )
+        _replayFrame = new RenderFrame( _grid );
+
+    RenderFrame& replayFrame = *_replayFrame;
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+        replayFrame.positions[axis].resize( nbParticles );
+
+    replayFrame.masses.resize( nbParticles );
+    replayFrame.volumes.resize( nbParticles );
+    _frameCells.resize( nbParticles );
+
+    // A recording of another particle count keeps the total mass
+    bool sameCount = ( nbParticles == _particles.size() );
+    float mass = _totalVolume * _restDensity / std::max( nbParticles, 1 );
+    const float* channels[Trajectory::ChannelCount];
+
+    for ( unsigned int c=0 ; c<Trajectory::ChannelCount ; ++c )
+        channels[c] = _frameValues.constData() + c * nbParticles;
+
+    float* positions[3] = { replayFrame.positions[0].data(), replayFrame.positions[1].data(), replayFrame.positions[2].data() };
+    float* masses = replayFrame.masses.data();
+    float* volumes = replayFrame.volumes.data();
+    Grid::Cell* cellIndices = _frameCells.data();
+
+    #pragma omp parallel for schedule( static )
+    for ( int i=0 ; i<nbParticles ; ++i )
+    {
+        QVector3D position( channels[Trajectory::ChannelPositionX][i], channels[Trajectory::ChannelPositionY][i], channels[Trajectory::ChannelPositionZ][i] );
+        float density = channels[Trajectory::ChannelDensity][i];
+        float particleMass = sameCount ? _particles.mass( i ) : mass;
+
+        positions[0][i] = position.x();
+        positions[1][i] = position.y();
+        positions[2][i] = position.z();
+        masses[i] = particleMass;
+        volumes[i] = particleMass / ( density > 0 ? density : _restDensity );
+        cellIndices[i] = _grid.cellIndex( position );
+    }
+
+    rebuildRenderGrid( replayFrame, _frameCells.constData(), nbParticles );
+
+    return true;
+}
+
+void SPH::hideFrame()
+{
+    delete _replayFrame;
+    _replayFrame = 0;
+}
+
+SPH::RenderFrame::RenderFrame( const Grid& grid )
+    : grid( grid )
+{
+}
+
+void SPH::setPipelined( bool pipelined )
+{
+    delete _renderFrames;
+    _renderFrames = 0;
+
+    if ( !pipelined )
+        return;
+
+    // Something to render before the first step of the thread
+    RenderFrame frame( _grid );
+    copyRenderFrame( frame );
+
+    _renderFrames = new FrameExchange<RenderFrame>( frame );
+}
+
+bool SPH::pipelined() const
+{
+    return _renderFrames != 0;
+}
+
+void SPH::publishFrame()
+{
+    if ( !_renderFrames )
+        return;
+
+    copyRenderFrame( _renderFrames->writeFrame() );
+    _renderFrames->publish();
+}
+
+void SPH::copyRenderFrame( RenderFrame& frame ) const
+{
+    // The recycled frames keep their allocations
+    int nbParticles = _particles.size();
+    const float* streams[5] = { _particles.positions( 0 ), _particles.positions( 1 ), _particles.positions( 2 ),
+                                _particles.masses(), _particles.volumes() };
+    QVector<float>* copies[5] = { &frame.positions[0], &frame.positions[1], &frame.positions[2], &frame.masses, &frame.volumes };
+
+    for ( unsigned int s=0 ; s<5 ; ++s )
+    {
+        copies[s]->resize( nbParticles );
+        std::copy( streams[s], streams[s] + nbParticles, copies[s]->data() );
+    }
+
+    frame.transformation = globalTransformation();
+    rebuildRenderGrid( frame, _particles.cellIndices(), nbParticles );
+}
+
+void SPH::rebuildRenderGrid( RenderFrame& frame, const Grid::Cell* cellIndices, int nbParticles ) const
+{
+    // The same storage as the live grid, which keys the cells, except that the
+    // incremental cells are rebuilt by a counting sort
+    Grid::StorageMode storageMode = _grid.storageMode();
+
+    if ( storageMode == Grid::StorageIncremental )
+        storageMode = Grid::StorageCountingSort;
+
+    if ( frame.grid.storageMode() != storageMode )
+        frame.grid.setStorageMode( storageMode );
+
+    frame.grid.rebuild( cellIndices, nbParticles );
+}
+
+BoundingBox SPH::inflatedContainerBoundingBox() const
+{
+    BoundingBox boundingBox = _container.boundingBox();
+    QVector3D center = ( boundingBox.minimum() + boundingBox.maximum() ) * 0.5;
+
+    return BoundingBox( ( boundingBox.minimum() - center ) * 1.2 + center,
+                        ( boundingBox.maximum() - center ) * 1.2 + center );
+}
+
+void SPH::initializeParticles()
+{
+    float totalMass = _totalVolume * _restDensity;
+    float mass = totalMass / _particles.size();
+
+    ParticleSeeder seeder( _container, _gravity, _seed );
+    QVector<QVector3D> positions = seeder.seed( _seedingMode, _particles.size(), _totalVolume );
+
+    // set particle position and mass
+    #pragma omp parallel for schedule( static )
+    for ( int i=0 ; i<_particles.size() ; ++i )
+	{
+        _particles.setMass( i, mass );
+        _particles.setDensity( i, _restDensity );
+        _particles.setVolume( i, mass / _restDensity );
+        _particles.setPosition( i, positions[i] );
+        _particles.setCellIndex( i, _grid.cellIndex( positions[i] ) );
+        _particles.identifiers()[i] = i;
+    }
+
+    if ( _decomposition )
+        _decomposition->initialize( _particles );
+
+    wakeParticles();
+
+    fillGrid();
+}
+
+void SPH::fillGrid()
+{
+    _grid.clear();
+    _neighborList.clear();
+
+    if ( _grid.storageMode() != Grid::StorageIncremental )
+        _grid.rebuild( _particles.cellIndices(), _particles.size() );
+    else
+        for ( int i=0 ; i<_particles.size() ; ++i )
+            _grid.addParticle( _particles.cellIndex( i ), i );
+}
+
+void SPH::exchangeParticles()
+{
+    // The halo must cover the neighborhoods of the particles of the slab
+    _decomposition->exchangeParticles( _particles, _smoothingRadius );
+
+    updateCellIndices();
+    fillGrid();
+}
+
+void SPH::updateCellIndices()
+{
+    Grid::Cell* cellIndices = _particles.cellIndices();
+
+    #pragma omp parallel for schedule( static )
+    for ( int i=0 ; i<_particles.size() ; ++i )
+        cellIndices[i] = _grid.cellIndex( _particles.position( i ) );
+}
+
+float SPH::pressure( float density ) const
+{
+    // The iterative solvers start from a zero pressure, so that the force
+    // kernels only compute the non pressure forces
+    if ( _solver != SolverEquationOfState )
+        return 0;
+
+    return density / _restDensity - 1;
+}
+
+void SPH::updateNeighborList()
+{
+    if ( _neighborSkin > 0 )
+        _neighborList.update( _particles, _grid, _smoothingRadius, _neighborSkin );
+}
+
+template <typename Function>
+void SPH::forEachNeighborRange( unsigned int particle, Function function ) const
+{
+    if ( _neighborSkin > 0 )
+    {
+        function( _neighborList.neighbors( particle ) );
+        return;
+    }
+
+    _grid.forEachNeighborCell( _particles.cellIndex( particle ), [&]( Grid::Cell cell )
+    {
+        function( _grid.cellParticles( cell ) );
+    } );
+}
+
+void SPH::resetStepStatistics()
+{
+    _lastStepTimings.neighbors = 0;
+    _lastStepTimings.densities = 0;
+    _lastStepTimings.forces = 0;
+    _lastStepTimings.pressure = 0;
+    _lastStepTimings.move = 0;
+    _lastStepTimings.reorder = 0;
+    _lastStepTimings.exchange = 0;
+
+    _lastPressureIterations = 0;
+    _lastDivergenceIterations = 0;
+    _lastDensityError = 0;
+}
+
+float SPH::simulateSubstep( float deltaTime, bool stable )
+{
+    // The only dispatches on the precision and the kernel, the whole step is
+    // specialized for them
+    switch ( _precision )
+    {
+        case PrecisionMixed : return simulateSubstep<MixedPrecision>( deltaTime, stable );
+        case PrecisionDouble : return simulateSubstep<DoublePrecision>( deltaTime, stable );
+        default : return simulateSubstep<SinglePrecision>( deltaTime, stable );
+    }
+}
+
+template <typename PrecisionPolicy>
+float SPH::simulateSubstep( float deltaTime, bool stable )
+{
+    typedef typename PrecisionPolicy::Scalar Scalar;
+
+    switch ( _kernel )
+    {
+        case KernelCubicSpline : return simulateSubstep<PrecisionPolicy>( CubicSplineKernel<Scalar>( _smoothingRadius ), deltaTime, stable );
+        case KernelWendlandC2 : return simulateSubstep<PrecisionPolicy>( WendlandC2Kernel<Scalar>( _smoothingRadius ), deltaTime, stable );
+        default : return simulateSubstep<PrecisionPolicy>( Poly6SpikyKernel<Scalar>( _smoothingRadius ), deltaTime, stable );
+    }
+}
+
+template <typename PrecisionPolicy, typename KernelPolicy>
+float SPH::simulateSubstep( const KernelPolicy& kernel, float deltaTime, bool stable )
+{
+    QElapsedTimer timer;
+
+    if ( _reorderInterval > 0 && _stepsSinceReorder >= _reorderInterval )
+    {
+        timer.start();
+        reorderParticles();
+        _lastStepTimings.reorder += timer.nsecsElapsed();
+    }
+
+    ++_stepsSinceReorder;
+
+    if ( _decomposition )
+    {
+        timer.start();
+        exchangeParticles();
+        _lastStepTimings.exchange += timer.nsecsElapsed();
+    }
+
+    // Moving the container changes the gravity in its frame
+    if ( _sleepSteps > 0 && localTransformation() != _sleepTransformation )
+    {
+        _sleepTransformation = localTransformation();
+        wakeParticles();
+    }
+
+    timer.start();
+    updateNeighborList();
+    _lastStepTimings.neighbors += timer.nsecsElapsed();
+
+    timer.start();
+    computeDensities<PrecisionPolicy>( kernel );
+    _lastStepTimings.densities += timer.nsecsElapsed();
+
+    // The forces read the new densities and pressures of the halo
+    if ( _decomposition )
+    {
+        timer.start();
+        _decomposition->updateHalo( _particles );
+        _lastStepTimings.exchange += timer.nsecsElapsed();
+    }
+
+    timer.start();
+    computeForces<PrecisionPolicy>( kernel );
+    _lastStepTimings.forces += timer.nsecsElapsed();
+
+    // Spread the remaining time evenly instead of ending the frame with a tiny substep
+    if ( stable )
+        deltaTime = deltaTime / ::ceil( deltaTime / stableTimeStep() );
+
+    timer.start();
+    solvePressure<PrecisionPolicy>( kernel, deltaTime );
+    _lastStepTimings.pressure += timer.nsecsElapsed();
+
+    timer.start();
+    moveParticles<PrecisionPolicy>( deltaTime );
+    updateSleeping();
+    _lastStepTimings.move += timer.nsecsElapsed();
+
+    _lastTimeStep = deltaTime;
+    return deltaTime;
+}
+
+float SPH::stableTimeStep() const
+{
+    const float* vx = _particles.velocities( 0 );
+    const float* vy = _particles.velocities( 1 );
+    const float* vz = _particles.velocities( 2 );
+    const float* ax = _particles.accelerations( 0 );
+    const float* ay = _particles.accelerations( 1 );
+    const float* az = _particles.accelerations( 2 );
+    float maxVelocity2 = 0;
+    float maxAcceleration2 = 0;
+
+    #pragma omp parallel for schedule( static ) reduction( max : maxVelocity2, maxAcceleration2 )
+    for ( int i=0 ; i<_particles.size() ; ++i )
+    {
+        maxVelocity2 = std::max( maxVelocity2, vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i] );
+        maxAcceleration2 = std::max( maxAcceleration2, ax[i] * ax[i] + ay[i] * ay[i] + az[i] * az[i] );
+    }
+
+    // CFL condition, with the speed of sound of the linear equation of state.
+    // The iterative solvers are incompressible and only depend on the flow speed.
+    float soundSpeed = ( _solver == SolverEquationOfState ) ? ::sqrt( _pressure / _restDensity ) : 0;
+    float speed = soundSpeed + ::sqrt( maxVelocity2 );
+    float deltaTime = ( speed > 0 ) ? _courantFactor * _smoothingRadius / speed : _maxFrameTime;
+
+    // Force condition
+    if ( maxAcceleration2 > 0 )
+        deltaTime = std::min<float>( deltaTime, 0.25f * ::sqrt( _smoothingRadius / ::sqrt( maxAcceleration2 ) ) );
+
+    // Viscous diffusion condition
+    float kinematicViscosity = _viscosity / _restDensity;
+
+    if ( kinematicViscosity > 0 )
+        deltaTime = std::min<float>( deltaTime, 0.125f * _smoothingRadius2 / kinematicViscosity );
+
+    // All the processes use the same step, or stop at a failed transfer
+    if ( _decomposition )
+        _decomposition->minimum( deltaTime );
+
+    return deltaTime;
+}
+
+template <typename PrecisionPolicy, typename KernelPolicy>
+void SPH::computeDensities( const KernelPolicy& kernel )
+{
+    typedef typename PrecisionPolicy::Storage Storage;
+    typedef typename PrecisionPolicy::Scalar Scalar;
+
+    if ( PrecisionPolicy::Vectorized && KernelPolicy::Vectorized &&
+         _simdKernels.instructionSet() != SIMDKernels::InstructionSetScalar )
+    {
+        computeDensitiesVectorized();
+        return;
+    }
+
+    const Storage* x = PrecisionPolicy::positions( _particles, 0 );
+    const Storage* y = PrecisionPolicy::positions( _particles, 1 );
+    const Storage* z = PrecisionPolicy::positions( _particles, 2 );
+    const float* masses = _particles.masses();
+    float* densities = _particles.densities();
+    float* volumes = _particles.volumes();
+    float* pressures = _particles.pressures();
+    const unsigned char* sleeping = _particles.sleeping();
+
+    // For each awake particle ( the sleeping ones keep their density )
+    #pragma omp parallel for schedule( guided )
+    for ( int i=0 ; i<_particles.size() ; ++i )
+	{
+        if ( sleeping[i] )
+            continue;
+
+        Scalar density = 0;
+        Scalar correction = 0;
+
+		// For each range of candidates ( neighbor cell or neighbor list )
+        forEachNeighborRange( i, [&]( const ParticleRange& neighbors )
+		{
+			// For each candidate particle
+            for ( int k=0 ; k<neighbors.size() ; ++k )
+			{
+                unsigned int n = neighbors[k];
+                Scalar dx = Scalar( x[i] ) - x[n];
+                Scalar dy = Scalar( y[i] ) - y[n];
+                Scalar dz = Scalar( z[i] ) - z[n];
+                Scalar r2 = dx * dx + dy * dy + dz * dz;
+
+				// If the neighboring particle is inside a sphere of radius 'h'
+                if ( r2 < _smoothingRadius2 )
+				{
+					// Add density contribution
+                    Scalar kernelMass = kernel.value( r2 ) * masses[n];
+                    density += kernelMass;
+                    correction += kernelMass / densities[n];
+				}
+			}
+		} );
+
+        densities[i] = density / correction;
+        volumes[i] = masses[i] / densities[i];
+        pressures[i] = pressure( density );
+    }
+}
+
+template <typename PrecisionPolicy, typename KernelPolicy>
+void SPH::computeForces( const KernelPolicy& kernel )
+{
+    typedef typename PrecisionPolicy::Storage Storage;
+    typedef typename PrecisionPolicy::Scalar Scalar;
+
+    if ( _symmetricForces )
+    {
+        computeForcesSymmetric<PrecisionPolicy>( kernel );
+        return;
+    }
+
+    if ( PrecisionPolicy::Vectorized && KernelPolicy::Vectorized &&
+         _simdKernels.instructionSet() != SIMDKernels::InstructionSetScalar )
+    {
+        computeForcesVectorized();
+        return;
+    }
+
+	// Compute gravity vector
+    QVector3D gravity = localTransformation().inverted().mapVector( _gravity );
+
+    const Storage* positions[3] = { PrecisionPolicy::positions( _particles, 0 ),
+                                    PrecisionPolicy::positions( _particles, 1 ),
+                                    PrecisionPolicy::positions( _particles, 2 ) };
+    const Storage* velocities[3] = { PrecisionPolicy::velocities( _particles, 0 ),
+                                     PrecisionPolicy::velocities( _particles, 1 ),
+                                     PrecisionPolicy::velocities( _particles, 2 ) };
+    const float* densities = _particles.densities();
+    const float* volumes = _particles.volumes();
+    const float* pressures = _particles.pressures();
+    float* accelerations[3] = { _particles.accelerations( 0 ), _particles.accelerations( 1 ), _particles.accelerations( 2 ) };
+    const unsigned char* sleeping = _particles.sleeping();
+
+    // For each awake particle
+    #pragma omp parallel for schedule( guided )
+    for ( int i=0 ; i<_particles.size() ; ++i )
+	{
+        if ( sleeping[i] )
+            continue;
+
+        Scalar pressureForce[3] = { 0, 0, 0 };
+        Scalar viscosityForce[3] = { 0, 0, 0 };
+        Scalar tensionForce[3] = { 0, 0, 0 };
+        Scalar correction = 0;
+
+		// For each range of candidates ( neighbor cell or neighbor list )
+        forEachNeighborRange( i, [&]( const ParticleRange& neighbors )
+		{
+			// For each candidate particle
+            for ( int k=0 ; k<neighbors.size() ; ++k )
+			{
+                unsigned int n = neighbors[k];
+                Scalar difference[3];
+
+                for ( unsigned int axis=0 ; axis<3 ; ++axis )
+                    difference[axis] = Scalar( positions[axis][i] ) - positions[axis][n];
+
+                Scalar r2 = difference[0] * difference[0] + difference[1] * difference[1] + difference[2] * difference[2];
+
+				// If the neighboring particle is inside a sphere of radius 'h'
+                if ( r2 < _smoothingRadius2 )
+				{
+                    Scalar r = ::sqrt( r2 );
+                    Scalar volume = volumes[n];
+                    Scalar meanPressure = ( pressures[n] + pressures[i] ) * 0.5;
+                    Scalar pressureScale = kernel.gradient( r ) * meanPressure * volume;
+                    Scalar viscosityScale = kernel.laplacian( r ) * volume;
+                    Scalar kernelRR = kernel.value( r2 );
+
+					// Add forces contribution
+                    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+                    {
+                        pressureForce[axis] -= difference[axis] * pressureScale;
+                        viscosityForce[axis] += ( Scalar( velocities[axis][n] ) - velocities[axis][i] ) * viscosityScale;
+                        tensionForce[axis] += difference[axis] * kernelRR; // * Mass_b / Mass_a, but in our case, this equals 1
+                    }
+
+                    correction += kernelRR * volume;
+				}
+			}
+		} );
+
+		// Normalize results and apply uniform coefficients, then convert the
+		// sum of all forces to an acceleration
+        for ( unsigned int axis=0 ; axis<3 ; ++axis )
+        {
+            Scalar pressureTerm = pressureForce[axis] * ( _pressure / correction );
+            Scalar viscosityTerm = viscosityForce[axis] * ( _viscosity / correction );
+            Scalar tensionTerm = tensionForce[axis] * ( _surfaceTension / correction );
+
+            accelerations[axis][i] = ( viscosityTerm - pressureTerm - tensionTerm ) / densities[i] + gravity[axis];
+        }
+    }
+}
+
+SIMDKernels::Streams SPH::particleStreams() const
+{
+    SIMDKernels::Streams streams;
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        streams.positions[axis] = _particles.positions( axis );
+        streams.velocities[axis] = _particles.velocities( axis );
+    }
+
+    streams.masses = _particles.masses();
+    streams.densities = _particles.densities();
+    streams.volumes = _particles.volumes();
+    streams.pressures = _particles.pressures();
+
+    return streams;
+}
+
+SIMDKernels::Coefficients SPH::kernelCoefficients() const
+{
+    Poly6SpikyKernel<float> kernel( _smoothingRadius );
+    SIMDKernels::Coefficients coefficients;
+    coefficients.smoothingRadius = _smoothingRadius;
+    coefficients.smoothingRadius2 = _smoothingRadius2;
+    coefficients.poly6 = kernel.poly6Coefficient();
+    coefficients.spiky = kernel.spikyCoefficient();
+    coefficients.viscosity = kernel.viscosityCoefficient();
+
+    return coefficients;
+}
+
+ParticleRange SPH::gatherCandidates( unsigned int particle, std::vector<unsigned int>& buffer ) const
+{
+    // The neighbor lists are already contiguous
+    if ( _neighborSkin > 0 )
+        return _neighborList.neighbors( particle );
+
+    buffer.clear();
+
+    forEachNeighborRange( particle, [&]( const ParticleRange& neighbors )
+    {
+        buffer.insert( buffer.end(), neighbors.begin(), neighbors.end() );
+    } );
+
+    return ParticleRange( buffer.data(), buffer.data() + buffer.size() );
+}
+
+void SPH::computeDensitiesVectorized()
+{
+    SIMDKernels::Streams streams = particleStreams();
+    SIMDKernels::Coefficients coefficients = kernelCoefficients();
+    const float* masses = _particles.masses();
+    float* densities = _particles.densities();
+    float* volumes = _particles.volumes();
+    float* pressures = _particles.pressures();
+    const unsigned char* sleeping = _particles.sleeping();
+
+    #pragma omp parallel
+    {
+        std::vector<unsigned int> candidates;
+
+        #pragma omp for schedule( guided )
+        for ( int i=0 ; i<_particles.size() ; ++i )
+        {
+            if ( sleeping[i] )
+                continue;
+
+            float density = 0;
+            float correction = 0;
+
+            _simdKernels.densitySum( coefficients, streams, i, gatherCandidates( i, candidates ), density, correction );
+
+            densities[i] = density / correction;
+            volumes[i] = masses[i] / densities[i];
+            pressures[i] = pressure( density );
+        }
+    }
+}
+
+void SPH::computeForcesVectorized()
+{
+    QVector3D gravity = localTransformation().inverted().mapVector( _gravity );
+    SIMDKernels::Streams streams = particleStreams();
+    SIMDKernels::Coefficients coefficients = kernelCoefficients();
+    const float* densities = _particles.densities();
+    float* accelerations[3] = { _particles.accelerations( 0 ), _particles.accelerations( 1 ), _particles.accelerations( 2 ) };
+    const unsigned char* sleeping = _particles.sleeping();
+
+    #pragma omp parallel
+    {
+        std::vector<unsigned int> candidates;
+
+        #pragma omp for schedule( guided )
+        for ( int i=0 ; i<_particles.size() ; ++i )
+        {
+            if ( sleeping[i] )
+                continue;
+
+            SIMDKernels::ForceSums sums = {};
+
+            _simdKernels.forceSums( coefficients, streams, i, gatherCandidates( i, candidates ), sums );
+
+            // Same normalization as 'computeForces'
+            for ( unsigned int axis=0 ; axis<3 ; ++axis )
+            {
+                float pressureForce = sums.pressure[axis] * _pressure / sums.correction;
+                float viscosityForce = sums.viscosity[axis] * _viscosity / sums.correction;
+                float tensionForce = sums.tension[axis] * _surfaceTension / sums.correction;
+
+                accelerations[axis][i] = ( viscosityForce - pressureForce - tensionForce ) / densities[i] + gravity[axis];
+            }
+        }
+    }
+}
+
+template <typename PrecisionPolicy, typename KernelPolicy>
+void SPH::addPairForces( const KernelPolicy& kernel, unsigned int i, unsigned int n,
+                         typename PrecisionPolicy::Scalar* sums, unsigned int nbParticles ) const
+{
+    typedef typename PrecisionPolicy::Storage Storage;
+    typedef typename PrecisionPolicy::Scalar Scalar;
+
+    const Storage* positions[3] = { PrecisionPolicy::positions( _particles, 0 ),
+                                    PrecisionPolicy::positions( _particles, 1 ),
+                                    PrecisionPolicy::positions( _particles, 2 ) };
+    const Storage* velocities[3] = { PrecisionPolicy::velocities( _particles, 0 ),
+                                     PrecisionPolicy::velocities( _particles, 1 ),
+                                     PrecisionPolicy::velocities( _particles, 2 ) };
+    const float* volumes = _particles.volumes();
+    const float* pressures = _particles.pressures();
+    const unsigned char* sleeping = _particles.sleeping();
+
+    // Only the forces on awake particles are used
+    if ( sleeping[i] && sleeping[n] )
+        return;
+
+    Scalar difference[3];
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+        difference[axis] = Scalar( positions[axis][i] ) - positions[axis][n];
+
+    Scalar r2 = difference[0] * difference[0] + difference[1] * difference[1] + difference[2] * difference[2];
+
+    // If the particles are inside a sphere of radius 'h' of each other
+    if ( r2 >= _smoothingRadius2 )
+        return;
+
+    Scalar r = ::sqrt( r2 );
+    Scalar meanPressure = ( pressures[n] + pressures[i] ) * 0.5;
+    Scalar pressureScale = kernel.gradient( r ) * meanPressure;
+    Scalar viscosityScale = kernel.laplacian( r );
+    Scalar kernelRR = kernel.value( r2 );
+
+    // Same terms as 'computeForces', seen from both particles. Each side is
+    // weighted by the volume of the other one.
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        Scalar pressureTerm = difference[axis] * pressureScale;
+        Scalar viscosityTerm = ( Scalar( velocities[axis][n] ) - velocities[axis][i] ) * viscosityScale;
+        Scalar tensionTerm = difference[axis] * kernelRR;
+
+        sums[( 0 + axis ) * nbParticles + i] -= pressureTerm * volumes[n];
+        sums[( 0 + axis ) * nbParticles + n] += pressureTerm * volumes[i];
+        sums[( 3 + axis ) * nbParticles + i] += viscosityTerm * volumes[n];
+        sums[( 3 + axis ) * nbParticles + n] -= viscosityTerm * volumes[i];
+        sums[( 6 + axis ) * nbParticles + i] += tensionTerm;
+        sums[( 6 + axis ) * nbParticles + n] -= tensionTerm;
+    }
+
+    sums[9 * nbParticles + i] += kernelRR * volumes[n];
+    sums[9 * nbParticles + n] += kernelRR * volumes[i];
+}
+
+template <>
+QVector<float>& SPH::forceSums<float>()
+{
+    return _forceSums;
+}
+
+template <>
+QVector<double>& SPH::forceSums<double>()
+{
+    return _preciseForceSums;
+}
+
+template <typename PrecisionPolicy, typename KernelPolicy>
+void SPH::computeForcesSymmetric( const KernelPolicy& kernel )
+{
+    typedef typename PrecisionPolicy::Scalar Scalar;
+
+    QVector3D gravity = localTransformation().inverted().mapVector( _gravity );
+    const unsigned int nbSums = 10; // pressure[3], viscosity[3], tension[3], correction
+    unsigned int nbParticles = _particles.size();
+
+    // The neighbor lists hold pairs up to a skin further, and both particles
+    // may have moved half a skin since
+    float reach = _smoothingRadius;
+
+    if ( _neighborSkin > 0 )
+        reach += 2 * _neighborSkin;
+
+    // No two cells of a colour update the same particle, so the threads scatter
+    // the pairs of a colour to a single buffer, colour after colour. The sums
+    // are thus the same whatever the number of threads.
+    _grid.colorCells( reach, _coloredCells, _colorStart );
+
+    QVector<Scalar>& buffer = forceSums<Scalar>();
+    buffer.resize( nbSums * nbParticles );
+    Scalar* sums = buffer.data();
+
+    #pragma omp parallel
+    {
+        #pragma omp for schedule( static )
+        for ( int j=0 ; j<buffer.size() ; ++j )
+            sums[j] = 0;
+
+        // Self contribution ( only the correction term is non zero )
+        #pragma omp for schedule( static )
+        for ( int i=0 ; i<(int)nbParticles ; ++i )
+            sums[9 * nbParticles + i] = kernel.value( 0 ) * _particles.volume( i );
+
+        for ( int color=0 ; color<_colorStart.size() - 1 ; ++color )
+        {
+            // Same test on every thread, so the barrier is skipped by all of them
+            if ( _colorStart[color] == _colorStart[color + 1] )
+                continue;
+
+            #pragma omp for schedule( dynamic, 16 )
+            for ( int c=_colorStart[color] ; c<(int)_colorStart[color + 1] ; ++c )
+            {
+                Grid::Cell cell = _coloredCells[c];
+                ParticleRange particles = _grid.cellParticles( cell );
+
+                if ( particles.size() == 0 )
+                    continue;
+
+                if ( _neighborSkin > 0 )
+                {
+                    // Half of the neighbor list of each particle of the cell
+                    for ( int a=0 ; a<particles.size() ; ++a )
+                    {
+                        unsigned int i = particles[a];
+                        ParticleRange neighbors = _neighborList.neighbors( i );
+
+                        for ( int k=0 ; k<neighbors.size() ; ++k )
+                            if ( neighbors[k] > i )
+                                addPairForces<PrecisionPolicy>( kernel, i, neighbors[k], sums, nbParticles );
+                    }
+
+                    continue;
+                }
+
+                bool cellAsleep = isAsleep( particles );
+
+                // Each pair of neighboring cells is visited once
+                _grid.forEachHalfNeighborCell( cell, [&]( Grid::Cell neighborCell )
+                {
+                    ParticleRange neighbors = _grid.cellParticles( neighborCell );
+
+                    // Cells of sleeping particles are skipped together
+                    if ( cellAsleep && isAsleep( neighbors ) )
+                        return;
+
+                    for ( int a=0 ; a<particles.size() ; ++a )
+                        for ( int b=( neighborCell == cell ) ? a + 1 : 0 ; b<neighbors.size() ; ++b )
+                            addPairForces<PrecisionPolicy>( kernel, particles[a], neighbors[b], sums, nbParticles );
+                } );
+            }
+        }
+
+        // Same normalization as 'computeForces'
+        #pragma omp for schedule( static )
+        for ( int i=0 ; i<(int)nbParticles ; ++i )
+        {
+            if ( _particles.sleeping()[i] )
+                continue;
+
+            Scalar correction = sums[9 * nbParticles + i];
+
+            for ( unsigned int axis=0 ; axis<3 ; ++axis )
+            {
+                Scalar pressureForce = sums[( 0 + axis ) * nbParticles + i] * ( _pressure / correction );
+                Scalar viscosityForce = sums[( 3 + axis ) * nbParticles + i] * ( _viscosity / correction );
+                Scalar tensionForce = sums[( 6 + axis ) * nbParticles + i] * ( _surfaceTension / correction );
+
+                _particles.accelerations( axis )[i] = ( viscosityForce - pressureForce - tensionForce ) / _particles.density( i ) + gravity[axis];
+            }
+        }
+    }
+}
+
+template <typename PrecisionPolicy, typename KernelPolicy>
+void SPH::solvePressure( const KernelPolicy& kernel, float deltaTime )
+{
+    if ( _solver == SolverPCISPH )
+        solvePressurePCISPH<PrecisionPolicy>( kernel, deltaTime );
+    else if ( _solver == SolverDFSPH )
+        solvePressureDFSPH<PrecisionPolicy>( kernel, deltaTime );
+}
+
+template <typename KernelPolicy>
+float SPH::pcisphScalingFactor( const KernelPolicy& kernel, float deltaTime ) const
+{
+    if ( _particles.size() == 0 || deltaTime <= 0 )
+        return 0;
+
+    // Gradient sums of a prototype particle with a full neighborhood, sampled
+    // on a lattice at the rest spacing
+    float mass = _particles.mass( 0 );
+    float spacing = ::pow( mass / _restDensity, 1.0f / 3.0f );
+    int extent = int( ::ceil( _smoothingRadius / spacing ) );
+    QVector3D gradientSum;
+    float gradientDotSum = 0;
+
+    for ( int i=-extent ; i<=extent ; ++i )
+        for ( int j=-extent ; j<=extent ; ++j )
+            for ( int k=-extent ; k<=extent ; ++k )
+            {
+                QVector3D difference = -QVector3D( i, j, k ) * spacing;
+                float r = difference.length();
+
+                if ( r < _smoothingRadius )
+                {
+                    QVector3D gradient = -difference * kernel.gradient( r );
+                    gradientSum += gradient;
+                    gradientDotSum += QVector3D::dotProduct( gradient, gradient );
+                }
+            }
+
+    float beta = 2 * deltaTime * deltaTime * mass * mass / ( _restDensity * _restDensity );
+    float denominator = beta * ( QVector3D::dotProduct( gradientSum, gradientSum ) + gradientDotSum );
+
+    // The factor assumes that only the center particle is corrected, but its
+    // neighbors are corrected at the same time, so only half of it is applied
+    return ( denominator > 0 ) ? 0.5f / denominator : 0;
+}
+
+template <typename PrecisionPolicy, typename KernelPolicy>
+void SPH::solvePressurePCISPH( const KernelPolicy& kernel, float deltaTime )
+{
+    // See B. Solenthaler et R. Pajarola. 2009
+    //     Predictive-corrective incompressible SPH.
+
+    typedef typename PrecisionPolicy::Storage Storage;
+    typedef typename PrecisionPolicy::Scalar Scalar;
+
+    const int nbParticles = _particles.size();
+    if ( nbParticles == 0 )
+        return;
+
+    const Storage* x = PrecisionPolicy::positions( _particles, 0 );
+    const Storage* y = PrecisionPolicy::positions( _particles, 1 );
+    const Storage* z = PrecisionPolicy::positions( _particles, 2 );
+    const Storage* vx = PrecisionPolicy::velocities( _particles, 0 );
+    const Storage* vy = PrecisionPolicy::velocities( _particles, 1 );
+    const Storage* vz = PrecisionPolicy::velocities( _particles, 2 );
+    const float* masses = _particles.masses();
+    float* ax = _particles.accelerations( 0 );
+    float* ay = _particles.accelerations( 1 );
+    float* az = _particles.accelerations( 2 );
+    float* pressures = _particles.pressures();
+    const unsigned char* sleeping = _particles.sleeping();
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        _predictedPositions[axis].resize( nbParticles );
+        _pressureAccelerations[axis].fill( 0, nbParticles );
+    }
+
+    float* px = _predictedPositions[0].data();
+    float* py = _predictedPositions[1].data();
+    float* pz = _predictedPositions[2].data();
+    float* apx = _pressureAccelerations[0].data();
+    float* apy = _pressureAccelerations[1].data();
+    float* apz = _pressureAccelerations[2].data();
+
+    const float delta = pcisphScalingFactor( kernel, deltaTime );
+    const float pressureScale = 1 / ( _restDensity * _restDensity );
+    unsigned int iterations = 0;
+
+    do
+    {
+        float densityError = 0;
+
+        // Predict positions with the non pressure forces and the current pressure
+        // forces, including the collisions so that the walls support the fluid.
+        // Sleeping particles stay in place with their current pressure. The
+        // predictions are only used for the density errors, in single precision.
+        #pragma omp parallel for schedule( guided )
+        for ( int i=0 ; i<nbParticles ; ++i )
+        {
+            if ( sleeping[i] )
+            {
+                px[i] = x[i];
+                py[i] = y[i];
+                pz[i] = z[i];
+                continue;
+            }
+
+            QVector3D position( x[i], y[i], z[i] );
+            QVector3D velocity = QVector3D( vx[i], vy[i], vz[i] ) + deltaTime * QVector3D( ax[i] + apx[i], ay[i] + apy[i], az[i] + apz[i] );
+            QVector3D predictedPosition = position + deltaTime * velocity;
+
+            collideWithContainer( position, predictedPosition, velocity );
+
+            px[i] = predictedPosition.x();
+            py[i] = predictedPosition.y();
+            pz[i] = predictedPosition.z();
+        }
+
+        // Predict densities and correct pressures. Only compression is corrected,
+        // so that the free surface is not pulled back.
+        #pragma omp parallel for schedule( guided ) reduction( + : densityError )
+        for ( int i=0 ; i<nbParticles ; ++i )
+        {
+            if ( sleeping[i] )
+                continue;
+
+            Scalar density = 0;
+
+            forEachNeighborRange( i, [&]( const ParticleRange& neighbors )
+            {
+                for ( int k=0 ; k<neighbors.size() ; ++k )
+                {
+                    unsigned int n = neighbors[k];
+                    Scalar dx = Scalar( px[i] ) - px[n];
+                    Scalar dy = Scalar( py[i] ) - py[n];
+                    Scalar dz = Scalar( pz[i] ) - pz[n];
+                    Scalar r2 = dx * dx + dy * dy + dz * dz;
+
+                    if ( r2 < _smoothingRadius2 )
+                        density += kernel.value( r2 ) * masses[n];
+                }
+            } );
+
+            float error = std::max<float>( density - _restDensity, 0.0f );
+            pressures[i] = std::max<float>( pressures[i] + delta * ( density - _restDensity ), 0.0f );
+            densityError += error;
+        }
+
+        // Pressure accelerations. The kernel gradients are taken at the current
+        // positions rather than the predicted ones : particles pushed against the
+        // walls cannot move, and re-evaluating the gradients on their predicted
+        // positions makes the iterations diverge.
+        #pragma omp parallel for schedule( guided )
+        for ( int i=0 ; i<nbParticles ; ++i )
+        {
+            if ( sleeping[i] )
+                continue;
+
+            Scalar acceleration[3] = { 0, 0, 0 };
+
+            forEachNeighborRange( i, [&]( const ParticleRange& neighbors )
+            {
+                for ( int k=0 ; k<neighbors.size() ; ++k )
+                {
+                    unsigned int n = neighbors[k];
+                    Scalar dx = Scalar( x[i] ) - x[n];
+                    Scalar dy = Scalar( y[i] ) - y[n];
+                    Scalar dz = Scalar( z[i] ) - z[n];
+                    Scalar r2 = dx * dx + dy * dy + dz * dz;
+
+                    if ( r2 < _smoothingRadius2 )
+                    {
+                        Scalar scale = kernel.gradient( ::sqrt( r2 ) ) * masses[n] * ( pressures[i] + pressures[n] );
+
+                        acceleration[0] += dx * scale;
+                        acceleration[1] += dy * scale;
+                        acceleration[2] += dz * scale;
+                    }
+                }
+            } );
+
+            apx[i] = acceleration[0] * pressureScale;
+            apy[i] = acceleration[1] * pressureScale;
+            apz[i] = acceleration[2] * pressureScale;
+        }
+
+        ++iterations;
+        _lastDensityError = densityError / ( nbParticles * _restDensity );
+    }
+    while ( ( _lastDensityError > _pressureTolerance || iterations < 3 ) &&
+            iterations < _maxPressureIterations );
+
+    _lastPressureIterations += iterations;
+
+    #pragma omp parallel for schedule( static )
+    for ( int i=0 ; i<nbParticles ; ++i )
+    {
+        ax[i] += apx[i];
+        ay[i] += apy[i];
+        az[i] += apz[i];
+    }
+}
+
+template <typename PrecisionPolicy, typename KernelPolicy>
+void SPH::computeDFSPHFactors( const KernelPolicy& kernel )
+{
+    typedef typename PrecisionPolicy::Storage Storage;
+    typedef typename PrecisionPolicy::Scalar Scalar;
+
+    const Storage* x = PrecisionPolicy::positions( _particles, 0 );
+    const Storage* y = PrecisionPolicy::positions( _particles, 1 );
+    const Storage* z = PrecisionPolicy::positions( _particles, 2 );
+    const float* masses = _particles.masses();
+    float* densities = _solverDensities.data();
+    float* factors = _dfsphFactors.data();
+
+    #pragma omp parallel for schedule( guided )
+    for ( int i=0 ; i<_particles.size() ; ++i )
+    {
+        Scalar density = 0;
+        Scalar gradientSum[3] = { 0, 0, 0 };
+        Scalar gradientDotSum = 0;
+
+        forEachNeighborRange( i, [&]( const ParticleRange& neighbors )
+        {
+            for ( int k=0 ; k<neighbors.size() ; ++k )
+            {
+                unsigned int n = neighbors[k];
+                Scalar dx = Scalar( x[i] ) - x[n];
+                Scalar dy = Scalar( y[i] ) - y[n];
+                Scalar dz = Scalar( z[i] ) - z[n];
+                Scalar r2 = dx * dx + dy * dy + dz * dz;
+
+                if ( r2 < _smoothingRadius2 )
+                {
+                    Scalar scale = kernel.gradient( ::sqrt( r2 ) ) * masses[n];
+                    Scalar gradient[3] = { -dx * scale, -dy * scale, -dz * scale };
+
+                    density += kernel.value( r2 ) * masses[n];
+                    gradientSum[0] += gradient[0];
+                    gradientSum[1] += gradient[1];
+                    gradientSum[2] += gradient[2];
+                    gradientDotSum += gradient[0] * gradient[0] + gradient[1] * gradient[1] + gradient[2] * gradient[2];
+                }
+            }
+        } );
+
+        // Isolated particles are left alone
+        Scalar denominator = gradientSum[0] * gradientSum[0] + gradientSum[1] * gradientSum[1] + gradientSum[2] * gradientSum[2] +
+                             gradientDotSum;
+
+        densities[i] = density;
+        factors[i] = ( denominator > Scalar( 1e-6f ) ) ? density / denominator : 0;
+    }
+}
+
+template <typename PrecisionPolicy, typename KernelPolicy>
+float SPH::densityChangeRate( const KernelPolicy& kernel, unsigned int particle ) const
+{
+    typedef typename PrecisionPolicy::Storage Storage;
+    typedef typename PrecisionPolicy::Scalar Scalar;
+
+    const Storage* x = PrecisionPolicy::positions( _particles, 0 );
+    const Storage* y = PrecisionPolicy::positions( _particles, 1 );
+    const Storage* z = PrecisionPolicy::positions( _particles, 2 );
+    const float* vx = _predictedVelocities[0].constData();
+    const float* vy = _predictedVelocities[1].constData();
+    const float* vz = _predictedVelocities[2].constData();
+    const float* masses = _particles.masses();
+    unsigned int i = particle;
+    Scalar rate = 0;
+
+    // Sum of m_j ( v_i - v_j ) . grad W_ij, with grad W_ij = -gradient * ( x_i - x_j )
+    forEachNeighborRange( i, [&]( const ParticleRange& neighbors )
+    {
+        for ( int k=0 ; k<neighbors.size() ; ++k )
+        {
+            unsigned int n = neighbors[k];
+            Scalar dx = Scalar( x[i] ) - x[n];
+            Scalar dy = Scalar( y[i] ) - y[n];
+            Scalar dz = Scalar( z[i] ) - z[n];
+            Scalar r2 = dx * dx + dy * dy + dz * dz;
+
+            if ( r2 < _smoothingRadius2 )
+            {
+                Scalar dot = ( vx[i] - vx[n] ) * dx + ( vy[i] - vy[n] ) * dy + ( vz[i] - vz[n] ) * dz;
+                rate -= dot * kernel.gradient( ::sqrt( r2 ) ) * masses[n];
+            }
+        }
+    } );
+
+    return rate;
+}
+
+template <typename PrecisionPolicy, typename KernelPolicy>
+void SPH::applyStiffness( const KernelPolicy& kernel, const float* stiffness )
+{
+    typedef typename PrecisionPolicy::Storage Storage;
+    typedef typename PrecisionPolicy::Scalar Scalar;
+
+    const Storage* x = PrecisionPolicy::positions( _particles, 0 );
+    const Storage* y = PrecisionPolicy::positions( _particles, 1 );
+    const Storage* z = PrecisionPolicy::positions( _particles, 2 );
+    const float* masses = _particles.masses();
+    const float* densities = _solverDensities.constData();
+    float* vx = _predictedVelocities[0].data();
+    float* vy = _predictedVelocities[1].data();
+    float* vz = _predictedVelocities[2].data();
+    const unsigned char* sleeping = _particles.sleeping();
+
+    // v_i -= sum of m_j ( k_i / rho_i + k_j / rho_j ) grad W_ij. The update only
+    // reads the stiffness, so the velocities can be written in place.
+    #pragma omp parallel for schedule( guided )
+    for ( int i=0 ; i<_particles.size() ; ++i )
+    {
+        if ( sleeping[i] )
+            continue;
+
+        float ki = stiffness[i] / densities[i];
+        Scalar change[3] = { 0, 0, 0 };
+
+        forEachNeighborRange( i, [&]( const ParticleRange& neighbors )
+        {
+            for ( int k=0 ; k<neighbors.size() ; ++k )
+            {
+                unsigned int n = neighbors[k];
+                Scalar dx = Scalar( x[i] ) - x[n];
+                Scalar dy = Scalar( y[i] ) - y[n];
+                Scalar dz = Scalar( z[i] ) - z[n];
+                Scalar r2 = dx * dx + dy * dy + dz * dz;
+
+                if ( r2 < _smoothingRadius2 )
+                {
+                    Scalar scale = kernel.gradient( ::sqrt( r2 ) ) * masses[n] * ( ki + stiffness[n] / densities[n] );
+
+                    change[0] += dx * scale;
+                    change[1] += dy * scale;
+                    change[2] += dz * scale;
+                }
+            }
+        } );
+
+        vx[i] += change[0];
+        vy[i] += change[1];
+        vz[i] += change[2];
+    }
+}
+
+template <typename PrecisionPolicy, typename KernelPolicy>
+void SPH::solvePressureDFSPH( const KernelPolicy& kernel, float deltaTime )
+{
+    // See J. Bender et D. Koschier. 2015
+    //     Divergence-free smoothed particle hydrodynamics.
+
+    const int nbParticles = _particles.size();
+    if ( nbParticles == 0 )
+        return;
+
+    const float* vx = _particles.velocities( 0 );
+    const float* vy = _particles.velocities( 1 );
+    const float* vz = _particles.velocities( 2 );
+    float* ax = _particles.accelerations( 0 );
+    float* ay = _particles.accelerations( 1 );
+    float* az = _particles.accelerations( 2 );
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+        _predictedVelocities[axis].resize( nbParticles );
+
+    _solverDensities.resize( nbParticles );
+    _dfsphFactors.resize( nbParticles );
+    _stiffnessSources.resize( nbParticles );
+
+    // The stiffness of the previous step is only reused if the particles are the same
+    if ( _densityStiffness.size() != nbParticles )
+    {
+        _densityStiffness.fill( 0, nbParticles );
+        _divergenceStiffness.fill( 0, nbParticles );
+    }
+
+    float* pvx = _predictedVelocities[0].data();
+    float* pvy = _predictedVelocities[1].data();
+    float* pvz = _predictedVelocities[2].data();
+    const float* densities = _solverDensities.constData();
+    const float* factors = _dfsphFactors.constData();
+    float* sources = _stiffnessSources.data();
+    float* densityStiffness = _densityStiffness.data();
+    float* divergenceStiffness = _divergenceStiffness.data();
+    const unsigned char* sleeping = _particles.sleeping();
+
+    #pragma omp parallel for schedule( static )
+    for ( int i=0 ; i<nbParticles ; ++i )
+    {
+        pvx[i] = vx[i];
+        pvy[i] = vy[i];
+        pvz[i] = vz[i];
+    }
+
+    computeDFSPHFactors<PrecisionPolicy>( kernel );
+
+    // Divergence-free solve on the current velocities. The stiffness is stored
+    // multiplied by the time step, which makes it independent of the step size.
+    // Half of the previous one is applied as a warm start, since the flow changes
+    // between steps.
+    #pragma omp parallel for schedule( static )
+    for ( int i=0 ; i<nbParticles ; ++i )
+        divergenceStiffness[i] *= 0.5f;
+
+    applyStiffness<PrecisionPolicy>( kernel, divergenceStiffness );
+
+    unsigned int iterations = 0;
+
+    while ( iterations < _maxPressureIterations )
+    {
+        float divergenceError = 0;
+
+        // Only compression is corrected, and only inside the fluid : the factors
+        // of the sparse neighborhoods at the free surface are too large to be
+        // warm-started safely. Sleeping particles are not corrected either.
+        #pragma omp parallel for schedule( guided ) reduction( + : divergenceError )
+        for ( int i=0 ; i<nbParticles ; ++i )
+        {
+            float rate = ( !sleeping[i] && densities[i] >= _restDensity ) ? std::max( densityChangeRate<PrecisionPolicy>( kernel, i ), 0.0f ) : 0;
+
+            sources[i] = rate * factors[i];
+            divergenceError += rate;
+        }
+
+        // Density change over the step, relative to the rest density
+        divergenceError *= deltaTime / ( nbParticles * _restDensity );
+
+        if ( iterations >= 1 && divergenceError <= _pressureTolerance )
+            break;
+
+        applyStiffness<PrecisionPolicy>( kernel, sources );
+
+        #pragma omp parallel for schedule( static )
+        for ( int i=0 ; i<nbParticles ; ++i )
+            divergenceStiffness[i] += sources[i];
+
+        ++iterations;
+    }
+
+    _lastDivergenceIterations += iterations;
+
+    // Non pressure forces
+    #pragma omp parallel for schedule( static )
+    for ( int i=0 ; i<nbParticles ; ++i )
+    {
+        pvx[i] += deltaTime * ax[i];
+        pvy[i] += deltaTime * ay[i];
+        pvz[i] += deltaTime * az[i];
+    }
+
+    // Constant density solve on the predicted velocities, warm-started the same way
+    #pragma omp parallel for schedule( static )
+    for ( int i=0 ; i<nbParticles ; ++i )
+        densityStiffness[i] *= 0.5f;
+
+    applyStiffness<PrecisionPolicy>( kernel, densityStiffness );
+
+    iterations = 0;
+
+    while ( iterations < _maxPressureIterations )
+    {
+        float densityError = 0;
+
+        #pragma omp parallel for schedule( guided ) reduction( + : densityError )
+        for ( int i=0 ; i<nbParticles ; ++i )
+        {
+            float error = sleeping[i] ? 0 : std::max( densities[i] + deltaTime * densityChangeRate<PrecisionPolicy>( kernel, i ) - _restDensity, 0.0f );
+
+            sources[i] = error / deltaTime * factors[i];
+            densityError += error;
+        }
+
+        _lastDensityError = densityError / ( nbParticles * _restDensity );
+
+        if ( iterations >= 2 && _lastDensityError <= _pressureTolerance )
+            break;
+
+        applyStiffness<PrecisionPolicy>( kernel, sources );
+
+        #pragma omp parallel for schedule( static )
+        for ( int i=0 ; i<nbParticles ; ++i )
+            densityStiffness[i] += sources[i];
+
+        ++iterations;
+    }
+
+    _lastPressureIterations += iterations;
+
+    // Replace the accelerations by the change of velocity over the step
+    #pragma omp parallel for schedule( static )
+    for ( int i=0 ; i<nbParticles ; ++i )
+    {
+        ax[i] = ( pvx[i] - vx[i] ) / deltaTime;
+        ay[i] = ( pvy[i] - vy[i] ) / deltaTime;
+        az[i] = ( pvz[i] - vz[i] ) / deltaTime;
+    }
+}
+
+bool SPH::collideWithContainer(QVector3D currPos, QVector3D& nextPos, QVector3D& nextVel) const {
+    // Returns whether the move was changed
+    const float epsilon = 2e-3f; // XXX
+
+    // A single projection on the surface when the container is outside of the
+    // new position or within 'epsilon' of it
+    if (_containerCollision == CollisionSignedDistance && _container.hasSignedDistance()) {
+        QVector3D normal;
+        float distance = _container.signedDistance(nextPos, normal);
+
+        if (distance > -epsilon) {
+            nextPos -= (distance + epsilon) * normal;
+            nextVel -= std::max(QVector3D::dotProduct(nextVel, normal), 0.0f) * normal;
+            return true;
+        }
+
+        return false;
+    }
+
+    QVector3D remMove = nextPos - currPos;
+    QVector3D dirMove = remMove.normalized();
+    bool collided = false;
+
+    Intersection inter;
+    while (_container.intersect(Ray(currPos, dirMove), inter) &&
+           remMove.length() > (inter.rayParameterT() * dirMove).length()) {
+        remMove = nextPos - inter.position();
+
+        currPos = inter.position() - epsilon * inter.normal();
+        nextVel -= QVector3D::dotProduct(nextVel, inter.normal()) * inter.normal();
+        nextPos -= (QVector3D::dotProduct(remMove, inter.normal()) + epsilon) * inter.normal();
+
+        dirMove = (nextPos - currPos).normalized();
+        collided = true;
+    }
+
+    return collided;
+}
+
+template <typename PrecisionPolicy>
+void SPH::moveParticles(float deltaTime) {
+    // Mettre à jour la vitesse et la position de chaque particule à l'aide de la méthode d'intégration
+    // semi-explicite d'Euler, en traitant correctement les intersections avec la paroi (_container).
+    //
+    // The integration is done in the storage precision, the collisions in single precision.
+
+    typedef typename PrecisionPolicy::Storage Storage;
+
+    const unsigned char* sleeping = _particles.sleeping();
+
+    #pragma omp parallel for schedule(guided)
+    for (int i = 0; i < _particles.size(); ++i) {
+        if (sleeping[i])
+            continue;
+
+        Storage currPos[3];
+        Storage nextVel[3];
+        Storage nextPos[3];
+
+        for (unsigned int axis = 0; axis < 3; ++axis) {
+            currPos[axis] = PrecisionPolicy::positions(_particles, axis)[i];
+            nextVel[axis] = PrecisionPolicy::velocities(_particles, axis)[i] + deltaTime * _particles.accelerations(axis)[i];
+            nextPos[axis] = currPos[axis] + deltaTime * nextVel[axis];
+        }
+
+        QVector3D collidedPos(nextPos[0], nextPos[1], nextPos[2]);
+        QVector3D collidedVel(nextVel[0], nextVel[1], nextVel[2]);
+
+        if (collideWithContainer(QVector3D(currPos[0], currPos[1], currPos[2]), collidedPos, collidedVel)) {
+            for (unsigned int axis = 0; axis < 3; ++axis) {
+                nextPos[axis] = collidedPos[axis];
+                nextVel[axis] = collidedVel[axis];
+            }
+        }
+
+        _particles.setVelocity(i, nextVel);
+        _particles.setPosition(i, nextPos);
+    }
+
+    // The counting sort and hashed grids are rebuilt from scratch from the new cell indices
+
+    if (_grid.storageMode() != Grid::StorageIncremental) {
+        Grid::Cell* cellIndices = _particles.cellIndices();
+
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < _particles.size(); ++i)
+            cellIndices[i] = _grid.cellIndex(_particles.position(i));
+
+        _grid.rebuild(cellIndices, _particles.size());
+        return;
+    }
+
+    // Vérifiez si la particule a changé de cellule de la grille régulière (classe Grid). Si c'est le cas
+    // changez-la de cellule (méthodes 'removeParticle' et 'addParticle' avant de mettre à jour son index).
+    //
+    // The cell changes are collected in one list per thread, then applied to the cells in parallel.
+    // With a static schedule, the lists follow each other in increasing particle order.
+
+    int nbThreads = 1;
+
+#ifdef _OPENMP
+    nbThreads = omp_get_max_threads();
+#endif
+
+    // The team may be smaller than requested, so clear every list
+    _migrations.resize(nbThreads);
+    for (int t = 0; t < _migrations.size(); ++t)
+        _migrations[t].clear();
+
+    QVector<Grid::Migration>* migrations = _migrations.data();
+
+    #pragma omp parallel num_threads(nbThreads)
+    {
+        int thread = 0;
+
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+
+        #pragma omp for schedule(static)
+        for (int i = 0; i < _particles.size(); ++i) {
+            Grid::Cell currCell = _particles.cellIndex(i);
+            Grid::Cell nextCell = _grid.cellIndex(_particles.position(i));
+
+            if (currCell != nextCell) {
+                _particles.setCellIndex(i, nextCell);
+
+                Grid::Migration migration = { unsigned(i), currCell, nextCell };
+                migrations[thread].append(migration);
+            }
+        }
+    }
+
+    _grid.migrateParticles(_migrations);
+}
+
+void SPH::updateSleeping()
+{
+    if ( _sleepSteps == 0 )
+        return;
+
+    const float* vx = _particles.velocities( 0 );
+    const float* vy = _particles.velocities( 1 );
+    const float* vz = _particles.velocities( 2 );
+    const float* ax = _particles.accelerations( 0 );
+    const float* ay = _particles.accelerations( 1 );
+    const float* az = _particles.accelerations( 2 );
+    const float* x = _particles.positions( 0 );
+    const float* y = _particles.positions( 1 );
+    const float* z = _particles.positions( 2 );
+    unsigned int* stillSteps = _particles.stillSteps();
+    unsigned char* sleeping = _particles.sleeping();
+    float velocity2 = _sleepVelocity * _sleepVelocity;
+    float acceleration2 = _sleepAcceleration * _sleepAcceleration;
+    int nbMoving = 0;
+    int nbAsleep = 0;
+
+    _moving.resize( _particles.size() );
+    unsigned char* moving = _moving.data();
+
+    // Count the steps of the awake particles below the thresholds
+    #pragma omp parallel for schedule( static ) reduction( + : nbMoving, nbAsleep )
+    for ( int i=0 ; i<_particles.size() ; ++i )
+    {
+        moving[i] = 0;
+
+        if ( sleeping[i] != Particles::SleepAwake )
+        {
+            ++nbAsleep;
+            continue;
+        }
+
+        if ( vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i] < velocity2 &&
+             ax[i] * ax[i] + ay[i] * ay[i] + az[i] * az[i] < acceleration2 )
+            ++stillSteps[i];
+        else
+        {
+            stillSteps[i] = 0;
+            moving[i] = 1;
+            ++nbMoving;
+        }
+    }
+
+    // The moving particles wake their sleeping neighbors up. Several of them
+    // may wake the same neighbor, which is only ever set to 'Particles::SleepWoken'.
+    if ( nbMoving > 0 && nbAsleep > 0 )
+    {
+        #pragma omp parallel for schedule( guided )
+        for ( int i=0 ; i<_particles.size() ; ++i )
+        {
+            if ( !moving[i] )
+                continue;
+
+            forEachNeighborRange( i, [&]( const ParticleRange& neighbors )
+            {
+                for ( int k=0 ; k<neighbors.size() ; ++k )
+                {
+                    unsigned int n = neighbors[k];
+                    float dx = x[i] - x[n];
+                    float dy = y[i] - y[n];
+                    float dz = z[i] - z[n];
+                    unsigned char state;
+
+                    if ( dx * dx + dy * dy + dz * dz >= _smoothingRadius2 )
+                        continue;
+
+                    #pragma omp atomic read
+                    state = sleeping[n];
+
+                    if ( state == Particles::SleepAsleep )
+                    {
+                        #pragma omp atomic write
+                        sleeping[n] = Particles::SleepWoken;
+                    }
+                }
+            } );
+        }
+    }
+
+    // Wake the particles up, or put the still ones to sleep, at rest
+    #pragma omp parallel for schedule( static )
+    for ( int i=0 ; i<_particles.size() ; ++i )
+    {
+        if ( sleeping[i] == Particles::SleepWoken )
+        {
+            sleeping[i] = Particles::SleepAwake;
+            stillSteps[i] = 0;
+        }
+        else if ( sleeping[i] == Particles::SleepAwake && stillSteps[i] >= _sleepSteps )
+        {
+            sleeping[i] = Particles::SleepAsleep;
+            _particles.setVelocity( i, QVector3D() );
+            _particles.setAcceleration( i, QVector3D() );
+        }
+    }
+}
+
+bool SPH::isAsleep( const ParticleRange& particles ) const
+{
+    const unsigned char* sleeping = _particles.sleeping();
+
+    for ( int k=0 ; k<particles.size() ; ++k )
+        if ( !sleeping[particles[k]] )
+            return false;
+
+    return true;
+}
+
+void SPH::surfaceInfo( const QVector3D& position, float& value, QVector3D& normal )
+{
+    switch ( _kernel )
+    {
+        case KernelCubicSpline : surfaceInfo( CubicSplineKernel<float>( _smoothingRadius ), position, value, normal ); break;
+        case KernelWendlandC2 : surfaceInfo( WendlandC2Kernel<float>( _smoothingRadius ), position, value, normal ); break;
+        default : surfaceInfo( Poly6SpikyKernel<float>( _smoothingRadius ), position, value, normal ); break;
+    }
+}
+
+template <typename KernelPolicy>
+void SPH::surfaceInfo(const KernelPolicy& kernel, const QVector3D& position, float& value, QVector3D& normal) {
+    // Calculez la valeur de la fonction 'f' ainsi que l'approximation de la normale à
+    // la surface au point 'position'. Cette fonction est appelée par la classe
+    // 'MarchingTetrahedra' à chaque sommet de sa grille. Inspirez-vous de la fonction
+    // 'computeDensities' pour savoir comment accéder aux particules voisines.
+
+    // The frame being rendered when the simulation runs on another thread, or
+    // the recorded frame being replayed
+    const RenderFrame* frame = _renderedFrame;
+    const float* x = frame ? frame->positions[0].constData() : _particles.positions(0);
+    const float* y = frame ? frame->positions[1].constData() : _particles.positions(1);
+    const float* z = frame ? frame->positions[2].constData() : _particles.positions(2);
+    const float* masses = frame ? frame->masses.constData() : _particles.masses();
+    const Grid& grid = frame ? frame->grid : _grid;
+
+    float density = 0;
+    QVector3D gradient = QVector3D();
+
+    grid.forEachNeighborCell(grid.cellIndex(position), [&](Grid::Cell cell) {
+        for (unsigned int neighbor : grid.cellParticles(cell)) {
+            QVector3D diffPos = position - QVector3D(x[neighbor], y[neighbor], z[neighbor]);
+
+            float r2 = diffPos.lengthSquared();
+            if (r2 < _smoothingRadius2) {
+                density += masses[neighbor] * kernel.value(r2);
+                gradient += masses[neighbor] * kernel.densityGradient(r2) * diffPos;
+            }
+        }
+    });
+
     value = density / _restDensity - (1 - .3f);
     normal = (2 * gradient / _restDensity).normalized();
 }
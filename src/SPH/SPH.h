@@ -4,8 +4,17 @@
 #include "Geometry/Geometry.h"
 #include "Geometry/ImplicitSurface.h"
 #include "Geometry/MarchingTetrahedra.h"
+#include "SPH/FrameExchange.h"
 #include "SPH/Particles.h"
 #include "SPH/Grid.h"
+#include "SPH/NeighborList.h"
+#include "SPH/ParticleSeeder.h"
+#include "SPH/Precision.h"
+#include "SPH/SIMDKernels.h"
+#include "SPH/SlabDecomposition.h"
+#include "SPH/SmoothingKernels.h"
+#include "SPH/Snapshot.h"
+#include "SPH/TrajectoryReader.h"
 #include "TimeState.h"
 
 /* SPH is responsible for animating the particles and rendering the fluid given a
@@ -25,41 +34,260 @@ public:
     virtual ~SPH();
 
     virtual void animate( const TimeState& timeState );
+    void step( float deltaTime );
+    float advance( float frameTime );
     virtual void render( GLShader& shader );
 
     void changeRenderMode();
     void changeMaterial();
     void resetVelocities();
 
+    const Particles& particles() const;
+
+    // Checkpoint of the particles, the parameters and the container
+    // transformation ( see Snapshot ). Loading replaces all of them, from a
+    // snapshot taken on the same grid ( smoothing radius, cells and container
+    // bounds ), and fails without any change otherwise or when the file holds
+    // unknown settings or sleep states, or parameters out of their range ( not
+    // finite, a scale or step not above 0, no substep ). Not available with a
+    // decomposition.
+    bool saveSnapshot( const QString& fileName ) const;
+    bool loadSnapshot( const QString& fileName );
+
+    // Renders a recorded frame ( see TrajectoryReader ) instead of the
+    // particles, until 'hideFrame'. The frame is decoded on the side, so the
+    // simulation is left as it was and goes on from there afterwards.
+    bool showFrame( const TrajectoryReader& trajectory, int frame );
+    void hideFrame();
+
+    // Rendering concurrent with the simulation : a simulation thread calls
+    // 'publishFrame' after its steps to copy what the rendering needs, and
+    // 'render' then draws the latest published frame instead of the particles
+    // being simulated. Must be enabled while no step runs, and again after a
+    // change of the grid settings.
+    void setPipelined( bool pipelined );
+    bool pipelined() const;
+    void publishFrame();
+
+    // Initial placement of the particles ( random by default ), reproducible for
+    // a given seed. Changing it places the particles again, at rest.
+    void setSeeding( ParticleSeeder::Mode seedingMode, quint64 seed = 0 );
+    ParticleSeeder::Mode seedingMode() const;
+
+    void setGridStorageMode( Grid::StorageMode storageMode );
+    void setGridNeighborhoodMode( Grid::NeighborhoodMode neighborhoodMode );
+
+    // Sorts the particles along the Z-order curve of their cells every
+    // 'nbSteps' steps ( never when 0 ), so that the neighbor loops read nearby
+    // memory. The neighbor lists are rebuilt after each sort.
+    void setReorderInterval( unsigned int nbSteps );
+    unsigned int reorderInterval() const;
+    void reorderParticles();
+
+    // Particles slower than 'velocity' and with less acceleration than
+    // 'acceleration' during 'nbSteps' steps fall asleep ( never when 0 ). They
+    // are neither updated nor moved, but still act on their neighbors as they
+    // were. They wake up when a neighbor within the smoothing radius moves
+    // faster, or when the container moves.
+    void setSleeping( unsigned int nbSteps, float velocity = 0.02, float acceleration = 0.5 );
+    unsigned int sleepSteps() const;
+    unsigned int nbSleepingParticles() const;
+    void wakeParticles();
+
+    // Smoothing kernels ( see SmoothingKernels ). The vectorized sums only
+    // implement the poly6 and spiky kernels, the others use the scalar loops.
+    enum Kernel { KernelPoly6Spiky, KernelCubicSpline, KernelWendlandC2 };
+    void setKernel( Kernel kernel );
+    Kernel kernel() const;
+    static const char* kernelName( Kernel kernel );
+
+    // Floating point precision of the neighbor sums and of the integrated
+    // positions and velocities ( see Precision ). Only single precision uses
+    // the vectorized sums.
+    enum Precision { PrecisionSingle, PrecisionMixed, PrecisionDouble };
+    void setPrecision( Precision precision );
+    Precision precision() const;
+    static const char* precisionName( Precision precision );
+
+    // Distributed simulation : this process only simulates the particles of
+    // its slab, with copies of the particles of the other processes exchanged
+    // at every step ( see SlabDecomposition ). Only the equation of state is
+    // supported, the iterative solvers would need an exchange per iteration,
+    // so setting a decomposition with another solver fails without any change.
+    // Sleeping particles are only woken by the particles of their process.
+    // The decomposition is not owned, and 0 simulates every particle.
+    bool setDecomposition( SlabDecomposition* decomposition );
+    SlabDecomposition* decomposition() const;
+
+    // Verlet neighbor lists, disabled when the skin is 0
+    void setNeighborSkin( float skin );
+    float neighborSkin() const;
+    const NeighborList::Statistics& neighborListStatistics() const;
+
+    // Density and force kernels, vectorized unless the scalar set is selected
+    void setInstructionSet( SIMDKernels::InstructionSet instructionSet );
+    SIMDKernels::InstructionSet instructionSet() const;
+
+    // Evaluate each pair once and apply the forces to both particles ( Newton's
+    // third law ). Takes precedence over the vectorized force kernel. The cells
+    // are processed colour by colour ( see Grid::colorCells ), so the forces
+    // do not depend on the number of threads.
+    void setSymmetricForces( bool symmetricForces );
+    bool symmetricForces() const;
+
+    // Collisions with the container, by projection on its signed distance when
+    // it provides one, or by casting rays along the particle moves
+    enum ContainerCollision { CollisionRayCast, CollisionSignedDistance };
+    void setContainerCollision( ContainerCollision containerCollision );
+    ContainerCollision containerCollision() const;
+
+    // Pressure solver. The equation of state computes the pressure directly from
+    // the density ( stiffness 'pressure' ), while PCISPH iterates a pressure
+    // correction on predicted positions until the mean density error is below
+    // the tolerance ( relative to the rest density ), which allows much larger
+    // time steps for the same compressibility. DFSPH solves for a divergence-free
+    // velocity field and then for a constant density, both warm-started from the
+    // stiffness of the previous step, with the same tolerance for both. The
+    // iterative solvers fail without any change with a decomposition.
+    enum Solver { SolverEquationOfState, SolverPCISPH, SolverDFSPH };
+    bool setSolver( Solver solver );
+    void setPressureTolerance( float tolerance );
+    void setMaxPressureIterations( unsigned int maxIterations );
+    Solver solver() const;
+    static const char* solverName( Solver solver );
+
+    // Iterations of the last call to step() or advance(), summed over the substeps
+    unsigned int lastPressureIterations() const;
+    unsigned int lastDivergenceIterations() const;
+    float lastDensityError() const;
+
+    // Adaptive time stepping : each frame covers its elapsed time ( up to
+    // 'maxFrameTime' ) with as many substeps as needed, each one using the
+    // largest step allowed by the CFL, force and viscosity conditions.
+    // Otherwise, a single step of at most 'maxDTime' is done per frame.
+    // advance() simulates a given time with adaptive substeps, whatever this setting.
+    void setAdaptiveTimeStep( bool adaptiveTimeStep );
+    void setCourantFactor( float courantFactor );
+    void setMaxFrameTime( float maxFrameTime );
+    void setMaxSubsteps( unsigned int maxSubsteps );
+    bool adaptiveTimeStep() const;
+    unsigned int lastSubstepCount() const;
+    float lastTimeStep() const;
+
+    // Wall-clock time spent in each phase of the last call to step() or advance(),
+    // in nanoseconds
+    struct StepTimings
+    {
+        qint64 neighbors;
+        qint64 densities;
+        qint64 forces;
+        qint64 pressure;    // Iterative pressure solve, 0 with the equation of state
+        qint64 move;        // Integration and grid update
+        qint64 reorder;     // Z-order sort, 0 on the steps without one
+        qint64 exchange;    // Particle exchanges between processes, 0 without decomposition
+    };
+    const StepTimings& lastStepTimings() const;
+
+    // Evaluates the implicit surface on the marching tetrahedra grid, which is
+    // what rendering the surface costs apart from the GL calls
+    void computeSurfaceValues();
+
 private:
 	// Pre-computations
     BoundingBox inflatedContainerBoundingBox() const;
-    void initializeCoefficients();
-    void initializeParticles( float totalVolume );
-
-	// Kernels and pressure fonction
-    float densityKernel( float r2 ) const;
-    float densitykernelGradient( float r2 ) const;
-    float pressureKernel( float r ) const;
-    float viscosityKernel( float r ) const;
+    void initializeParticles();
+    void fillGrid();
+    void exchangeParticles();
+    void updateCellIndices();
+
+	// Pressure fonction
     float pressure( float density ) const;
 
-	// Animation steps
-    void computeDensities();
-    void computeForces();
+	// Neighbor search
+    void updateNeighborList();
+    template <typename Function>
+    void forEachNeighborRange( unsigned int particle, Function function ) const;
+
+	// Animation steps, the ones with neighbor sums are specialized for each
+	// precision and kernel
+    void resetStepStatistics();
+    float simulateSubstep( float deltaTime, bool stable );
+    template <typename PrecisionPolicy>
+    float simulateSubstep( float deltaTime, bool stable );
+    template <typename PrecisionPolicy, typename KernelPolicy>
+    float simulateSubstep( const KernelPolicy& kernel, float deltaTime, bool stable );
+    float stableTimeStep() const;
+    template <typename PrecisionPolicy, typename KernelPolicy>
+    void computeDensities( const KernelPolicy& kernel );
+    template <typename PrecisionPolicy, typename KernelPolicy>
+    void computeForces( const KernelPolicy& kernel );
+    bool collideWithContainer( QVector3D currentPosition, QVector3D& nextPosition, QVector3D& nextVelocity ) const;
+    template <typename PrecisionPolicy>
     void moveParticles( float deltaTime );
+    void updateSleeping();
+    bool isAsleep( const ParticleRange& particles ) const;
+
+    // Vectorized animation steps
+    SIMDKernels::Streams particleStreams() const;
+    SIMDKernels::Coefficients kernelCoefficients() const;
+    ParticleRange gatherCandidates( unsigned int particle, std::vector<unsigned int>& buffer ) const;
+    void computeDensitiesVectorized();
+    void computeForcesVectorized();
+
+    // Symmetric animation step
+    template <typename PrecisionPolicy, typename KernelPolicy>
+    void addPairForces( const KernelPolicy& kernel, unsigned int i, unsigned int n,
+                        typename PrecisionPolicy::Scalar* sums, unsigned int nbParticles ) const;
+    template <typename PrecisionPolicy, typename KernelPolicy>
+    void computeForcesSymmetric( const KernelPolicy& kernel );
+    template <typename Scalar>
+    QVector<Scalar>& forceSums();
+
+    // Iterative pressure solvers, applied on top of the non pressure forces
+    template <typename PrecisionPolicy, typename KernelPolicy>
+    void solvePressure( const KernelPolicy& kernel, float deltaTime );
+    template <typename KernelPolicy>
+    float pcisphScalingFactor( const KernelPolicy& kernel, float deltaTime ) const;
+    template <typename PrecisionPolicy, typename KernelPolicy>
+    void solvePressurePCISPH( const KernelPolicy& kernel, float deltaTime );
+    template <typename PrecisionPolicy, typename KernelPolicy>
+    void computeDFSPHFactors( const KernelPolicy& kernel );
+    template <typename PrecisionPolicy, typename KernelPolicy>
+    float densityChangeRate( const KernelPolicy& kernel, unsigned int particle ) const;
+    template <typename PrecisionPolicy, typename KernelPolicy>
+    void applyStiffness( const KernelPolicy& kernel, const float* stiffness );
+    template <typename PrecisionPolicy, typename KernelPolicy>
+    void solvePressureDFSPH( const KernelPolicy& kernel, float deltaTime );
 
     // Marching tetrahedra rendering
     virtual void surfaceInfo( const QVector3D& position, float& value, QVector3D& normal );
+    template <typename KernelPolicy>
+    void surfaceInfo( const KernelPolicy& kernel, const QVector3D& position, float& value, QVector3D& normal );
+
+    // What rendering a step or a recorded frame needs, see 'publishFrame' and
+    // 'showFrame'. The grid is a copy of the grid of the simulation with its
+    // own storage.
+    struct RenderFrame
+    {
+        RenderFrame( const Grid& grid );
+
+        QVector<float> positions[3];
+        QVector<float> masses;
+        QVector<float> volumes;
+        Grid grid;
+        QMatrix4x4 transformation;
+    };
+
+    void copyRenderFrame( RenderFrame& frame ) const;
+    void rebuildRenderGrid( RenderFrame& frame, const Grid::Cell* cellIndices, int nbParticles ) const;
+    void renderFrame( const RenderFrame& frame, GLShader& shader );
 
 private:
     const Geometry& _container;
 
 	// Pre-computations
-    float _coeffPoly6;
-    float _coeffSpiky;
-    float _coeffVisc;
     float _restDensity;
+    float _totalVolume;
 
 	// Animation global properties
     float _smoothingRadius;
@@ -72,13 +300,69 @@ private:
 
 	// Particles and cells
     Particles _particles;
+    ParticleSeeder::Mode _seedingMode;
+    quint64 _seed;
     Grid _grid;
+    QVector<QVector<Grid::Migration> > _migrations;
+    unsigned int _reorderInterval;
+    unsigned int _stepsSinceReorder;
+    SlabDecomposition* _decomposition;
+    QVector<float> _frameValues;
+    QVector<Grid::Cell> _frameCells;
+
+    // Sleeping particles
+    unsigned int _sleepSteps;
+    float _sleepVelocity;
+    float _sleepAcceleration;
+    QMatrix4x4 _sleepTransformation;
+    QVector<unsigned char> _moving;
     MarchingTetrahedra _marchingTetrahedra;
 
+    // Neighbor search and kernels
+    float _neighborSkin;
+    NeighborList _neighborList;
+    Kernel _kernel;
+    Precision _precision;
+    SIMDKernels _simdKernels;
+    bool _symmetricForces;
+    ContainerCollision _containerCollision;
+    QVector<float> _forceSums;
+    QVector<double> _preciseForceSums;
+    QVector<Grid::Cell> _coloredCells;
+    QVector<unsigned int> _colorStart;
+
+    // Pressure solver
+    Solver _solver;
+    float _pressureTolerance;
+    unsigned int _maxPressureIterations;
+    unsigned int _lastPressureIterations;
+    unsigned int _lastDivergenceIterations;
+    float _lastDensityError;
+    QVector<float> _predictedPositions[3];
+    QVector<float> _pressureAccelerations[3];
+    QVector<float> _predictedVelocities[3];
+    QVector<float> _solverDensities;
+    QVector<float> _dfsphFactors;
+    QVector<float> _densityStiffness;
+    QVector<float> _divergenceStiffness;
+    QVector<float> _stiffnessSources;
+
+    // Adaptive time stepping
+    bool _adaptiveTimeStep;
+    float _courantFactor;
+    float _maxFrameTime;
+    unsigned int _maxSubsteps;
+    unsigned int _lastSubstepCount;
+    float _lastTimeStep;
+    StepTimings _lastStepTimings;
+
     // Rendering
     enum RenderMode { RenderParticles, RenderImplicitSurface };
     RenderMode _renderMode;
     Material _material;
+    FrameExchange<RenderFrame>* _renderFrames;
+    const RenderFrame* _renderedFrame;
+    RenderFrame* _replayFrame;
 };
 
 #endif //SPH_H
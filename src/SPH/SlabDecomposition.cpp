@@ -0,0 +1,304 @@
+#include "SlabDecomposition.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace
+{
+    // What a rank needs to know of a particle of another rank. The positions
+    // and velocities are exchanged in double precision, so that none is lost
+    // by a migration in double precision mode.
+    struct ParticleRecord
+    {
+        double position[3];
+        double velocity[3];
+        float acceleration[3];
+        float mass;
+        float density;
+        float volume;
+        float pressure;
+        unsigned int identifier;
+    };
+
+    // The attributes of the halo computed by the density pass
+    struct HaloRecord
+    {
+        float density;
+        float volume;
+        float pressure;
+    };
+
+    void appendRecord( QByteArray& records, const Particles& particles, unsigned int i )
+    {
+        ParticleRecord record;
+
+        for ( unsigned int axis=0 ; axis<3 ; ++axis )
+        {
+            record.position[axis] = particles.doublePrecision() ? particles.precisePositions( axis )[i] : particles.positions( axis )[i];
+            record.velocity[axis] = particles.doublePrecision() ? particles.preciseVelocities( axis )[i] : particles.velocities( axis )[i];
+            record.acceleration[axis] = particles.accelerations( axis )[i];
+        }
+
+        record.mass = particles.mass( i );
+        record.density = particles.density( i );
+        record.volume = particles.volume( i );
+        record.pressure = particles.pressure( i );
+        record.identifier = particles.identifiers()[i];
+
+        records.append( reinterpret_cast<const char*>( &record ), sizeof( record ) );
+    }
+}
+
+SlabDecomposition::SlabDecomposition( Transport& transport )
+    : _transport( transport )
+    , _axis( 0 )
+    , _nbOwnedParticles( 0 )
+    , _nbHaloParticles( 0 )
+    , _failed( false )
+    , _haloSources( transport.nbRanks() )
+    , _haloStarts( transport.nbRanks(), 0 )
+{
+    _bounds.fill( std::numeric_limits<float>::infinity(), transport.nbRanks() + 1 );
+    _bounds[0] = -std::numeric_limits<float>::infinity();
+}
+
+void SlabDecomposition::initialize( Particles& particles )
+{
+    int nbRanks = _transport.nbRanks();
+
+    // Widest axis of the particles
+    float extents[3];
+
+    for ( unsigned int axis=0 ; axis<3 ; ++axis )
+    {
+        const float* coordinates = particles.positions( axis );
+        std::pair<const float*, const float*> range = std::minmax_element( coordinates, coordinates + particles.size() );
+
+        extents[axis] = ( particles.size() > 0 ) ? *range.second - *range.first : 0;
+    }
+
+    _axis = std::max_element( extents, extents + 3 ) - extents;
+
+    // The same number of particles in every slab
+    std::vector<float> sorted( particles.positions( _axis ), particles.positions( _axis ) + particles.size() );
+    std::sort( sorted.begin(), sorted.end() );
+
+    for ( int r=1 ; r<nbRanks ; ++r )
+        _bounds[r] = sorted.empty() ? 0 : sorted[sorted.size() * r / nbRanks];
+
+    QVector<unsigned int> owned;
+    const float* coordinates = particles.positions( _axis );
+
+    for ( int i=0 ; i<particles.size() ; ++i )
+        if ( owner( coordinates[i] ) == _transport.rank() )
+            owned.append( i );
+
+    particles.reorder( owned );
+    _nbOwnedParticles = particles.size();
+    _nbHaloParticles = 0;
+
+    for ( int r=0 ; r<nbRanks ; ++r )
+    {
+        _haloSources[r].clear();
+        _haloStarts[r] = _nbOwnedParticles;
+    }
+}
+
+void SlabDecomposition::exchangeParticles( Particles& particles, float haloWidth )
+{
+    if ( _failed )
+        return;
+
+    int rank = _transport.rank();
+    int nbRanks = _transport.nbRanks();
+    const float* coordinates = particles.positions( _axis );
+    const unsigned char* sleeping = particles.sleeping();
+
+    // Drop the previous halo, and the particles that moved to another slab
+    QVector<QByteArray> migrants( nbRanks );
+    QVector<unsigned int> kept;
+    kept.reserve( particles.size() );
+
+    for ( int i=0 ; i<particles.size() ; ++i )
+    {
+        if ( sleeping[i] == Particles::SleepHalo )
+            continue;
+
+        int destination = owner( coordinates[i] );
+
+        if ( destination == rank )
+            kept.append( i );
+        else
+            appendRecord( migrants[destination], particles, i );
+    }
+
+    particles.reorder( kept );
+
+    QVector<QByteArray> immigrants;
+    if ( !_transport.exchange( migrants, immigrants ) )
+    {
+        _failed = true;
+        return;
+    }
+
+    for ( int r=0 ; r<nbRanks ; ++r )
+        appendParticles( particles, immigrants[r], Particles::SleepAwake );
+
+    _nbOwnedParticles = particles.size();
+    coordinates = particles.positions( _axis );
+
+    // Copies of the particles within the halo width of the other slabs. The
+    // neighboring slabs come first, but thin slabs may need further ones.
+    QVector<QByteArray> halos( nbRanks );
+
+    for ( int r=0 ; r<nbRanks ; ++r )
+        _haloSources[r].clear();
+
+    for ( int i=0 ; i<_nbOwnedParticles ; ++i )
+    {
+        for ( int r=rank-1 ; r>=0 && coordinates[i] - _bounds[r + 1] < haloWidth ; --r )
+            _haloSources[r].append( i );
+
+        for ( int r=rank+1 ; r<nbRanks && _bounds[r] - coordinates[i] < haloWidth ; ++r )
+            _haloSources[r].append( i );
+    }
+
+    for ( int r=0 ; r<nbRanks ; ++r )
+        for ( int k=0 ; k<_haloSources[r].size() ; ++k )
+            appendRecord( halos[r], particles, _haloSources[r][k] );
+
+    QVector<QByteArray> received;
+    if ( !_transport.exchange( halos, received ) )
+    {
+        _failed = true;
+        return;
+    }
+
+    for ( int r=0 ; r<nbRanks ; ++r )
+    {
+        _haloStarts[r] = particles.size();
+        appendParticles( particles, received[r], Particles::SleepHalo );
+    }
+
+    _nbHaloParticles = particles.size() - _nbOwnedParticles;
+}
+
+void SlabDecomposition::updateHalo( Particles& particles )
+{
+    if ( _failed )
+        return;
+
+    int nbRanks = _transport.nbRanks();
+    QVector<QByteArray> outgoing( nbRanks );
+
+    for ( int r=0 ; r<nbRanks ; ++r )
+    {
+        const QVector<unsigned int>& sources = _haloSources[r];
+
+        outgoing[r].resize( sources.size() * sizeof( HaloRecord ) );
+        HaloRecord* records = reinterpret_cast<HaloRecord*>( outgoing[r].data() );
+
+        for ( int k=0 ; k<sources.size() ; ++k )
+        {
+            records[k].density = particles.density( sources[k] );
+            records[k].volume = particles.volume( sources[k] );
+            records[k].pressure = particles.pressure( sources[k] );
+        }
+    }
+
+    QVector<QByteArray> incoming;
+    if ( !_transport.exchange( outgoing, incoming ) )
+    {
+        _failed = true;
+        return;
+    }
+
+    for ( int r=0 ; r<nbRanks ; ++r )
+    {
+        int nbRecords = incoming[r].size() / sizeof( HaloRecord );
+        const HaloRecord* records = reinterpret_cast<const HaloRecord*>( incoming[r].constData() );
+
+        for ( int k=0 ; k<nbRecords ; ++k )
+        {
+            particles.setDensity( _haloStarts[r] + k, records[k].density );
+            particles.setVolume( _haloStarts[r] + k, records[k].volume );
+            particles.setPressure( _haloStarts[r] + k, records[k].pressure );
+        }
+    }
+}
+
+bool SlabDecomposition::minimum( float& value )
+{
+    if ( _failed || !_transport.minimum( value ) )
+        _failed = true;
+
+    return !_failed;
+}
+
+bool SlabDecomposition::failed() const
+{
+    return _failed;
+}
+
+Transport& SlabDecomposition::transport() const
+{
+    return _transport;
+}
+
+unsigned int SlabDecomposition::axis() const
+{
+    return _axis;
+}
+
+float SlabDecomposition::lowerBound() const
+{
+    return _bounds[_transport.rank()];
+}
+
+float SlabDecomposition::upperBound() const
+{
+    return _bounds[_transport.rank() + 1];
+}
+
+int SlabDecomposition::nbOwnedParticles() const
+{
+    return _nbOwnedParticles;
+}
+
+int SlabDecomposition::nbHaloParticles() const
+{
+    return _nbHaloParticles;
+}
+
+int SlabDecomposition::owner( float coordinate ) const
+{
+    // Number of inner bounds below the coordinate
+    return std::upper_bound( _bounds.constBegin() + 1, _bounds.constEnd() - 1, coordinate ) - ( _bounds.constBegin() + 1 );
+}
+
+void SlabDecomposition::appendParticles( Particles& particles, const QByteArray& records, unsigned char state ) const
+{
+    int first = particles.size();
+    int nbRecords = records.size() / sizeof( ParticleRecord );
+
+    particles.resize( first + nbRecords );
+
+    for ( int k=0 ; k<nbRecords ; ++k )
+    {
+        ParticleRecord record;
+        std::memcpy( &record, records.constData() + k * sizeof( ParticleRecord ), sizeof( record ) );
+
+        int i = first + k;
+        particles.setPosition( i, record.position );
+        particles.setVelocity( i, record.velocity );
+        particles.setAcceleration( i, QVector3D( record.acceleration[0], record.acceleration[1], record.acceleration[2] ) );
+        particles.setMass( i, record.mass );
+        particles.setDensity( i, record.density );
+        particles.setVolume( i, record.volume );
+        particles.setPressure( i, record.pressure );
+        particles.stillSteps()[i] = 0;
+        particles.sleeping()[i] = state;
+        particles.identifiers()[i] = record.identifier;
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef SLABDECOMPOSITION_H
+#define SLABDECOMPOSITION_H
+
+#include "SPH/Particles.h"
+#include "SPH/Transport.h"
+#include <QVector>
+
+/* Splits the particles of a simulation between the ranks of a transport, in
+ * slabs along one axis of the domain. Each rank owns the particles of its
+ * slab, and receives at every step a halo of copies of the particles of the
+ * other ranks within a given width of its slab, so that the neighbor sums of
+ * its own particles are complete.
+ *
+ * The owned particles are kept in the same order between the exchanges, and
+ * the halo particles are appended after them with the 'SleepHalo' state, so
+ * that the solver loops skip them. The particles that leave the slab are sent
+ * to their new owner at the next exchange.
+ *
+ * The slabs are chosen once, along the widest axis of the initial particles,
+ * so that each one holds the same number of them.
+ */
+
+class SlabDecomposition
+{
+public:
+    explicit SlabDecomposition( Transport& transport );
+
+    // Chooses the slabs and only keeps the particles of this rank. Every rank
+    // must start from the same particles.
+    void initialize( Particles& particles );
+
+    // Migrates the particles that left the slab and replaces the halo
+    void exchangeParticles( Particles& particles, float haloWidth );
+
+    // Sends the densities, volumes and pressures of the particles of the last
+    // halo, once they have been computed
+    void updateHalo( Particles& particles );
+
+    // Minimum of 'value' over all the ranks, false when the transfer failed
+    bool minimum( float& value );
+
+    // Once a transfer failed, the exchanges do nothing
+    bool failed() const;
+
+    Transport& transport() const;
+    unsigned int axis() const;
+    float lowerBound() const;
+    float upperBound() const;
+    int nbOwnedParticles() const;
+    int nbHaloParticles() const;
+
+private:
+    int owner( float coordinate ) const;
+    void appendParticles( Particles& particles, const QByteArray& records, unsigned char state ) const;
+
+private:
+    Transport& _transport;
+    unsigned int _axis;
+    QVector<float> _bounds;  // Slab 'r' is between '_bounds[r]' and '_bounds[r+1]'
+    int _nbOwnedParticles;
+    int _nbHaloParticles;
+    bool _failed;
+
+    // Particles sent to each rank as its halo, and first particle received from each rank
+    QVector<QVector<unsigned int> > _haloSources;
+    QVector<int> _haloStarts;
+};
+
+#endif // SLABDECOMPOSITION_H
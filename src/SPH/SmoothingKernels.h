@@ -0,0 +1,271 @@
+#ifndef SMOOTHINGKERNELS_H
+#define SMOOTHINGKERNELS_H
+
+#include <cmath>
+
+/* Smoothing kernels of the SPH solver, as policies : the solver loops are
+ * templates on the kernel, so that each kernel is inlined in its own copy of
+ * the loops instead of being chosen for every pair. The coefficients only
+ * depend on the smoothing radius 'h', the support of the kernels, and are
+ * computed once per step.
+ *
+ * The kernels are templates on the floating point type of their arithmetic
+ * ( see Precision ). Each kernel provides, for two particles closer than 'h' :
+ *   - value( r2 ) : the kernel W, for the densities and the surface tension.
+ *   - gradient( r ) : the norm of the gradient of the pressure kernel divided
+ *     by 'r', so that grad W_ij = -gradient( r ) * ( x_i - x_j ).
+ *   - densityGradient( r2 ) : the same for W itself, for the surface normals.
+ *     Only the poly6 / spiky pair uses different kernels for the two.
+ *   - laplacian( r ) : the laplacian of the viscosity kernel of Müller et al.,
+ *     the same for all kernels since it stays positive over the whole support.
+ *
+ * Kernels with 'Vectorized' set are also implemented by SIMDKernels, in
+ * single precision.
+ */
+
+template <typename Scalar>
+class SmoothingKernel
+{
+public:
+    explicit SmoothingKernel( Scalar smoothingRadius );
+
+    Scalar laplacian( Scalar r ) const;
+    Scalar viscosityCoefficient() const;
+
+protected:
+    Scalar _smoothingRadius;
+    Scalar _smoothingRadius2;
+    Scalar _viscosity;
+};
+
+/* Poly6 for the densities and spiky for the pressure, see M. Müller,
+ * D. Charypar et M. Gross. 2003
+ *     Particle-based fluid simulation for interactive applications.
+ */
+
+template <typename Scalar>
+class Poly6SpikyKernel : public SmoothingKernel<Scalar>
+{
+public:
+    static const bool Vectorized = true;
+
+    explicit Poly6SpikyKernel( Scalar smoothingRadius );
+
+    Scalar value( Scalar r2 ) const;
+    Scalar gradient( Scalar r ) const;
+    Scalar densityGradient( Scalar r2 ) const;
+
+    Scalar poly6Coefficient() const;
+    Scalar spikyCoefficient() const;
+
+private:
+    Scalar _poly6;
+    Scalar _spiky;
+};
+
+/* The cubic B-spline, see J. Monaghan. 1992
+ *     Smoothed particle hydrodynamics.
+ */
+
+template <typename Scalar>
+class CubicSplineKernel : public SmoothingKernel<Scalar>
+{
+public:
+    static const bool Vectorized = false;
+
+    explicit CubicSplineKernel( Scalar smoothingRadius );
+
+    Scalar value( Scalar r2 ) const;
+    Scalar gradient( Scalar r ) const;
+    Scalar densityGradient( Scalar r2 ) const;
+
+private:
+    Scalar _inverseRadius;
+    Scalar _coefficient;
+    Scalar _gradientCoefficient;
+};
+
+/* The Wendland C2 kernel, see W. Dehnen et H. Aly. 2012
+ *     Improving convergence in smoothed particle hydrodynamics simulations
+ *     without pairing instability.
+ *
+ * It does not cluster the particles under compression, but weighs each
+ * particle itself more than the poly6 kernel : the smoothing radius should be
+ * at least 2.5 particle spacings, otherwise the densities at rest are above the
+ * rest density and the iterative solvers keep correcting them.
+ */
+
+template <typename Scalar>
+class WendlandC2Kernel : public SmoothingKernel<Scalar>
+{
+public:
+    static const bool Vectorized = false;
+
+    explicit WendlandC2Kernel( Scalar smoothingRadius );
+
+    Scalar value( Scalar r2 ) const;
+    Scalar gradient( Scalar r ) const;
+    Scalar densityGradient( Scalar r2 ) const;
+
+private:
+    Scalar _inverseRadius;
+    Scalar _coefficient;
+    Scalar _gradientCoefficient;
+};
+
+template <typename Scalar>
+inline SmoothingKernel<Scalar>::SmoothingKernel( Scalar smoothingRadius )
+    : _smoothingRadius( smoothingRadius )
+    , _smoothingRadius2( smoothingRadius * smoothingRadius )
+{
+    Scalar h6 = _smoothingRadius2 * _smoothingRadius2 * _smoothingRadius2;
+
+    _viscosity = 45.0 / ( M_PI * h6 );
+}
+
+template <typename Scalar>
+inline Scalar SmoothingKernel<Scalar>::laplacian( Scalar r ) const
+{
+    return _viscosity * ( _smoothingRadius - r );
+}
+
+template <typename Scalar>
+inline Scalar SmoothingKernel<Scalar>::viscosityCoefficient() const
+{
+    return _viscosity;
+}
+
+template <typename Scalar>
+inline Poly6SpikyKernel<Scalar>::Poly6SpikyKernel( Scalar smoothingRadius )
+    : SmoothingKernel<Scalar>( smoothingRadius )
+{
+    Scalar h = this->_smoothingRadius;
+    Scalar h2 = this->_smoothingRadius2;
+    Scalar h6 = h2 * h2 * h2;
+    Scalar h9 = h6 * h2 * h;
+
+    _poly6 = 315.0 / ( 64.0 * M_PI * h9 );
+    _spiky = 3.0 * 15.0 / ( M_PI * h6 );
+}
+
+template <typename Scalar>
+inline Scalar Poly6SpikyKernel<Scalar>::value( Scalar r2 ) const
+{
+    Scalar diff = this->_smoothingRadius2 - r2;
+
+    return _poly6 * diff * diff * diff;
+}
+
+template <typename Scalar>
+inline Scalar Poly6SpikyKernel<Scalar>::gradient( Scalar r ) const
+{
+    if ( r == 0 )
+        return 0;
+
+    Scalar diff = this->_smoothingRadius - r;
+
+    return _spiky * diff * diff / r;
+}
+
+template <typename Scalar>
+inline Scalar Poly6SpikyKernel<Scalar>::densityGradient( Scalar r2 ) const
+{
+    Scalar diff = this->_smoothingRadius2 - r2;
+
+    return 6 * _poly6 * diff * diff;
+}
+
+template <typename Scalar>
+inline Scalar Poly6SpikyKernel<Scalar>::poly6Coefficient() const
+{
+    return _poly6;
+}
+
+template <typename Scalar>
+inline Scalar Poly6SpikyKernel<Scalar>::spikyCoefficient() const
+{
+    return _spiky;
+}
+
+template <typename Scalar>
+inline CubicSplineKernel<Scalar>::CubicSplineKernel( Scalar smoothingRadius )
+    : SmoothingKernel<Scalar>( smoothingRadius )
+    , _inverseRadius( 1 / smoothingRadius )
+{
+    Scalar h = this->_smoothingRadius;
+    Scalar h2 = this->_smoothingRadius2;
+
+    _coefficient = 8.0 / ( M_PI * h2 * h );
+    _gradientCoefficient = 6 * _coefficient / h2;
+}
+
+template <typename Scalar>
+inline Scalar CubicSplineKernel<Scalar>::value( Scalar r2 ) const
+{
+    Scalar q = ::sqrt( r2 ) * _inverseRadius;
+
+    if ( q <= Scalar( 0.5 ) )
+        return _coefficient * ( 6 * q * q * ( q - 1 ) + 1 );
+
+    Scalar diff = 1 - q;
+
+    return _coefficient * 2 * diff * diff * diff;
+}
+
+template <typename Scalar>
+inline Scalar CubicSplineKernel<Scalar>::gradient( Scalar r ) const
+{
+    Scalar q = r * _inverseRadius;
+
+    // The derivative is linear in 'r' near the center, so the quotient has a limit
+    if ( q <= Scalar( 0.5 ) )
+        return _gradientCoefficient * ( 2 - 3 * q );
+
+    Scalar diff = 1 - q;
+
+    return _gradientCoefficient * diff * diff / q;
+}
+
+template <typename Scalar>
+inline Scalar CubicSplineKernel<Scalar>::densityGradient( Scalar r2 ) const
+{
+    return gradient( ::sqrt( r2 ) );
+}
+
+template <typename Scalar>
+inline WendlandC2Kernel<Scalar>::WendlandC2Kernel( Scalar smoothingRadius )
+    : SmoothingKernel<Scalar>( smoothingRadius )
+    , _inverseRadius( 1 / smoothingRadius )
+{
+    Scalar h = this->_smoothingRadius;
+    Scalar h2 = this->_smoothingRadius2;
+
+    _coefficient = 21.0 / ( 2.0 * M_PI * h2 * h );
+    _gradientCoefficient = 20 * _coefficient / h2;
+}
+
+template <typename Scalar>
+inline Scalar WendlandC2Kernel<Scalar>::value( Scalar r2 ) const
+{
+    Scalar q = ::sqrt( r2 ) * _inverseRadius;
+    Scalar diff = 1 - q;
+    Scalar diff2 = diff * diff;
+
+    return _coefficient * diff2 * diff2 * ( 1 + 4 * q );
+}
+
+template <typename Scalar>
+inline Scalar WendlandC2Kernel<Scalar>::gradient( Scalar r ) const
+{
+    Scalar diff = 1 - r * _inverseRadius;
+
+    return _gradientCoefficient * diff * diff * diff;
+}
+
+template <typename Scalar>
+inline Scalar WendlandC2Kernel<Scalar>::densityGradient( Scalar r2 ) const
+{
+    return gradient( ::sqrt( r2 ) );
+}
+
+#endif // SMOOTHINGKERNELS_H
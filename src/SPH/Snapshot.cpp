@@ -0,0 +1,143 @@
+#include "Snapshot.h"
+#include <cstring>
+
+namespace
+{
+    const char Magic[8] = { 'S', 'P', 'H', 'S', 'N', 'A', 'P', 0 };
+
+    // Reads back as another value with the other byte order
+    const quint32 ByteOrderMark = 0x01020304;
+
+    qint64 aligned( qint64 offset )
+    {
+        return ( offset + Snapshot::ArrayAlignment - 1 ) / Snapshot::ArrayAlignment * Snapshot::ArrayAlignment;
+    }
+}
+
+Snapshot::Snapshot()
+    : _mapping( 0 )
+{
+    std::memset( &_header, 0, sizeof( _header ) );
+    std::memcpy( _header.magic, Magic, sizeof( Magic ) );
+    _header.version = Version;
+    _header.byteOrder = ByteOrderMark;
+
+    for ( int a=0 ; a<ArrayCount ; ++a )
+        _arrays[a] = 0;
+}
+
+void Snapshot::setParticleCount( quint64 nbParticles )
+{
+    _header.nbParticles = nbParticles;
+}
+
+void Snapshot::setParameters( const Parameters& parameters )
+{
+    _header.parameters = parameters;
+}
+
+void Snapshot::setArray( Array array, const void* data, qint64 size )
+{
+    _arrays[array] = data;
+    _header.arrays[array].size = ( data ? size : 0 );
+}
+
+bool Snapshot::save( const QString& fileName ) const
+{
+    // The arrays follow the header in their order, each one aligned
+    Header header = _header;
+    qint64 offset = aligned( sizeof( Header ) );
+
+    for ( int a=0 ; a<ArrayCount ; ++a )
+    {
+        header.arrays[a].offset = offset;
+        offset = aligned( offset + header.arrays[a].size );
+    }
+
+    QFile file( fileName );
+
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+        return false;
+
+    const char padding[ArrayAlignment] = { 0 };
+    qint64 written = sizeof( header );
+
+    if ( file.write( reinterpret_cast<const char*>( &header ), written ) != written )
+        return false;
+
+    for ( int a=0 ; a<ArrayCount ; ++a )
+    {
+        qint64 size = header.arrays[a].size;
+        qint64 paddingSize = header.arrays[a].offset - written;
+
+        if ( file.write( padding, paddingSize ) != paddingSize )
+            return false;
+
+        if ( size > 0 && file.write( static_cast<const char*>( _arrays[a] ), size ) != size )
+            return false;
+
+        written = header.arrays[a].offset + size;
+    }
+
+    return file.write( padding, offset - written ) == offset - written;
+}
+
+bool Snapshot::map( const QString& fileName )
+{
+    if ( _mapping )
+    {
+        _file.unmap( const_cast<uchar*>( _mapping ) );
+        _file.close();
+        _mapping = 0;
+    }
+
+    _file.setFileName( fileName );
+
+    if ( !_file.open( QIODevice::ReadOnly ) || _file.size() < qint64( sizeof( Header ) ) )
+        return false;
+
+    _mapping = _file.map( 0, _file.size() );
+
+    if ( !_mapping )
+        return false;
+
+    Header header;
+    std::memcpy( &header, _mapping, sizeof( header ) );
+
+    if ( std::memcmp( header.magic, Magic, sizeof( Magic ) ) != 0 || header.version != Version || header.byteOrder != ByteOrderMark )
+        return false;
+
+    // Every array must lie in the file
+    for ( int a=0 ; a<ArrayCount ; ++a )
+    {
+        const ArrayEntry& entry = header.arrays[a];
+
+        if ( entry.offset > quint64( _file.size() ) || entry.size > quint64( _file.size() ) - entry.offset )
+            return false;
+
+        _arrays[a] = ( entry.size > 0 ) ? _mapping + entry.offset : 0;
+    }
+
+    _header = header;
+    return true;
+}
+
+quint64 Snapshot::nbParticles() const
+{
+    return _header.nbParticles;
+}
+
+const Snapshot::Parameters& Snapshot::parameters() const
+{
+    return _header.parameters;
+}
+
+const void* Snapshot::array( Array array ) const
+{
+    return _arrays[array];
+}
+
+qint64 Snapshot::arraySize( Array array ) const
+{
+    return _header.arrays[array].size;
+}
@@ -0,0 +1,140 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <QFile>
+#include <QString>
+#include <QtGlobal>
+
+/* A binary checkpoint of a simulation ( see SPH::saveSnapshot ). The file is
+ * a fixed size header followed by one contiguous array per particle attribute,
+ * each aligned on 'ArrayAlignment' bytes :
+ *
+ *   Header { magic, version, byte order, parameters, arrays[ArrayCount] }
+ *   array 0 ... array ArrayCount - 1
+ *
+ * The header gives the offset and size in bytes of every array, 0 for the
+ * missing ones ( the double precision streams outside double precision, the
+ * DFSPH stiffness before its first step, the cell order with the grid
+ * storages rebuilt at every step ). The values are stored in the byte
+ * order of the machine that wrote them, and the files are rejected elsewhere.
+ *
+ * 'ArrayCellOrder' lists the particles of the incremental grid cell by cell,
+ * since the order of the particles in a cell depends on their past moves and
+ * changes the rounding of the neighbor sums : restoring it makes a restarted
+ * run identical to an uninterrupted one. The cells of the particles are not
+ * stored, they are computed again from the positions.
+ *
+ * Reading maps the file and checks the header, the arrays are then read in
+ * place from the mapping, which stays valid as long as the snapshot.
+ */
+
+class Snapshot
+{
+public:
+    static const quint32 Version = 3;
+    static const qint64 ArrayAlignment = 64;
+
+    enum Array
+    {
+        ArrayPositionX, ArrayPositionY, ArrayPositionZ,
+        ArrayVelocityX, ArrayVelocityY, ArrayVelocityZ,
+        ArrayAccelerationX, ArrayAccelerationY, ArrayAccelerationZ,
+        ArrayMass, ArrayDensity, ArrayVolume, ArrayPressure,
+        ArrayStillSteps, ArraySleeping, ArrayIdentifier,
+        ArrayPrecisePositionX, ArrayPrecisePositionY, ArrayPrecisePositionZ,
+        ArrayPreciseVelocityX, ArrayPreciseVelocityY, ArrayPreciseVelocityZ,
+        ArrayDensityStiffness, ArrayDivergenceStiffness,
+        ArrayCellOrder,
+        ArrayCount
+    };
+
+    // Everything but the particles, with fixed size fields
+    struct Parameters
+    {
+        // The grid the cell order refers to, which must match on restore
+        float smoothingRadius;
+        quint32 nbCells;
+        float gridMinimum[3];
+        float gridMaximum[3];
+
+        float restDensity;
+        float totalVolume;
+        float viscosity;
+        float pressure;
+        float surfaceTension;
+        float maxDeltaTime;
+        float gravity[3];
+
+        qint32 kernel;
+        qint32 precision;
+        qint32 solver;
+        qint32 containerCollision;
+        qint32 seedingMode;
+        quint64 seed;
+
+        float pressureTolerance;
+        quint32 maxPressureIterations;
+        quint32 sleepSteps;
+        float sleepVelocity;
+        float sleepAcceleration;
+        float neighborSkin;
+        quint32 symmetricForces;
+        quint32 reorderInterval;
+        quint32 stepsSinceReorder;
+
+        quint32 adaptiveTimeStep;
+        float courantFactor;
+        float maxFrameTime;
+        quint32 maxSubsteps;
+        float lastTimeStep;
+
+        // Column major, as QMatrix4x4::data()
+        float transformation[16];
+        float sleepTransformation[16];
+    };
+
+    Snapshot();
+
+    // Writing : the arrays are only referenced until 'save' returns
+    void setParticleCount( quint64 nbParticles );
+    void setParameters( const Parameters& parameters );
+    void setArray( Array array, const void* data, qint64 size );
+    bool save( const QString& fileName ) const;
+
+    // Reading : false when the file is missing, truncated or not a snapshot
+    // of this version and byte order
+    bool map( const QString& fileName );
+
+    quint64 nbParticles() const;
+    const Parameters& parameters() const;
+    const void* array( Array array ) const;
+    qint64 arraySize( Array array ) const;
+
+private:
+    struct ArrayEntry
+    {
+        quint64 offset;
+        quint64 size;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        quint32 version;
+        quint32 byteOrder;
+        quint64 nbParticles;
+        Parameters parameters;
+        ArrayEntry arrays[ArrayCount];
+    };
+
+    Snapshot( const Snapshot& );
+    Snapshot& operator=( const Snapshot& );
+
+private:
+    Header _header;
+    const void* _arrays[ArrayCount];
+    QFile _file;
+    const uchar* _mapping;
+};
+
+#endif // SNAPSHOT_H
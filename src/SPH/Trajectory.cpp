@@ -0,0 +1,4 @@
+#include "Trajectory.h"
+
+const char Trajectory::FileMagic[8] = { 'S', 'P', 'H', 'T', 'R', 'A', 'J', 0 };
+const char Trajectory::IndexMagic[8] = { 'S', 'P', 'H', 'I', 'N', 'D', 'X', 0 };
@@ -0,0 +1,75 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <QtGlobal>
+
+/* Layout of the trajectory files written by TrajectoryWriter : a file header,
+ * the frames one after the other, and an index of the frames once the file
+ * is closed.
+ *
+ *   FileHeader
+ *   FrameHeader payload   ( for each frame )
+ *   quint64 offsets[nbFrames]
+ *   IndexTrailer
+ *
+ * The payload of a frame holds one array per channel, then the identifiers of
+ * the particles ( see Particles::identifiers ), since their order changes
+ * between frames. The values are floats, or with 'EncodingQuantized' 16 bit
+ * integers spread between the minimum and the maximum of the channel in the
+ * frame, and the identifiers 32 bit integers. With 'EncodingCompressed', the
+ * bytes of the values and of the identifiers are grouped by significance
+ * ( all the first bytes, then all the second ones... ) and compressed with
+ * zlib ( see qCompress ).
+ *
+ * A file without index, whose writer did not finish, can still be read by
+ * following the payload sizes from the first frame. The values are stored in
+ * the byte order of the machine that wrote them.
+ */
+
+class Trajectory
+{
+public:
+    static const quint32 Version = 2;
+
+    enum Channel
+    {
+        ChannelPositionX, ChannelPositionY, ChannelPositionZ,
+        ChannelVelocityX, ChannelVelocityY, ChannelVelocityZ,
+        ChannelDensity,
+        ChannelCount
+    };
+
+    enum Encoding { EncodingQuantized = 1, EncodingCompressed = 2 };
+
+    struct FileHeader
+    {
+        char magic[8];
+        quint32 version;
+        quint32 byteOrder;
+    };
+
+    struct FrameHeader
+    {
+        quint64 step;           // Number of recorded steps before this one
+        double time;
+        quint32 nbParticles;
+        quint32 encoding;
+        quint64 payloadSize;    // Bytes following the header
+        quint64 rawSize;        // Bytes of the payload before compression
+        float minimum[ChannelCount];
+        float maximum[ChannelCount];
+    };
+
+    struct IndexTrailer
+    {
+        quint64 nbFrames;
+        quint64 indexOffset;    // Offset of the frame offsets
+        char magic[8];
+    };
+
+    static const char FileMagic[8];
+    static const char IndexMagic[8];
+    static const quint32 ByteOrderMark = 0x01020304;
+};
+
+#endif // TRAJECTORY_H
@@ -0,0 +1,209 @@
+#include "TrajectoryReader.h"
+#include <QByteArray>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // Inverse of the shuffle of TrajectoryWriter
+    void unshuffleBytes( const char* shuffled, qint64 size, unsigned int valueSize, char* values )
+    {
+        qint64 count = size / valueSize;
+
+        for ( unsigned int b=0 ; b<valueSize ; ++b )
+            for ( qint64 i=0 ; i<count ; ++i )
+                values[i * valueSize + b] = shuffled[b * count + i];
+    }
+
+    bool earlier( double time, const Trajectory::FrameHeader& header )
+    {
+        return time < header.time;
+    }
+}
+
+TrajectoryReader::TrajectoryReader()
+    : _mapping( 0 )
+    , _size( 0 )
+{
+}
+
+bool TrajectoryReader::open( const QString& fileName )
+{
+    close();
+    _file.setFileName( fileName );
+
+    if ( !_file.open( QIODevice::ReadOnly ) || _file.size() < qint64( sizeof( Trajectory::FileHeader ) ) )
+    {
+        close();
+        return false;
+    }
+
+    _size = _file.size();
+    _mapping = _file.map( 0, _size );
+
+    Trajectory::FileHeader header;
+
+    if ( _mapping )
+        std::memcpy( &header, _mapping, sizeof( header ) );
+
+    if ( !_mapping || std::memcmp( header.magic, Trajectory::FileMagic, sizeof( header.magic ) ) != 0 ||
+         header.version != Trajectory::Version || header.byteOrder != Trajectory::ByteOrderMark )
+    {
+        close();
+        return false;
+    }
+
+    if ( !readIndex() )
+        scanFrames();
+
+    return true;
+}
+
+void TrajectoryReader::close()
+{
+    if ( _mapping )
+        _file.unmap( const_cast<uchar*>( _mapping ) );
+
+    _file.close();
+    _mapping = 0;
+    _size = 0;
+    _headers.clear();
+    _offsets.clear();
+}
+
+bool TrajectoryReader::isOpen() const
+{
+    return _mapping != 0;
+}
+
+int TrajectoryReader::nbFrames() const
+{
+    return _headers.size();
+}
+
+const Trajectory::FrameHeader& TrajectoryReader::frameHeader( int frame ) const
+{
+    return _headers[frame];
+}
+
+int TrajectoryReader::frameAt( double time ) const
+{
+    int after = std::upper_bound( _headers.constBegin(), _headers.constEnd(), time, earlier ) - _headers.constBegin();
+
+    return std::max( after - 1, 0 );
+}
+
+bool TrajectoryReader::readFrame( int frame, QVector<float>& values, QVector<quint32>* identifiers ) const
+{
+    const Trajectory::FrameHeader& header = _headers[frame];
+    int nbValues = header.nbParticles * Trajectory::ChannelCount;
+    unsigned int valueSize = ( header.encoding & Trajectory::EncodingQuantized ) ? sizeof( quint16 ) : sizeof( float );
+    qint64 valuesSize = qint64( nbValues ) * valueSize;
+    qint64 identifiersSize = qint64( header.nbParticles ) * sizeof( quint32 );
+    const char* payload = reinterpret_cast<const char*>( _mapping + _offsets[frame] + sizeof( header ) );
+
+    if ( header.rawSize != quint64( valuesSize + identifiersSize ) )
+        return false;
+
+    // The mapping holds the raw values, unless they were compressed
+    QByteArray raw;
+
+    if ( header.encoding & Trajectory::EncodingCompressed )
+    {
+        QByteArray shuffled = qUncompress( reinterpret_cast<const uchar*>( payload ), int( header.payloadSize ) );
+
+        if ( quint64( shuffled.size() ) != header.rawSize )
+            return false;
+
+        raw.resize( shuffled.size() );
+        unshuffleBytes( shuffled.constData(), valuesSize, valueSize, raw.data() );
+        unshuffleBytes( shuffled.constData() + valuesSize, identifiersSize, sizeof( quint32 ), raw.data() + valuesSize );
+        payload = raw.constData();
+    }
+    else if ( header.payloadSize != header.rawSize )
+        return false;
+
+    if ( identifiers )
+    {
+        identifiers->resize( header.nbParticles );
+        std::memcpy( identifiers->data(), payload + valuesSize, identifiersSize );
+    }
+
+    values.resize( nbValues );
+
+    if ( !( header.encoding & Trajectory::EncodingQuantized ) )
+    {
+        std::memcpy( values.data(), payload, nbValues * sizeof( float ) );
+        return true;
+    }
+
+    const quint16* quantized = reinterpret_cast<const quint16*>( payload );
+
+    for ( unsigned int c=0 ; c<Trajectory::ChannelCount ; ++c )
+    {
+        float scale = ( header.maximum[c] - header.minimum[c] ) / 65535;
+        int first = c * header.nbParticles;
+
+        for ( quint32 i=0 ; i<header.nbParticles ; ++i )
+            values[first + i] = header.minimum[c] + quantized[first + i] * scale;
+    }
+
+    return true;
+}
+
+bool TrajectoryReader::readIndex()
+{
+    Trajectory::IndexTrailer trailer;
+
+    if ( _size < qint64( sizeof( Trajectory::FileHeader ) + sizeof( trailer ) ) )
+        return false;
+
+    std::memcpy( &trailer, _mapping + _size - sizeof( trailer ), sizeof( trailer ) );
+
+    if ( std::memcmp( trailer.magic, Trajectory::IndexMagic, sizeof( trailer.magic ) ) != 0 ||
+         trailer.nbFrames > quint64( _size ) / sizeof( quint64 ) || trailer.indexOffset > quint64( _size ) ||
+         trailer.indexOffset + trailer.nbFrames * sizeof( quint64 ) + sizeof( trailer ) != quint64( _size ) )
+        return false;
+
+    _offsets.resize( int( trailer.nbFrames ) );
+    _headers.resize( int( trailer.nbFrames ) );
+
+    if ( trailer.nbFrames > 0 )
+        std::memcpy( _offsets.data(), _mapping + trailer.indexOffset, trailer.nbFrames * sizeof( quint64 ) );
+
+    for ( int f=0 ; f<_offsets.size() ; ++f )
+    {
+        if ( _offsets[f] + sizeof( Trajectory::FrameHeader ) > trailer.indexOffset )
+            return false;
+
+        std::memcpy( &_headers[f], _mapping + _offsets[f], sizeof( Trajectory::FrameHeader ) );
+
+        if ( _headers[f].payloadSize > trailer.indexOffset - _offsets[f] - sizeof( Trajectory::FrameHeader ) )
+            return false;
+    }
+
+    return true;
+}
+
+void TrajectoryReader::scanFrames()
+{
+    _offsets.clear();
+    _headers.clear();
+
+    quint64 offset = sizeof( Trajectory::FileHeader );
+
+    while ( offset + sizeof( Trajectory::FrameHeader ) <= quint64( _size ) )
+    {
+        Trajectory::FrameHeader header;
+        std::memcpy( &header, _mapping + offset, sizeof( header ) );
+
+        quint64 end = offset + sizeof( header );
+
+        if ( header.payloadSize > quint64( _size ) - end )
+            break;
+
+        _offsets.append( offset );
+        _headers.append( header );
+        offset = end + header.payloadSize;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef TRAJECTORYREADER_H
+#define TRAJECTORYREADER_H
+
+#include "SPH/Trajectory.h"
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+/* Random access to the frames of a trajectory file ( see Trajectory ), for
+ * replays. The file is mapped, and the frames are found through its index,
+ * or by following the frames from the first one when the writer did not
+ * finish. A frame is only decoded when it is read.
+ */
+
+class TrajectoryReader
+{
+public:
+    TrajectoryReader();
+
+    // False when the file is missing or not a trajectory of this version and
+    // byte order. A truncated last frame is ignored.
+    bool open( const QString& fileName );
+    void close();
+    bool isOpen() const;
+
+    int nbFrames() const;
+    const Trajectory::FrameHeader& frameHeader( int frame ) const;
+
+    // Last frame at or before 'time', the first one when there is none
+    int frameAt( double time ) const;
+
+    // Decodes the frame into one stream of 'nbParticles' values per channel,
+    // in the order of the channels, and the identifiers of the particles when
+    // 'identifiers' is given. False when the payload is corrupted.
+    bool readFrame( int frame, QVector<float>& values, QVector<quint32>* identifiers = 0 ) const;
+
+private:
+    bool readIndex();
+    void scanFrames();
+
+    TrajectoryReader( const TrajectoryReader& );
+    TrajectoryReader& operator=( const TrajectoryReader& );
+
+private:
+    QFile _file;
+    const uchar* _mapping;
+    qint64 _size;
+    QVector<Trajectory::FrameHeader> _headers;
+    QVector<quint64> _offsets;
+};
+
+#endif // TRAJECTORYREADER_H
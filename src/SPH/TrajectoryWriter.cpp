@@ -0,0 +1,341 @@
+#include "TrajectoryWriter.h"
+#include <QMutexLocker>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    // Quantizes 'count' values between their minimum and maximum
+    void quantize( const float* values, int count, quint16* quantized, float& minimum, float& maximum )
+    {
+        minimum = 0;
+        maximum = 0;
+
+        if ( count == 0 )
+            return;
+
+        std::pair<const float*, const float*> range = std::minmax_element( values, values + count );
+        minimum = *range.first;
+        maximum = *range.second;
+
+        float scale = ( maximum > minimum ) ? 65535 / ( maximum - minimum ) : 0;
+
+        for ( int i=0 ; i<count ; ++i )
+            quantized[i] = quint16( ( values[i] - minimum ) * scale + 0.5f );
+    }
+
+    // Groups the bytes of the values by significance, which leaves long runs
+    // of similar bytes for the compression
+    void shuffleBytes( const char* values, qint64 size, unsigned int valueSize, char* shuffled )
+    {
+        qint64 count = size / valueSize;
+
+        for ( unsigned int b=0 ; b<valueSize ; ++b )
+            for ( qint64 i=0 ; i<count ; ++i )
+                shuffled[b * count + i] = values[i * valueSize + b];
+    }
+}
+
+TrajectoryWriter::TrajectoryWriter()
+    : _interval( 1 )
+    , _overflow( OverflowBlock )
+    , _quantization( false )
+    , _compressionLevel( 0 )
+    , _nbWrittenBytes( 0 )
+    , _frames( 4 )
+    , _first( 0 )
+    , _nbQueued( 0 )
+    , _closing( false )
+    , _failed( false )
+    , _nbSteps( 0 )
+    , _nbWrittenFrames( 0 )
+    , _nbDroppedFrames( 0 )
+{
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+    close();
+}
+
+void TrajectoryWriter::setInterval( unsigned int nbSteps )
+{
+    _interval = std::max( nbSteps, 1u );
+}
+
+void TrajectoryWriter::setBufferCount( unsigned int nbBuffers )
+{
+    _frames.resize( std::max( nbBuffers, 1u ) );
+}
+
+void TrajectoryWriter::setOverflow( Overflow overflow )
+{
+    _overflow = overflow;
+}
+
+const char* TrajectoryWriter::overflowName( Overflow overflow )
+{
+    switch ( overflow )
+    {
+        case OverflowBlock : return "block";
+        case OverflowDrop : return "drop";
+    }
+
+    return "";
+}
+
+void TrajectoryWriter::setQuantization( bool quantization )
+{
+    _quantization = quantization;
+}
+
+void TrajectoryWriter::setCompressionLevel( int level )
+{
+    _compressionLevel = std::min( std::max( level, 0 ), 9 );
+}
+
+bool TrajectoryWriter::open( const QString& fileName )
+{
+    _file.setFileName( fileName );
+
+    if ( isRunning() || !_file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+        return false;
+
+    Trajectory::FileHeader header;
+    std::memcpy( header.magic, Trajectory::FileMagic, sizeof( header.magic ) );
+    header.version = Trajectory::Version;
+    header.byteOrder = Trajectory::ByteOrderMark;
+
+    _frameOffsets.clear();
+    _nbWrittenBytes = 0;
+    _first = 0;
+    _nbQueued = 0;
+    _closing = false;
+    _failed = false;
+    _nbSteps = 0;
+    _nbWrittenFrames = 0;
+    _nbDroppedFrames = 0;
+
+    if ( !write( &header, sizeof( header ) ) )
+    {
+        _file.close();
+        return false;
+    }
+
+    start();
+    return true;
+}
+
+bool TrajectoryWriter::record( const Particles& particles, int nbParticles, double time )
+{
+    quint64 step = _nbSteps++;
+
+    if ( step % _interval != 0 )
+        return true;
+
+    // Reserve the next free buffer
+    Frame* frame = 0;
+    {
+        QMutexLocker locker( &_mutex );
+
+        if ( !isRunning() || _failed )
+            return false;
+
+        while ( _nbQueued == _frames.size() )
+        {
+            if ( _overflow == OverflowDrop )
+            {
+                ++_nbDroppedFrames;
+                return false;
+            }
+
+            _frameFreed.wait( &_mutex );
+
+            if ( _failed )
+                return false;
+        }
+
+        frame = &_frames[( _first + _nbQueued ) % _frames.size()];
+    }
+
+    // The writer does not touch the free buffers, and the buffers only grow
+    const float* channels[Trajectory::ChannelCount] =
+    {
+        particles.positions( 0 ), particles.positions( 1 ), particles.positions( 2 ),
+        particles.velocities( 0 ), particles.velocities( 1 ), particles.velocities( 2 ),
+        particles.densities()
+    };
+
+    frame->header.step = step;
+    frame->header.time = time;
+    frame->header.nbParticles = nbParticles;
+    frame->values.resize( Trajectory::ChannelCount * nbParticles );
+
+    for ( unsigned int c=0 ; c<Trajectory::ChannelCount ; ++c )
+        std::memcpy( frame->values.data() + c * nbParticles, channels[c], nbParticles * sizeof( float ) );
+
+    frame->identifiers.resize( nbParticles );
+    std::memcpy( frame->identifiers.data(), particles.identifiers(), nbParticles * sizeof( quint32 ) );
+
+    QMutexLocker locker( &_mutex );
+    ++_nbQueued;
+    _frameQueued.wakeOne();
+
+    return true;
+}
+
+bool TrajectoryWriter::close()
+{
+    if ( !isRunning() && !_file.isOpen() )
+        return !_failed;
+
+    {
+        QMutexLocker locker( &_mutex );
+        _closing = true;
+        _frameQueued.wakeOne();
+    }
+
+    wait();
+
+    // The index of the frames
+    Trajectory::IndexTrailer trailer;
+    trailer.nbFrames = _frameOffsets.size();
+    trailer.indexOffset = _nbWrittenBytes;
+    std::memcpy( trailer.magic, Trajectory::IndexMagic, sizeof( trailer.magic ) );
+
+    if ( !_failed )
+        _failed = !write( _frameOffsets.constData(), _frameOffsets.size() * sizeof( quint64 ) ) ||
+                  !write( &trailer, sizeof( trailer ) ) || !_file.flush();
+
+    _file.close();
+    return !_failed;
+}
+
+bool TrajectoryWriter::failed() const
+{
+    QMutexLocker locker( &_mutex );
+    return _failed;
+}
+
+quint64 TrajectoryWriter::nbWrittenFrames() const
+{
+    QMutexLocker locker( &_mutex );
+    return _nbWrittenFrames;
+}
+
+quint64 TrajectoryWriter::nbDroppedFrames() const
+{
+    QMutexLocker locker( &_mutex );
+    return _nbDroppedFrames;
+}
+
+qint64 TrajectoryWriter::nbWrittenBytes() const
+{
+    QMutexLocker locker( &_mutex );
+    return _nbWrittenBytes;
+}
+
+void TrajectoryWriter::run()
+{
+    QMutexLocker locker( &_mutex );
+
+    for ( ;; )
+    {
+        while ( _nbQueued == 0 && !_closing )
+            _frameQueued.wait( &_mutex );
+
+        if ( _nbQueued == 0 )
+            break;
+
+        // The queued buffers are not touched by 'record'
+        Frame& frame = _frames[_first];
+        locker.unlock();
+        bool written = writeFrame( frame );
+        locker.relock();
+
+        _first = ( _first + 1 ) % _frames.size();
+        --_nbQueued;
+        _frameFreed.wakeOne();
+
+        if ( !written )
+        {
+            _failed = true;
+            _frameFreed.wakeAll();
+            break;
+        }
+
+        ++_nbWrittenFrames;
+    }
+}
+
+bool TrajectoryWriter::writeFrame( Frame& frame )
+{
+    int nbParticles = frame.header.nbParticles;
+    const char* values = reinterpret_cast<const char*>( frame.values.constData() );
+    qint64 valuesSize = frame.values.size() * sizeof( float );
+    unsigned int valueSize = sizeof( float );
+    const char* identifiers = reinterpret_cast<const char*>( frame.identifiers.constData() );
+    qint64 identifiersSize = frame.identifiers.size() * sizeof( quint32 );
+
+    frame.header.encoding = 0;
+
+    for ( unsigned int c=0 ; c<Trajectory::ChannelCount ; ++c )
+    {
+        frame.header.minimum[c] = 0;
+        frame.header.maximum[c] = 0;
+    }
+
+    if ( _quantization )
+    {
+        _encoded.resize( frame.values.size() * sizeof( quint16 ) );
+        quint16* quantized = reinterpret_cast<quint16*>( _encoded.data() );
+
+        for ( unsigned int c=0 ; c<Trajectory::ChannelCount ; ++c )
+            quantize( frame.values.constData() + c * nbParticles, nbParticles, quantized + c * nbParticles,
+                      frame.header.minimum[c], frame.header.maximum[c] );
+
+        frame.header.encoding |= Trajectory::EncodingQuantized;
+        values = _encoded.constData();
+        valuesSize = _encoded.size();
+        valueSize = sizeof( quint16 );
+    }
+
+    frame.header.rawSize = valuesSize + identifiersSize;
+    frame.header.payloadSize = frame.header.rawSize;
+
+    QByteArray compressed;
+
+    if ( _compressionLevel > 0 )
+    {
+        QByteArray shuffled( int( frame.header.rawSize ), 0 );
+        shuffleBytes( values, valuesSize, valueSize, shuffled.data() );
+        shuffleBytes( identifiers, identifiersSize, sizeof( quint32 ), shuffled.data() + valuesSize );
+        compressed = qCompress( shuffled, _compressionLevel );
+
+        frame.header.encoding |= Trajectory::EncodingCompressed;
+        frame.header.payloadSize = compressed.size();
+    }
+
+    quint64 offset = _nbWrittenBytes;
+
+    if ( !write( &frame.header, sizeof( frame.header ) ) )
+        return false;
+
+    if ( _compressionLevel > 0 ? !write( compressed.constData(), compressed.size() )
+                               : !write( values, valuesSize ) || !write( identifiers, identifiersSize ) )
+        return false;
+
+    _frameOffsets.append( offset );
+    return true;
+}
+
+bool TrajectoryWriter::write( const void* data, qint64 size )
+{
+    if ( _file.write( static_cast<const char*>( data ), size ) != size )
+        return false;
+
+    QMutexLocker locker( &_mutex );
+    _nbWrittenBytes += size;
+    return true;
+}
@@ -0,0 +1,104 @@
+#ifndef TRAJECTORYWRITER_H
+#define TRAJECTORYWRITER_H
+
+#include "SPH/Particles.h"
+#include "SPH/Trajectory.h"
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+/* Records the positions, velocities and densities of the particles every few
+ * steps into a trajectory file ( see Trajectory ), from a background thread.
+ *
+ * The simulation thread only copies the particle streams into a free buffer
+ * of a fixed ring, the writer thread then encodes and writes the buffers in
+ * order. When the writer falls behind and every buffer is in use, a capture
+ * either waits for a free buffer ( OverflowBlock ) or is dropped and counted
+ * ( OverflowDrop ), so that a slow disk never stalls the simulation.
+ *
+ * The settings must be chosen before 'open'. With a decomposition ( see
+ * SlabDecomposition ), each process records the particles it owns, without
+ * its halo.
+ */
+
+class TrajectoryWriter : public QThread
+{
+public:
+    enum Overflow { OverflowBlock, OverflowDrop };
+
+    TrajectoryWriter();
+    virtual ~TrajectoryWriter();
+
+    // A capture every 'nbSteps' calls to 'record'
+    void setInterval( unsigned int nbSteps );
+    void setBufferCount( unsigned int nbBuffers );
+    void setOverflow( Overflow overflow );
+    static const char* overflowName( Overflow overflow );
+
+    // 16 bit values instead of floats, and zlib compression from 1 ( fastest )
+    // to 9 ( smallest ), 0 stores the values as they are
+    void setQuantization( bool quantization );
+    void setCompressionLevel( int level );
+
+    // Starts the writer thread, false when the file cannot be created
+    bool open( const QString& fileName );
+
+    // To be called after every step, with the number of particles to record
+    // from the first one : every particle, or the owned ones with a
+    // decomposition ( see SlabDecomposition::nbOwnedParticles ). Returns false
+    // when the capture was dropped or the writer failed.
+    bool record( const Particles& particles, int nbParticles, double time );
+
+    // Writes the remaining captures and the index, and stops the thread.
+    // Returns false when a write failed.
+    bool close();
+
+    bool failed() const;
+    quint64 nbWrittenFrames() const;
+    quint64 nbDroppedFrames() const;
+    qint64 nbWrittenBytes() const;
+
+protected:
+    virtual void run();
+
+private:
+    struct Frame
+    {
+        Trajectory::FrameHeader header;
+        QVector<float> values;  // One stream of 'nbParticles' values per channel
+        QVector<quint32> identifiers;
+    };
+
+    bool writeFrame( Frame& frame );
+    bool write( const void* data, qint64 size );
+
+private:
+    unsigned int _interval;
+    Overflow _overflow;
+    bool _quantization;
+    int _compressionLevel;
+
+    QFile _file;
+    QVector<quint64> _frameOffsets;
+    qint64 _nbWrittenBytes;
+    QByteArray _encoded;
+
+    // Ring of captures : '_nbQueued' buffers from '_first' are waiting for the
+    // writer, the others are free
+    QVector<Frame> _frames;
+    int _first;
+    int _nbQueued;
+    bool _closing;
+    bool _failed;
+    quint64 _nbSteps;
+    quint64 _nbWrittenFrames;
+    quint64 _nbDroppedFrames;
+    mutable QMutex _mutex;
+    QWaitCondition _frameQueued;
+    QWaitCondition _frameFreed;
+};
+
+#endif // TRAJECTORYWRITER_H
@@ -0,0 +1,607 @@
+#include "Transport.h"
+#include <QtGlobal>
+#include <algorithm>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <new>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+namespace
+{
+    // Bytes of the length that precedes each message
+    const qint64 HeaderSize = sizeof( quint64 );
+
+#ifdef Q_OS_UNIX
+    // One non blocking stream socket per peer
+    class SocketTransport : public Transport
+    {
+    public:
+        // Keeps the sockets of 'rank' in 'sockets[rank][peer]' and closes the others
+        SocketTransport( int rank, int nbRanks, const QVector<QVector<int> >& sockets )
+            : Transport( rank, nbRanks )
+            , _sockets( sockets[rank] )
+        {
+            for ( int r=0 ; r<nbRanks ; ++r )
+                for ( int peer=0 ; peer<nbRanks ; ++peer )
+                    if ( r != rank && sockets[r][peer] >= 0 )
+                        ::close( sockets[r][peer] );
+
+            for ( int peer=0 ; peer<nbRanks ; ++peer )
+                if ( _sockets[peer] >= 0 )
+                    ::fcntl( _sockets[peer], F_SETFL, ::fcntl( _sockets[peer], F_GETFL ) | O_NONBLOCK );
+        }
+
+        virtual ~SocketTransport()
+        {
+            for ( int peer=0 ; peer<_sockets.size() ; ++peer )
+                if ( _sockets[peer] >= 0 )
+                    ::close( _sockets[peer] );
+        }
+
+    protected:
+        virtual qint64 writeSome( int peer, const char* data, qint64 size )
+        {
+            ssize_t written = ::send( _sockets[peer], data, size, MSG_NOSIGNAL );
+
+            if ( written < 0 )
+                return ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) ? 0 : -1;
+
+            return written;
+        }
+
+        virtual qint64 readSome( int peer, char* data, qint64 size )
+        {
+            ssize_t count = ::recv( _sockets[peer], data, size, 0 );
+
+            // The peer closed its end before the message was complete
+            if ( count == 0 )
+                return -1;
+
+            if ( count < 0 )
+                return ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) ? 0 : -1;
+
+            return count;
+        }
+
+        virtual bool waitForProgress( const QVector<bool>& writing, const QVector<bool>& reading )
+        {
+            QVector<pollfd> descriptors;
+
+            for ( int peer=0 ; peer<_sockets.size() ; ++peer )
+            {
+                if ( !writing[peer] && !reading[peer] )
+                    continue;
+
+                pollfd descriptor;
+                descriptor.fd = _sockets[peer];
+                descriptor.events = ( writing[peer] ? POLLOUT : 0 ) | ( reading[peer] ? POLLIN : 0 );
+                descriptor.revents = 0;
+                descriptors.append( descriptor );
+            }
+
+            return ::poll( descriptors.data(), descriptors.size(), -1 ) >= 0 || errno == EINTR;
+        }
+
+    private:
+        QVector<int> _sockets;
+    };
+
+    // One single producer, single consumer ring buffer per ordered pair of
+    // ranks. The counters only grow, their difference is the used size. They
+    // are written by different processes, hence on separate cache lines.
+    struct Ring
+    {
+        alignas( 64 ) std::atomic<quint64> head;
+        alignas( 64 ) std::atomic<quint64> tail;
+    };
+
+    // Where a rank sleeps while its transfers are stuck : the peers bump
+    // 'sequence' whenever they add data for it or make room for it
+    struct Mailbox
+    {
+        alignas( 64 ) std::atomic<quint32> sequence;
+        std::atomic<quint32> sleepers;
+        std::atomic<qint64> pid;
+    };
+
+    // Set by the first rank that sees a peer die, so that all the others give up
+    struct Control
+    {
+        alignas( 64 ) std::atomic<quint32> failed;
+    };
+
+    // How long a rank sleeps before checking again that its peers are alive
+    const long LivenessPeriod = 10000000; // ns
+
+    class SharedMemoryTransport : public Transport
+    {
+    public:
+        static const qint64 RingCapacity = 1 << 18;
+
+        static qint64 mappingSize( int nbRanks )
+        {
+            return sizeof( Control ) + nbRanks * sizeof( Mailbox ) + qint64( nbRanks ) * nbRanks * ( sizeof( Ring ) + RingCapacity );
+        }
+
+        // Constructs the shared structures in a new mapping. The process ids
+        // of the other ranks are set by the original process once forked.
+        static void initialize( void* mapping, int nbRanks )
+        {
+            char* bytes = static_cast<char*>( mapping );
+
+            new ( bytes ) Control();
+            static_cast<Control*>( mapping )->failed.store( 0 );
+            bytes += sizeof( Control );
+
+            for ( int r=0 ; r<nbRanks ; ++r, bytes += sizeof( Mailbox ) )
+            {
+                Mailbox* mailbox = new ( bytes ) Mailbox();
+                mailbox->sequence.store( 0 );
+                mailbox->sleepers.store( 0 );
+                mailbox->pid.store( r == 0 ? ::getpid() : 0 );
+            }
+
+            for ( int i=0 ; i<nbRanks * nbRanks ; ++i, bytes += sizeof( Ring ) )
+            {
+                Ring* ring = new ( bytes ) Ring();
+                ring->head.store( 0 );
+                ring->tail.store( 0 );
+            }
+        }
+
+        static void setProcess( void* mapping, int rank, qint64 pid )
+        {
+            reinterpret_cast<Mailbox*>( static_cast<char*>( mapping ) + sizeof( Control ) )[rank].pid.store( pid );
+        }
+
+        // The mapping must be created before the fork, with the rings initialized
+        SharedMemoryTransport( int rank, int nbRanks, void* mapping )
+            : Transport( rank, nbRanks )
+            , _mapping( static_cast<char*>( mapping ) )
+        {
+        }
+
+        virtual ~SharedMemoryTransport()
+        {
+            ::munmap( _mapping, mappingSize( nbRanks() ) );
+        }
+
+    protected:
+        virtual qint64 writeSome( int peer, const char* data, qint64 size )
+        {
+            Ring* ring = this->ring( rank(), peer );
+            char* buffer = this->buffer( rank(), peer );
+            quint64 head = ring->head.load( std::memory_order_relaxed );
+            quint64 tail = ring->tail.load( std::memory_order_acquire );
+            qint64 count = std::min<qint64>( size, RingCapacity - qint64( head - tail ) );
+
+            for ( qint64 copied=0 ; copied<count ; )
+            {
+                qint64 offset = ( head + copied ) % RingCapacity;
+                qint64 chunk = std::min( count - copied, RingCapacity - offset );
+
+                std::memcpy( buffer + offset, data + copied, chunk );
+                copied += chunk;
+            }
+
+            ring->head.store( head + count, std::memory_order_release );
+
+            if ( count > 0 )
+                notify( peer );
+
+            return count;
+        }
+
+        virtual qint64 readSome( int peer, char* data, qint64 size )
+        {
+            Ring* ring = this->ring( peer, rank() );
+            const char* buffer = this->buffer( peer, rank() );
+            quint64 tail = ring->tail.load( std::memory_order_relaxed );
+            quint64 head = ring->head.load( std::memory_order_acquire );
+            qint64 count = std::min<qint64>( size, qint64( head - tail ) );
+
+            for ( qint64 copied=0 ; copied<count ; )
+            {
+                qint64 offset = ( tail + copied ) % RingCapacity;
+                qint64 chunk = std::min( count - copied, RingCapacity - offset );
+
+                std::memcpy( data + copied, buffer + offset, chunk );
+                copied += chunk;
+            }
+
+            ring->tail.store( tail + count, std::memory_order_release );
+
+            if ( count > 0 )
+                notify( peer );
+
+            return count;
+        }
+
+        virtual bool waitForProgress( const QVector<bool>& writing, const QVector<bool>& reading )
+        {
+            Mailbox* mailbox = this->mailbox( rank() );
+
+            // Announce the sleep before sampling the sequence, so that a peer
+            // bumping it afterwards either is seen here or wakes this rank
+            mailbox->sleepers.fetch_add( 1 );
+            quint32 sequence = mailbox->sequence.load();
+            bool progress = canProgress( writing, reading );
+            bool alive = !progress && peersAlive( writing, reading );
+
+            if ( !progress && alive )
+                sleep( mailbox, sequence );
+
+            mailbox->sleepers.fetch_sub( 1 );
+
+            if ( progress || alive )
+                return true;
+
+            // Data sent by a rank that exited normally right before the check
+            // may still be waiting in the rings
+            if ( canProgress( writing, reading ) )
+                return true;
+
+            fail();
+            return false;
+        }
+
+    private:
+        // Whether one of the pending transfers would move some bytes
+        bool canProgress( const QVector<bool>& writing, const QVector<bool>& reading ) const
+        {
+            for ( int peer=0 ; peer<nbRanks() ; ++peer )
+            {
+                if ( writing[peer] )
+                {
+                    const Ring* ring = this->ring( rank(), peer );
+
+                    if ( ring->head.load() - ring->tail.load() < quint64( RingCapacity ) )
+                        return true;
+                }
+
+                if ( reading[peer] )
+                {
+                    const Ring* ring = this->ring( peer, rank() );
+
+                    if ( ring->head.load() != ring->tail.load() )
+                        return true;
+                }
+            }
+
+            return false;
+        }
+
+        // The original process reaps its children as they exit, the others
+        // are reparented when it dies. A rank waiting on a sibling that died
+        // is released by the original process through the failure flag.
+        bool peersAlive( const QVector<bool>& writing, const QVector<bool>& reading ) const
+        {
+            if ( control()->failed.load() )
+                return false;
+
+            if ( rank() != 0 )
+                return ::getppid() == pid_t( mailbox( 0 )->pid.load() );
+
+            for ( int peer=1 ; peer<nbRanks() ; ++peer )
+            {
+                pid_t pid = pid_t( mailbox( peer )->pid.load() );
+
+                if ( ( writing[peer] || reading[peer] ) && pid > 0 && ::waitpid( pid, 0, WNOHANG ) != 0 )
+                    return false;
+            }
+
+            return true;
+        }
+
+        // Blocks until 'mailbox' no longer holds 'sequence', or for the liveness period
+        void sleep( Mailbox* mailbox, quint32 sequence ) const
+        {
+#ifdef Q_OS_LINUX
+            timespec timeout = { 0, LivenessPeriod };
+            ::syscall( SYS_futex, reinterpret_cast<quint32*>( &mailbox->sequence ), FUTEX_WAIT, sequence, &timeout, 0, 0 );
+#else
+            if ( mailbox->sequence.load() == sequence )
+                ::usleep( 100 );
+#endif
+        }
+
+        void notify( int peer )
+        {
+            Mailbox* mailbox = this->mailbox( peer );
+
+            mailbox->sequence.fetch_add( 1 );
+
+#ifdef Q_OS_LINUX
+            if ( mailbox->sleepers.load() > 0 )
+                ::syscall( SYS_futex, reinterpret_cast<quint32*>( &mailbox->sequence ), FUTEX_WAKE, 1, 0, 0, 0 );
+#endif
+        }
+
+        // Releases all the ranks waiting on a peer that will never answer
+        void fail()
+        {
+            control()->failed.store( 1 );
+
+            for ( int r=0 ; r<nbRanks() ; ++r )
+                if ( r != rank() )
+                    notify( r );
+        }
+
+        Control* control() const
+        {
+            return reinterpret_cast<Control*>( _mapping );
+        }
+
+        Mailbox* mailbox( int rank ) const
+        {
+            return reinterpret_cast<Mailbox*>( _mapping + sizeof( Control ) ) + rank;
+        }
+
+        Ring* ring( int from, int to ) const
+        {
+            return reinterpret_cast<Ring*>( _mapping + sizeof( Control ) + nbRanks() * sizeof( Mailbox ) ) + from * nbRanks() + to;
+        }
+
+        char* buffer( int from, int to ) const
+        {
+            char* buffers = reinterpret_cast<char*>( ring( nbRanks(), 0 ) );
+
+            return buffers + ( qint64( from ) * nbRanks() + to ) * RingCapacity;
+        }
+
+    private:
+        char* _mapping;
+    };
+#endif
+}
+
+Transport::Transport( int rank, int nbRanks )
+    : _rank( rank )
+    , _nbRanks( nbRanks )
+{
+}
+
+Transport::~Transport()
+{
+#ifdef Q_OS_UNIX
+    for ( int i=0 ; i<_children.size() ; ++i )
+        ::waitpid( pid_t( _children[i] ), 0, 0 );
+#endif
+}
+
+Transport* Transport::launch( Kind kind, int nbRanks )
+{
+#ifdef Q_OS_UNIX
+    if ( nbRanks < 1 )
+        return 0;
+
+    // Channels between every pair of ranks, inherited by the forked processes
+    QVector<QVector<int> > sockets( nbRanks, QVector<int>( nbRanks, -1 ) );
+    void* mapping = 0;
+
+    if ( kind == TransportSocket )
+    {
+        for ( int i=0 ; i<nbRanks ; ++i )
+            for ( int j=i+1 ; j<nbRanks ; ++j )
+            {
+                int pair[2];
+
+                if ( ::socketpair( AF_UNIX, SOCK_STREAM, 0, pair ) < 0 )
+                    return 0;
+
+                sockets[i][j] = pair[0];
+                sockets[j][i] = pair[1];
+            }
+    }
+    else
+    {
+        mapping = ::mmap( 0, SharedMemoryTransport::mappingSize( nbRanks ), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+
+        if ( mapping == MAP_FAILED )
+            return 0;
+
+        SharedMemoryTransport::initialize( mapping, nbRanks );
+    }
+
+    QVector<qint64> children;
+
+    for ( int rank=1 ; rank<nbRanks ; ++rank )
+    {
+        pid_t pid = ::fork();
+
+        if ( pid < 0 )
+            break;
+
+        if ( pid == 0 )
+        {
+            if ( kind == TransportSocket )
+                return new SocketTransport( rank, nbRanks, sockets );
+
+            return new SharedMemoryTransport( rank, nbRanks, mapping );
+        }
+
+        children.append( pid );
+
+        if ( kind == TransportSharedMemory )
+            SharedMemoryTransport::setProcess( mapping, rank, pid );
+    }
+
+    Transport* transport = 0;
+
+    if ( kind == TransportSocket )
+        transport = new SocketTransport( 0, nbRanks, sockets );
+    else
+        transport = new SharedMemoryTransport( 0, nbRanks, mapping );
+
+    // The ranks already forked see the failure as a closed channel
+    transport->_children = children;
+
+    if ( children.size() != nbRanks - 1 )
+    {
+        delete transport;
+        return 0;
+    }
+
+    return transport;
+#else
+    Q_UNUSED( kind );
+    Q_UNUSED( nbRanks );
+    return 0;
+#endif
+}
+
+const char* Transport::kindName( Kind kind )
+{
+    switch ( kind )
+    {
+        case TransportSocket : return "socket";
+        case TransportSharedMemory : return "shm";
+    }
+
+    return "";
+}
+
+int Transport::rank() const
+{
+    return _rank;
+}
+
+int Transport::nbRanks() const
+{
+    return _nbRanks;
+}
+
+bool Transport::exchange( const QVector<QByteArray>& outgoing, QVector<QByteArray>& incoming )
+{
+    // Each message is preceded by its length
+    QVector<QByteArray> frames( _nbRanks );
+    QVector<qint64> sent( _nbRanks, 0 );
+    QVector<QByteArray> headers( _nbRanks, QByteArray( HeaderSize, 0 ) );
+    QVector<qint64> received( _nbRanks, 0 );
+    QVector<bool> writing( _nbRanks, false );
+    QVector<bool> reading( _nbRanks, false );
+
+    incoming.fill( QByteArray(), _nbRanks );
+
+    for ( int peer=0 ; peer<_nbRanks ; ++peer )
+    {
+        if ( peer == _rank )
+            continue;
+
+        quint64 size = outgoing[peer].size();
+        frames[peer] = QByteArray( reinterpret_cast<const char*>( &size ), HeaderSize ) + outgoing[peer];
+        writing[peer] = true;
+        reading[peer] = true;
+    }
+
+    while ( writing.contains( true ) || reading.contains( true ) )
+    {
+        bool progress = false;
+
+        for ( int peer=0 ; peer<_nbRanks ; ++peer )
+        {
+            if ( writing[peer] )
+            {
+                qint64 count = writeSome( peer, frames[peer].constData() + sent[peer], frames[peer].size() - sent[peer] );
+                if ( count < 0 )
+                    return false;
+
+                sent[peer] += count;
+                writing[peer] = sent[peer] < frames[peer].size();
+                progress = progress || count > 0;
+            }
+
+            if ( reading[peer] )
+            {
+                // The header, then the message once its length is known
+                qint64 count = 0;
+
+                if ( received[peer] < HeaderSize )
+                    count = readSome( peer, headers[peer].data() + received[peer], HeaderSize - received[peer] );
+                else
+                    count = readSome( peer, incoming[peer].data() + received[peer] - HeaderSize,
+                                      incoming[peer].size() + HeaderSize - received[peer] );
+
+                if ( count < 0 )
+                    return false;
+
+                received[peer] += count;
+                progress = progress || count > 0;
+
+                if ( received[peer] == HeaderSize && count > 0 )
+                {
+                    quint64 size = 0;
+                    std::memcpy( &size, headers[peer].constData(), HeaderSize );
+                    incoming[peer].resize( int( size ) );
+                }
+
+                reading[peer] = received[peer] < HeaderSize || received[peer] < incoming[peer].size() + HeaderSize;
+            }
+        }
+
+        if ( !progress && !waitForProgress( writing, reading ) )
+            return false;
+    }
+
+    return true;
+}
+
+bool Transport::minimum( float& value )
+{
+    QVector<QByteArray> outgoing( _nbRanks, QByteArray( reinterpret_cast<const char*>( &value ), sizeof( value ) ) );
+    QVector<QByteArray> incoming;
+
+    if ( !exchange( outgoing, incoming ) )
+        return false;
+
+    for ( int peer=0 ; peer<_nbRanks ; ++peer )
+    {
+        float other = value;
+
+        if ( peer != _rank && incoming[peer].size() == sizeof( other ) )
+            std::memcpy( &other, incoming[peer].constData(), sizeof( other ) );
+
+        value = std::min( value, other );
+    }
+
+    return true;
+}
+
+bool Transport::sum( qint64& value )
+{
+    QVector<QByteArray> outgoing( _nbRanks, QByteArray( reinterpret_cast<const char*>( &value ), sizeof( value ) ) );
+    QVector<QByteArray> incoming;
+    qint64 total = value;
+
+    if ( !exchange( outgoing, incoming ) )
+        return false;
+
+    for ( int peer=0 ; peer<_nbRanks ; ++peer )
+    {
+        qint64 other = 0;
+
+        if ( peer != _rank && incoming[peer].size() == sizeof( other ) )
+            std::memcpy( &other, incoming[peer].constData(), sizeof( other ) );
+
+        total += other;
+    }
+
+    value = total;
+    return true;
+}
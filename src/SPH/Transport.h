@@ -0,0 +1,66 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <QByteArray>
+#include <QVector>
+
+/* Messages between the processes of a distributed simulation ( see
+ * SlabDecomposition ), each process being a 'rank' from 0 to 'nbRanks' - 1.
+ * The processes are forked on the same machine, and connected by :
+ *   - TransportSocket : one pair of Unix domain sockets per pair of ranks.
+ *   - TransportSharedMemory : one ring buffer per ordered pair of ranks, in a
+ *     mapping shared by all the processes.
+ *
+ * The messages are raw bytes, since all the ranks run the same executable on
+ * the same machine. The transfers are non blocking internally, so that every
+ * rank can send and receive at the same time whatever the message sizes.
+ * Errors are reported by returning false, also when a rank waits on another
+ * one that exited : closed sockets, or a dead process for the shared memory.
+ *
+ * Only available on Unix, 'launch' returns 0 elsewhere.
+ */
+
+class Transport
+{
+public:
+    enum Kind { TransportSocket, TransportSharedMemory };
+
+    // Forks 'nbRanks' - 1 processes connected to this one, and returns the
+    // transport of the calling process ( rank 0 in the original process ).
+    // Must be called before any OpenMP region, the thread pool does not
+    // survive a fork. Returns 0 on failure.
+    static Transport* launch( Kind kind, int nbRanks );
+    static const char* kindName( Kind kind );
+
+    // The original process waits for the other ranks to exit
+    virtual ~Transport();
+
+    int rank() const;
+    int nbRanks() const;
+
+    // Sends 'outgoing[r]' to every other rank 'r' and receives 'incoming[r]'
+    // from it. The entries of the calling rank are left empty.
+    bool exchange( const QVector<QByteArray>& outgoing, QVector<QByteArray>& incoming );
+
+    // Reductions over all the ranks
+    bool minimum( float& value );
+    bool sum( qint64& value );
+
+protected:
+    Transport( int rank, int nbRanks );
+
+    // Moves at most 'size' bytes to or from 'peer' without blocking, and
+    // returns their number, or -1 on error
+    virtual qint64 writeSome( int peer, const char* data, qint64 size ) = 0;
+    virtual qint64 readSome( int peer, char* data, qint64 size ) = 0;
+
+    // Blocks until one of the pending transfers may progress
+    virtual bool waitForProgress( const QVector<bool>& writing, const QVector<bool>& reading ) = 0;
+
+private:
+    int _rank;
+    int _nbRanks;
+    QVector<qint64> _children;  // Process ids of the other ranks, in the original process
+};
+
+#endif // TRANSPORT_H
@@ -0,0 +1,30 @@
+#include "SceneFactory.h"
+#include "Scenes/SceneCube.h"
+#include "Scenes/SceneCylinder.h"
+#include "Scenes/SceneSphere.h"
+#include "Scenes/SceneSphereHighRes.h"
+
+QStringList SceneFactory::names()
+{
+    QStringList names;
+    names << "sphere" << "cube" << "cylinder" << "sphere-highres";
+
+    return names;
+}
+
+Scene* SceneFactory::create( const QString& name )
+{
+    if ( name == "sphere" )
+        return new SceneSphere;
+
+    if ( name == "cube" )
+        return new SceneCube;
+
+    if ( name == "cylinder" )
+        return new SceneCylinder;
+
+    if ( name == "sphere-highres" )
+        return new SceneSphereHighRes;
+
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef SCENEFACTORY_H
+#define SCENEFACTORY_H
+
+#include "Scenes/Scene.h"
+#include <QStringList>
+
+/* Creates the scenes from a short name ( "sphere", "cube", ... ), for the
+ * command line targets that do not have the scene list widget.
+ */
+
+class SceneFactory
+{
+public:
+    static QStringList names();
+    static Scene* create( const QString& name );
+};
+
+#endif // SCENEFACTORY_H
@@ -13,6 +13,9 @@ SceneSphereHighRes::SceneSphereHighRes()
               QVector3D( 0, -9.81, 0 ) )
 {
     _sphere.setParent( &_water );
+    _water.setGridStorageMode( Grid::StorageCountingSort );
+    _water.setGridNeighborhoodMode( Grid::NeighborhoodStencil );
+    _water.setAdaptiveTimeStep( true );
     _camera.lookAt( QVector3D(  0,  2, -2 ),
                     QVector3D(  0,  0,  0 ),
                     QVector3D(  0,  1,  0 ) );
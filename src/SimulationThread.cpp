@@ -0,0 +1,99 @@
+#include "SimulationThread.h"
+
+SimulationThread::SimulationThread()
+    : _scene( 0 )
+    , _stopping( false )
+    , _paused( false )
+    , _resetVelocities( false )
+{
+}
+
+SimulationThread::~SimulationThread()
+{
+    stop();
+}
+
+void SimulationThread::simulate( Scene* scene )
+{
+    stop();
+
+    if ( !scene )
+        return;
+
+    _scene = scene;
+    _stopping = false;
+    _scene->sph().setPipelined( true );
+
+    start();
+}
+
+void SimulationThread::stop()
+{
+    if ( !_scene )
+        return;
+
+    _stopping = true;
+    wait();
+
+    applyRequests();
+    _scene->sph().setPipelined( false );
+    _scene = 0;
+}
+
+void SimulationThread::setPaused( bool paused )
+{
+    _paused = paused;
+}
+
+void SimulationThread::resetVelocities()
+{
+    _resetVelocities = true;
+}
+
+void SimulationThread::moveContainer( const QMatrix4x4& transformation )
+{
+    _containerTransformations.writeFrame() = transformation;
+    _containerTransformations.publish();
+}
+
+void SimulationThread::run()
+{
+    SPH& sph = _scene->sph();
+    TimeState timeState;
+
+    while ( !_stopping )
+    {
+        timeState.newFrame();
+
+        bool moved = applyRequests();
+
+        // A paused simulation only publishes the moves of the container
+        if ( _paused && !moved )
+        {
+            msleep( 5 );
+            continue;
+        }
+
+        if ( !_paused )
+            sph.animate( timeState );
+
+        sph.publishFrame();
+    }
+}
+
+bool SimulationThread::applyRequests()
+{
+    SPH& sph = _scene->sph();
+    bool moved = _containerTransformations.acquire();
+
+    if ( moved )
+    {
+        sph.localTransformation() = _containerTransformations.readFrame();
+        sph.update();
+    }
+
+    if ( _resetVelocities.exchange( false ) )
+        sph.resetVelocities();
+
+    return moved;
+}
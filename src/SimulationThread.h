@@ -0,0 +1,54 @@
+#ifndef SIMULATION_THREAD_H
+#define SIMULATION_THREAD_H
+
+#include "Scenes/Scene.h"
+#include "SPH/FrameExchange.h"
+#include "TimeState.h"
+#include <QMatrix4x4>
+#include <QThread>
+#include <atomic>
+
+/* Steps the SPH of a scene on its own thread, while the GUI thread renders
+ * the frames it publishes ( see SPH::setPipelined ). A frame then costs the
+ * longest of a step and a rendering instead of both.
+ *
+ * While the thread runs, the GUI thread must not touch the simulation : the
+ * container moves, pauses and velocity resets are handed to the thread, which
+ * applies them between two steps. Every hand-off is lock-free.
+ */
+
+class SimulationThread : public QThread
+{
+public:
+    SimulationThread();
+    virtual ~SimulationThread();
+
+    // Starts stepping 'scene', after stopping the previous one
+    void simulate( Scene* scene );
+
+    // Waits for the step in progress and applies the pending requests. The
+    // scene then renders its own particles again.
+    void stop();
+
+    void setPaused( bool paused );
+    void resetVelocities();
+
+    // Local transformation of the SPH ( its container ) for the next step
+    void moveContainer( const QMatrix4x4& transformation );
+
+protected:
+    virtual void run();
+
+private:
+    // Returns true when the container moved
+    bool applyRequests();
+
+private:
+    Scene* _scene;
+    std::atomic<bool> _stopping;
+    std::atomic<bool> _paused;
+    std::atomic<bool> _resetVelocities;
+    FrameExchange<QMatrix4x4> _containerTransformations;
+};
+
+#endif // SIMULATION_THREAD_H
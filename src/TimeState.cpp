@@ -9,7 +9,7 @@ TimeState::TimeState()
 
 void TimeState::newFrame()
 {
-    _deltaTime = _timer.elapsed() / 1000.0;
+    _deltaTime = _timer.nsecsElapsed() / 1.0e9;
     _time += _deltaTime;
     _timer.restart();
 }
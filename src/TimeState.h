@@ -1,11 +1,12 @@
 #ifndef TIMESTATE_H
 #define TIMESTATE_H
 
-#include <QTime>
+#include <QElapsedTimer>
 
 /* TimeState contains the information about the time (in seconds)
  * for the current frame. deltaTime is the difference
- * in time between the current and the previous frame.
+ * in time between the current and the previous frame, measured in
+ * nanoseconds so that frames shorter than a millisecond still advance.
  */
 
 class TimeState
@@ -18,7 +19,7 @@ public:
     float deltaTime() const;
 
 private:
-    QTime _timer;
+    QElapsedTimer _timer;
     float _time;
     float _deltaTime;
 };